@@ -0,0 +1,75 @@
+#ifndef H_BIN_GRID
+#define H_BIN_GRID
+
+#include <cstddef>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+
+#include "core/named_func.hpp"
+#include "core/gamma_params.hpp"
+
+class Baby;
+
+class BinGrid{
+public:
+  typedef std::map<std::string, std::pair<double, double> > Ranges;//!<Axis name -> (low, high] range
+
+  explicit BinGrid(const NamedFunc &cut = true);
+  BinGrid(const BinGrid &) = default;
+  BinGrid& operator=(const BinGrid &) = default;
+  BinGrid(BinGrid &&) = default;
+  BinGrid& operator=(BinGrid &&) = default;
+  ~BinGrid() = default;
+
+  BinGrid & AddAxis(const std::string &name,
+                    const NamedFunc &var,
+                    const std::vector<double> &edges);
+  BinGrid & AddRegion(const std::string &name,
+                      const Ranges &ranges = Ranges());
+  BinGrid & Cut(const NamedFunc &cut);
+  BinGrid & AxisVariable(const std::string &name, const NamedFunc &var);
+
+  const NamedFunc & Cut() const;
+  const NamedFunc & AxisVariable(const std::string &name) const;
+
+  std::size_t NumAxes() const;
+  std::size_t NumCells() const;
+  std::size_t NumRegions() const;
+  std::size_t RegionIndex(const std::string &name) const;
+  const std::string & RegionName(std::size_t iregion) const;
+  bool InRegion(std::size_t iregion, long cell) const;
+  NamedFunc RegionCut(const std::string &name) const;
+
+  long CellIndex(const Baby &baby, bool apply_cut = true) const;
+
+  void Fill(long cell, double weight = 1.);
+  long Fill(const Baby &baby, double weight = 1.);
+  void Clear();
+  BinGrid & operator+=(const BinGrid &other);
+
+  double SumW(std::size_t iregion) const;
+  double SumW2(std::size_t iregion) const;
+  long Entries(std::size_t iregion) const;
+  GammaParams Yield(std::size_t iregion) const;
+
+private:
+  NamedFunc cut_;//!<Selection applied before locating event in lattice
+  std::vector<std::string> names_;//!<Name of each axis
+  std::vector<NamedFunc> vars_;//!<Variable binned along each axis
+  std::vector<std::vector<double> > edges_;//!<Bin edges of each axis
+  std::vector<std::size_t> strides_;//!<Cell index stride of each axis
+  std::vector<std::string> region_names_;//!<Name of each region
+  std::vector<std::vector<std::size_t> > region_cells_;//!<Cells covered by each region
+  std::vector<std::vector<bool> > region_mask_;//!<Per-cell membership of each region
+  std::vector<std::string> region_cut_names_;//!<Text of cut equivalent to each region
+  std::vector<double> sumw_;//!<Sum of weights in each cell
+  std::vector<double> sumw2_;//!<Sum of squared weights in each cell
+  std::vector<long> entries_;//!<Number of events with non-zero weight in each cell
+
+  std::size_t AxisIndex(const std::string &name) const;
+};
+
+#endif
@@ -4,6 +4,7 @@
 #include <list>
 #include <set>
 #include <vector>
+#include <istream>
 #include <ostream>
 #include <random>
 
@@ -41,6 +42,9 @@ namespace Clustering{
                          long max_points = -1);
 
     void AddPoint(float x, float y, float w);
+
+    void Serialize(std::ostream &out) const;
+    void Merge(std::istream &in);
     
     void SetPoints(const std::vector<Point> &points);
     void SetPoints(const TH2D &h);
@@ -53,6 +57,7 @@ namespace Clustering{
     bool hist_mode_;
     TH2D hist_;
     std::vector<Point> orig_points_;
+    long grid_size_;
     mutable std::list<Node> nodes_;
     mutable std::vector<Point> final_points_;
     mutable float clustered_lumi_;
@@ -72,6 +77,7 @@ namespace Clustering{
 
     void EmptyHistogram();
     void ConvertToHist();
+    void Compact();
 
     void Cluster(double luminosity) const;
     void SetupNodes(double luminosity) const;
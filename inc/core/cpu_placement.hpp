@@ -0,0 +1,38 @@
+#ifndef H_CPU_PLACEMENT
+#define H_CPU_PLACEMENT
+
+#include <cstddef>
+
+#include <string>
+#include <vector>
+#include <mutex>
+
+class CpuPlacement{
+public:
+  enum class Policy{none, compact, scatter};
+
+  CpuPlacement(Policy policy, std::size_t num_threads);
+  CpuPlacement(const CpuPlacement &) = delete;
+  CpuPlacement& operator=(const CpuPlacement &) = delete;
+  CpuPlacement(CpuPlacement &&) = delete;
+  CpuPlacement& operator=(CpuPlacement &&) = delete;
+  ~CpuPlacement() = default;
+
+  void Pin(std::size_t iworker);
+  std::string Report() const;
+
+  static std::vector<int> AllowedCpus();
+  static Policy ParsePolicy(const std::string &name);
+  static std::string PolicyName(Policy policy);
+
+private:
+  Policy policy_;//!<How workers are spread over the allowed CPUs
+  std::vector<int> planned_cpus_;//!<CPU assigned to each worker, or -1 if unpinned
+  std::vector<int> observed_cpus_;//!<CPU each worker was running on after pinning
+  std::vector<int> node_of_cpu_;//!<NUMA node of each CPU
+  mutable std::mutex mutex_;
+
+  int Node(int cpu) const;
+};
+
+#endif
@@ -5,6 +5,10 @@
 #include <vector>
 #include <string>
 #include <fstream>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #include "core/figure.hpp"
 #include "core/process.hpp"
@@ -15,13 +19,26 @@ class EventScan final : public Figure{
  public:
    SingleScan(const EventScan &event_scan,
               const std::shared_ptr<Process> &process);
-   ~SingleScan() = default;
+   ~SingleScan();
 
    void RecordEvent(const Baby &baby) final;
 
    void Precision(unsigned precision);
+   void Flush();
 
  private:
+   //! Unformatted scan rows handed from the event loop to the writer thread
+   struct Batch{
+     std::vector<std::size_t> rows_;//!<Row number of each printed line
+     std::vector<std::size_t> instances_;//!<Instance number of each printed line
+     std::vector<NamedFunc::ScalarType> values_;//!<Column values, one block of columns per line
+     std::vector<char> filled_;//!<Whether each entry of values_ is set (false for missing vector elements)
+     unsigned precision_;//!<Significant digits with which values are printed
+   };
+
+   static const std::size_t max_batch_values_ = 1 << 16;//!<Values per batch before handing it to the writer
+   static const std::size_t max_queued_batches_ = 8;//!<Batches waiting to be written before RecordEvent blocks
+
    SingleScan() = delete;
    SingleScan(const SingleScan &) = delete;
    SingleScan& operator=(const SingleScan &) = delete;
@@ -33,6 +50,18 @@ class EventScan final : public Figure{
    NamedFunc::VectorType cut_vector_;//!<Cut results (to avoid creating new vector each event)
    std::vector<NamedFunc::VectorType> val_vectors_;//!<Values for each column (to avoid creating new vectors each event)
    std::size_t row_;
+   unsigned precision_;//!<Significant digits with which values are printed
+   Batch batch_;//!<Rows recorded since last hand-off to writer
+   std::deque<Batch> queue_;//!<Batches waiting to be written
+   std::mutex queue_mutex_;//!<Protects queue_, writing_, and done_
+   std::condition_variable queue_cv_;//!<Signals changes to queue_, writing_, or done_
+   bool writing_;//!<True while writer thread is formatting a batch
+   bool done_;//!<Tells writer thread to exit once queue_ is empty
+   std::thread writer_;//!<Thread formatting and writing batches to out_
+
+   void QueueBatch();
+   void WriteBatches();
+   void WriteBatch(const Batch &batch);
  };
 
  EventScan(const std::string &name,
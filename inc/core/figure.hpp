@@ -4,6 +4,8 @@
 #include <memory>
 #include <vector>
 #include <mutex>
+#include <istream>
+#include <ostream>
 
 #include "core/process.hpp"
 #include "core/baby.hpp"
@@ -19,6 +21,10 @@ public:
 
     virtual void RecordEvent(const Baby &baby) = 0;
 
+    virtual bool Mergeable() const;
+    virtual void Serialize(std::ostream &out) const;
+    virtual void Merge(std::istream &in);
+
     const Figure& figure_;//!<Reference to figure containing this component
     std::shared_ptr<Process> process_;//!<Process associated to this part of the figure
     std::mutex mutex_;
@@ -0,0 +1,52 @@
+#ifndef H_FILE_CATALOG
+#define H_FILE_CATALOG
+
+#include <cstdint>
+
+#include <string>
+#include <set>
+#include <unordered_map>
+#include <mutex>
+
+class FileCatalog{
+public:
+  static FileCatalog & Get();
+
+  std::set<std::string> Glob(const std::string &pattern);
+  long Entries(const std::string &path);
+  void SetEntries(const std::string &path, long entries);
+
+  const std::string & Path() const;
+
+private:
+  struct FileInfo{
+    std::int64_t size;//!<File size in bytes
+    std::int64_t mtime;//!<Modification time in ns since the epoch
+    long entries;//!<Entries in the file's tree
+  };
+
+  struct GlobInfo{
+    std::int64_t dir_mtime;//!<Modification time in ns of the directory holding the matches
+    std::set<std::string> matches;//!<Result of ::Glob() for the pattern
+  };
+
+  FileCatalog();
+  FileCatalog(const FileCatalog &) = delete;
+  FileCatalog& operator=(const FileCatalog &) = delete;
+  FileCatalog(FileCatalog &&) = delete;
+  FileCatalog& operator=(FileCatalog &&) = delete;
+  ~FileCatalog();
+
+  void Load(const std::string &path);
+  void Save();
+
+  static bool Stat(const std::string &path, std::int64_t &size, std::int64_t &mtime);
+
+  std::unordered_map<std::string, FileInfo> files_;//!<Metadata of ntuple files, keyed by real path
+  std::unordered_map<std::string, GlobInfo> globs_;//!<Cached glob expansions, keyed by pattern
+  std::string path_;//!<Catalog file on disk, empty to keep the catalog in memory only
+  bool modified_;//!<Catalog has changed since it was loaded
+  std::mutex mutex_;
+};
+
+#endif
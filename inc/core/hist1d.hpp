@@ -33,6 +33,9 @@ public:
     mutable TH1D scaled_hist_;//!<Kludge. Mutable storage of scaled and stacked histogram
 
     void RecordEvent(const Baby &baby) final;
+    bool Mergeable() const final;
+    void Serialize(std::ostream &out) const final;
+    void Merge(std::istream &in) final;
 
     double GetMax(double max_bound = std::numeric_limits<double>::infinity(),
                   bool include_error_bar = false,
@@ -24,6 +24,9 @@ public:
     Clustering::Clusterizer clusterizer_;
 
     void RecordEvent(const Baby &baby);
+    bool Mergeable() const override;
+    void Serialize(std::ostream &out) const override;
+    void Merge(std::istream &in) override;
 
   private:
     SingleHist2D() = delete;
@@ -5,6 +5,8 @@
 #include <functional>
 #include <ostream>
 #include <vector>
+#include <map>
+#include <memory>
 
 #include "TString.h"
 
@@ -16,6 +18,7 @@ public:
   using VectorType = std::vector<ScalarType>;
   using ScalarFunc = ScalarType(const Baby &);
   using VectorFunc = VectorType(const Baby &);
+  using Bindings = std::map<std::string, NamedFunc>;
 
   NamedFunc(const std::string &name,
             const std::function<ScalarFunc> &function);
@@ -35,6 +38,8 @@ public:
   NamedFunc & Name(const std::string &name);
   std::string PlainName() const;
   std::string PrettyName() const;
+  bool NameDefinesFunction() const;
+  NamedFunc & NameDefinesFunction(bool defines);
 
   NamedFunc & Function(const std::function<ScalarFunc> &function);
   NamedFunc & Function(const std::function<VectorFunc> &function);
@@ -44,6 +49,12 @@ public:
   bool IsScalar() const;
   bool IsVector() const;
 
+  std::vector<NamedFunc> Conjuncts() const;
+
+  NamedFunc & MarkVariable(const std::string &variable);
+  bool DependsOn(const std::string &variable) const;
+  NamedFunc Rebind(const Bindings &bindings) const;
+
   ScalarType GetScalar(const Baby &b) const;
   VectorType GetVector(const Baby &b) const;
 
@@ -56,12 +67,33 @@ public:
   NamedFunc operator [] (const NamedFunc &func) const;
 
 private:
+  friend NamedFunc operator - (NamedFunc f);
+  friend NamedFunc operator == (NamedFunc f, NamedFunc g);
+  friend NamedFunc operator != (NamedFunc f, NamedFunc g);
+  friend NamedFunc operator > (NamedFunc f, NamedFunc g);
+  friend NamedFunc operator < (NamedFunc f, NamedFunc g);
+  friend NamedFunc operator >= (NamedFunc f, NamedFunc g);
+  friend NamedFunc operator <= (NamedFunc f, NamedFunc g);
+  friend NamedFunc operator && (NamedFunc f, NamedFunc g);
+  friend NamedFunc operator || (NamedFunc f, NamedFunc g);
+  friend NamedFunc operator ! (NamedFunc f);
+
+  using UnaryOp = NamedFunc (*)(NamedFunc);
+  using BinaryOp = NamedFunc (*)(NamedFunc, NamedFunc);
+  struct Rebinder;
+  struct Conjunction;
+
   NamedFunc() = delete;
   std::string name_;//!<String representation of the function
   std::function<ScalarFunc> scalar_func_;//<!Scalar function. Cannot be valid at same time as NamedFunc::vector_func_.
   std::function<VectorFunc> vector_func_;//<!Vector function. Cannot be valid at same time as NamedFunc::scalar_func_.
+  std::shared_ptr<const Conjunction> conjunction_;//!<Scalar operands if *this is a chain of "&&"; null otherwise
+  std::shared_ptr<const Rebinder> rebinder_;//!<Variables *this depends on and how to rebuild it from rebound operands. Null if not rebindable.
+  bool name_defines_function_;//!<True if parsing name_ gives this function, so functions with equal names and this flag set are equal
 
   void CleanName();
+  void RecordOperand(const NamedFunc &f, UnaryOp op);
+  void RecordOperands(const NamedFunc &f, const NamedFunc &g, BinaryOp op);
 };
 
 NamedFunc operator + (NamedFunc f, NamedFunc g);
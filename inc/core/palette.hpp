@@ -2,6 +2,8 @@
 #define H_PALETTE
 
 #include <string>
+#include <array>
+#include <unordered_map>
 
 #include "RtypesCore.h"
 
@@ -35,8 +37,14 @@ public:
   static Int_t HLS(Float_t h, Float_t l, Float_t s);
 
 private:
+  using ColorMap = std::unordered_map<std::string, std::array<Int_t, 3> >;//!<RGB values keyed by color name
+
   std::string file_;//!<File from which to read color definitions
   std::string palette_;//!<Palette name from which to read color definitions
+
+  static const ColorMap & Colors(const std::string &file,
+                                 const std::string &palette);
+  static std::unordered_map<std::string, ColorMap> ReadFile(const std::string &file);
 };
 
 #endif
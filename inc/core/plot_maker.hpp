@@ -3,13 +3,20 @@
 
 #include <vector>
 #include <set>
+#include <map>
 #include <memory>
 #include <utility>
+#include <string>
+#include <istream>
+#include <ostream>
 
 #include "core/plot_opt.hpp"
 #include "core/figure.hpp"
+#include "core/cpu_placement.hpp"
 
 class Process;
+class Progress;
+class PlotMetrics;
 
 class PlotMaker{
 public:
@@ -42,12 +49,38 @@ public:
 
   bool multithreaded_;
   bool min_print_;
+  std::size_t num_threads_;//!<Maximum number of worker threads, 0 for one per allowed CPU
+  std::size_t num_processes_;//!<Worker processes to fork for filling figures, 0 or 1 to use threads instead
+  CpuPlacement::Policy affinity_;//!<How worker threads are pinned to CPUs
+  std::string metrics_file_;//!<JSON file for performance metrics of the first MakePlots() call (later ones get a _pass<N> suffix), empty to skip
+  std::size_t shard_index_;//!<Shard of the babies filled when num_shards_ > 1, from 0 to num_shards_-1
+  std::size_t num_shards_;//!<Number of shards the babies are split into, 0 or 1 to fill and print everything
+  std::string shard_dir_;//!<Directory where shard results are written, and read when merging
+  bool merge_shards_;//!<Fill figures from the shard results in shard_dir_ instead of from the babies
 
 private:
   std::vector<std::unique_ptr<Figure> > figures_;//!<Figures to be produced
 
-  void GetYields();
-  long GetYield(Baby *baby_ptr);
+  void GetYields(const std::set<Baby*> &babies, PlotMetrics &metrics);
+  long GetYield(Baby *baby_ptr, Progress *progress, PlotMetrics *metrics);
+  long GetYieldsForked(const std::set<Baby*> &babies,
+                       std::size_t num_processes,
+                       PlotMetrics &metrics);
+  int RunWorker(const std::vector<Baby*> &babies, int fd);
+  void WriteResults(std::ostream &out, const PlotMetrics &metrics) const;
+  long ReadResults(std::istream &in, const std::string &source,
+                   std::size_t iworker, PlotMetrics &metrics);
+  bool Mergeable() const;
+  std::map<std::string, Figure::FigureComponent*> ComponentKeys(bool &unique) const;
+
+  void WriteShard(std::size_t pass, const std::set<Baby*> &babies,
+                  const PlotMetrics &metrics) const;
+  long MergeShards(std::size_t pass, PlotMetrics &metrics);
+  std::string ShardPath(std::size_t pass) const;
+
+  static std::vector<std::vector<Baby*> > AssignBabies(const std::set<Baby*> &babies,
+                                                       std::size_t num_parts);
+  static std::string BabyKey(const Baby &baby);
 
   std::set<Baby*> GetBabies() const;
   std::set<const Process *> GetProcesses() const;
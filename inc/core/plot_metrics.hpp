@@ -0,0 +1,63 @@
+#ifndef H_PLOT_METRICS
+#define H_PLOT_METRICS
+
+#include <cstddef>
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+class PlotMetrics{
+public:
+  struct BabyRecord{
+    std::string tag;//!<Baby file name (or "Baby for processes") and process list
+    std::size_t thread;//!<Index of the thread (or worker process) that processed the Baby
+    long entries;//!<Entries looped over
+    double wall_seconds;//!<Wall time from activation to end of loop
+    double cpu_seconds;//!<CPU time used by the processing thread
+    double lock_seconds;//!<Time spent blocked on the ROOT and figure component mutexes
+    long bytes_read;//!<Bytes read from disk
+    long bytes_unzipped;//!<Decompressed size of the branches that were read
+    std::size_t figures;//!<Figure components filled from this Baby
+    std::vector<std::pair<std::string, long> > passed;//!<Events passing each process cut
+  };
+
+  using Clock = std::chrono::steady_clock;
+
+  PlotMetrics();
+  PlotMetrics(const PlotMetrics &) = delete;
+  PlotMetrics& operator=(const PlotMetrics &) = delete;
+  PlotMetrics(PlotMetrics &&) = delete;
+  PlotMetrics& operator=(PlotMetrics &&) = delete;
+  ~PlotMetrics() = default;
+
+  void Start(std::size_t num_threads, const std::string &affinity,
+             std::size_t num_processes = 1);
+  void Add(BabyRecord record);
+  void Add(BabyRecord record, std::size_t worker);
+  std::vector<BabyRecord> Babies() const;
+  void FinishYields();
+  void FinishPrint(std::size_t num_figures);
+  void Write(const std::string &path) const;
+
+  static double ThreadCpuSeconds();
+  static std::string PassPath(const std::string &path, std::size_t pass);
+
+private:
+  std::size_t num_threads_;//!<Worker threads in the pass
+  std::size_t num_processes_;//!<Worker processes in the pass
+  std::string affinity_;//!<CPU placement policy
+  Clock::time_point start_;//!<Start of the pass
+  double yields_seconds_;//!<Wall time spent filling yields
+  double print_seconds_;//!<Wall time spent printing figures
+  std::size_t num_figures_;//!<Figures printed
+  std::vector<BabyRecord> babies_;//!<Records in order of completion
+  std::map<std::thread::id, std::size_t> thread_index_;//!<Index of each thread that added a record
+  mutable std::mutex mutex_;
+};
+
+#endif
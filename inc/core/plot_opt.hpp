@@ -5,6 +5,9 @@
 
 #include <set>
 #include <string>
+#include <vector>
+#include <utility>
+#include <unordered_map>
 
 namespace PlotOptTypes{
   enum class BottomType{off, ratio, diff};
@@ -143,6 +146,8 @@ public:
   void MakeSane();
 
 private:
+  using Properties = std::vector<std::pair<std::string, std::string> >;//!<Property names and values in file order
+
   PlotOptTypes::BottomType bottom_type_;
   PlotOptTypes::YAxisType y_axis_type_;
   PlotOptTypes::TitleType title_type_;
@@ -168,6 +173,10 @@ private:
 
   void SetProperty(const std::string &property_name,
                    const std::string &value_string);
+
+  static const Properties & Styles(const std::string &file_name,
+                                   const std::string &config_name);
+  static std::unordered_map<std::string, Properties> ReadFile(const std::string &file_name);
 };
 
 #endif
@@ -0,0 +1,36 @@
+#ifndef H_PLOT_SERVER
+#define H_PLOT_SERVER
+
+#include <string>
+#include <vector>
+#include <memory>
+
+class Process;
+
+class PlotServer{
+public:
+  PlotServer(const std::string &socket_path,
+             const std::string &process_file);
+  PlotServer(const PlotServer &) = delete;
+  PlotServer& operator=(const PlotServer &) = delete;
+  PlotServer(PlotServer &&) = delete;
+  PlotServer& operator=(PlotServer &&) = delete;
+  ~PlotServer();
+
+  void Run();
+
+  static std::string Submit(const std::string &socket_path,
+                            const std::string &request);
+  static std::string DefaultSocket();
+
+private:
+  std::string HandleRequest(const std::string &request, bool &stop);
+  void LoadProcesses(const std::string &process_file);
+
+  std::string socket_path_;//!<Unix socket on which requests are accepted
+  std::vector<std::shared_ptr<Process> > processes_;//!<Processes available to requests, kept between requests
+  std::vector<std::shared_ptr<void> > activators_;//!<Keep the chains of all babies open between requests
+  int listen_fd_;//!<Listening socket, or -1 before Run()
+};
+
+#endif
@@ -6,10 +6,13 @@
 #include <map>
 #include <set>
 #include <mutex>
+#include <unordered_map>
+#include <typeinfo>
 
 #include "core/baby.hpp"
 #include "core/named_func.hpp"
 #include "core/utilities.hpp"
+#include "core/file_catalog.hpp"
 
 class Process : public TAttFill, public TAttLine, public TAttMarker{
 public:
@@ -49,7 +52,10 @@ private:
   Process(Process &&) = delete;
   Process& operator=(Process &&) = delete;
 
+  static std::string IndexKey(const std::type_info &baby_type, const std::string &file);
+
   static std::set<std::unique_ptr<Baby> > baby_pool_;
+  static std::unordered_map<std::string, Baby*> baby_index_;//!<Baby in baby_pool_ reading each file, keyed by IndexKey()
   static std::mutex mutex_;
 };
 
@@ -73,22 +79,16 @@ Process::Process(BabyType * /*dummy_baby*/,
   color_(color){
   std::lock_guard<std::mutex> lock(mutex_);
   for(const auto &file: files){
-    const auto &full_files = Glob(file);
+    const auto &full_files = FileCatalog::Get().Glob(file);
     for(const auto &full_file: full_files){
-      bool found = false;
-      for(auto &baby_p: baby_pool_){
-        auto &baby = *baby_p;
-        if(typeid(baby) != typeid(BabyType)) continue;
-        const auto &baby_files = baby.FileNames();
-        if(baby_files.find(full_file) != baby_files.end()){
-          baby.processes_.insert(this);
-          found = true;
-          break;
-        }
-      }
-      if(!found){
-        baby_pool_.emplace(static_cast<Baby*>(new BabyType(std::set<std::string>{full_file},
-                                                           std::set<const Process*>{this})));
+      auto found = baby_index_.find(IndexKey(typeid(BabyType), full_file));
+      if(found != baby_index_.end()){
+        found->second->processes_.insert(this);
+      }else{
+        Baby *baby = new BabyType(std::set<std::string>{full_file},
+                                  std::set<const Process*>{this});
+        baby_pool_.emplace(baby);
+        baby_index_.emplace(IndexKey(typeid(BabyType), full_file), baby);
       }
     }
   }
@@ -0,0 +1,52 @@
+#ifndef H_PROGRESS
+#define H_PROGRESS
+
+#include <cstddef>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+class Progress{
+public:
+  using Clock = std::chrono::steady_clock;
+
+  explicit Progress(std::size_t num_tasks,
+                    double refresh = 1.);
+  Progress(const Progress &) = delete;
+  Progress& operator=(const Progress &) = delete;
+  Progress(Progress &&) = delete;
+  Progress& operator=(Progress &&) = delete;
+  ~Progress();
+
+  void StartTask(long num_events);
+  void AddEvents(long num_events);
+  void FinishTask();
+  void Log(const std::string &message);
+  void Stop();
+
+  static const long batch_size_ = 4096;//!<Events a worker should count locally before calling AddEvents()
+
+private:
+  void Run();
+  void Print(Clock::time_point now);
+
+  std::size_t num_tasks_;//!<Number of tasks (babies) in the pass
+  std::atomic<std::size_t> tasks_started_;//!<Tasks whose number of events is known
+  std::atomic<std::size_t> tasks_done_;//!<Tasks finished
+  std::atomic<long> events_total_;//!<Events in the started tasks
+  std::atomic<long> events_done_;//!<Events processed so far
+  Clock::time_point start_time_;//!<Creation time
+  std::chrono::duration<double> refresh_;//!<Time between status updates
+  bool erase_lines_;//!<Redraw a single line on a terminal instead of appending lines
+  bool line_shown_;//!<Status line is currently displayed and must be erased before other output
+  bool stop_;//!<Set to make the printer exit
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::thread printer_;//!<Thread printing the status line
+};
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef H_PU_ACCUMULATOR
+#define H_PU_ACCUMULATOR
+
+#include <cstddef>
+
+#include <vector>
+
+class PUAccumulator{
+public:
+  explicit PUAccumulator(const std::vector<double> &data_npv,
+                         std::size_t max_low = 20);
+  PUAccumulator(const PUAccumulator &) = default;
+  PUAccumulator& operator=(const PUAccumulator &) = default;
+  PUAccumulator(PUAccumulator &&) = default;
+  PUAccumulator& operator=(PUAccumulator &&) = default;
+  ~PUAccumulator() = default;
+
+  void Fill(int npv, double weight);
+  void Clear();
+  PUAccumulator & operator+=(const PUAccumulator &other);
+
+  double DataFraction(std::size_t npv) const;
+  double MCFraction(std::size_t npv) const;
+  double MeanLow() const;
+  double MeanHigh() const;
+  double Uncertainty(double eff_low, double eff_high) const;
+
+private:
+  std::vector<double> data_npv_;//!<Normalized N_PV distribution in data
+  std::vector<double> mc_npv_;//!<Sum of MC weights in each N_PV bin
+  std::size_t max_low_;//!<Largest N_PV in the low pile-up category
+
+  double MCSum(std::size_t begin, std::size_t end) const;
+  double MCMean(std::size_t begin, std::size_t end) const;
+};
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef H_RANDOM_STREAM
+#define H_RANDOM_STREAM
+
+#include <cstddef>
+#include <cstdint>
+
+#include <vector>
+
+class RandomStream{
+public:
+  explicit RandomStream(std::uint64_t seed = 0);
+  RandomStream(const RandomStream &) = default;
+  RandomStream& operator=(const RandomStream &) = default;
+  RandomStream(RandomStream &&) = default;
+  RandomStream& operator=(RandomStream &&) = default;
+  ~RandomStream() = default;
+
+  RandomStream Split(std::uint64_t index) const;
+
+  std::uint64_t Next();
+  double Uniform();
+  double Normal(double mean = 0., double sigma = 1.);
+  double Gamma(double shape, double scale = 1.);
+  double Poisson(double mean);
+
+  void Uniform(std::vector<double> &out);
+  void Normal(std::vector<double> &out, double mean = 0., double sigma = 1.);
+  void Gamma(std::vector<double> &out, double shape, double scale = 1.);
+  void Poisson(std::vector<double> &out, double mean);
+  void Poisson(std::vector<double> &out, const std::vector<double> &means);
+
+private:
+  std::uint64_t key_;//!<Mixed seed identifying the stream
+  std::uint64_t counter_;//!<Number of words drawn from the stream so far
+  std::vector<double> normals_;//!<Scratch space for batched gamma draws
+  std::vector<double> uniforms_;//!<Scratch space for batched gamma draws
+  std::vector<std::size_t> pending_;//!<Indices still to be accepted in batched gamma draws
+
+  static std::uint64_t Mix(std::uint64_t x);
+  static double ToUniform(std::uint64_t x);
+};
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef H_SERIALIZATION
+#define H_SERIALIZATION
+
+#include <cstdint>
+
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <type_traits>
+
+#include "TH1.h"
+
+#include "core/utilities.hpp"
+
+/*!\brief Compact binary encoding of figure accumulators
+
+  Used to send partial results between processes of the same build on the same
+  machine, so values are written in native byte order and layout.
+*/
+namespace Serialization{
+  template<typename T>
+  void Write(std::ostream &out, const T &value){
+    static_assert(std::is_trivially_copyable<T>::value, "Only trivially copyable types can be written directly");
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+
+  template<typename T>
+  T Read(std::istream &in){
+    static_assert(std::is_trivially_copyable<T>::value, "Only trivially copyable types can be read directly");
+    T value;
+    if(!in.read(reinterpret_cast<char*>(&value), sizeof(T))) ERROR("Truncated serialized data");
+    return value;
+  }
+
+  template<typename T>
+  void WriteVector(std::ostream &out, const std::vector<T> &values){
+    Write<std::uint64_t>(out, values.size());
+    if(!values.empty()) out.write(reinterpret_cast<const char*>(values.data()), values.size()*sizeof(T));
+  }
+
+  template<typename T>
+  std::vector<T> ReadVector(std::istream &in){
+    std::vector<T> values(Read<std::uint64_t>(in));
+    if(!values.empty()
+       && !in.read(reinterpret_cast<char*>(values.data()), values.size()*sizeof(T))){
+      ERROR("Truncated serialized data");
+    }
+    return values;
+  }
+
+  void WriteString(std::ostream &out, const std::string &str);
+  std::string ReadString(std::istream &in);
+
+  void WriteHist(std::ostream &out, const TH1 &hist);
+  void AddHist(std::istream &in, TH1 &hist);
+}
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef H_STAGING_CACHE
+#define H_STAGING_CACHE
+
+#include <cstddef>
+#include <cstdint>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+class StagingCache{
+public:
+  static StagingCache & Get();
+
+  bool Enabled() const;
+  std::string Local(const std::string &path);
+  void Prefetch(const std::vector<std::string> &paths);
+
+private:
+  static const std::size_t max_recent_ = 64;//!<Copies returned by Local() protected from eviction
+
+  StagingCache();
+  StagingCache(const StagingCache &) = delete;
+  StagingCache& operator=(const StagingCache &) = delete;
+  StagingCache(StagingCache &&) = delete;
+  StagingCache& operator=(StagingCache &&) = delete;
+  ~StagingCache();
+
+  std::string LocalName(const std::string &path) const;
+  bool Stage(const std::string &path, const std::string &local);
+  void Evict();
+  void Work();
+
+  std::string dir_;//!<Local scratch directory, empty if staging is disabled
+  std::int64_t max_bytes_;//!<Size limit of the scratch directory
+  std::size_t lookahead_;//!<Prefetched files allowed to wait for use
+  std::deque<std::string> queue_;//!<Files to prefetch, in order of expected use
+  std::set<std::string> busy_;//!<Files being copied
+  std::set<std::string> waiting_;//!<Prefetched files not yet used
+  std::set<std::string> used_;//!<Files already passed to Local(), not to be prefetched
+  std::deque<std::string> recent_;//!<Local copies most recently returned, which chains may not have opened yet
+  bool stop_;//!<Set to make the prefetch thread exit
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::thread prefetcher_;//!<Copies queued files ahead of use
+};
+
+#endif
@@ -21,8 +21,13 @@ public:
     ~TableColumn() = default;
 
     void RecordEvent(const Baby &baby) final;
+    bool Mergeable() const final;
+    void Serialize(std::ostream &out) const final;
+    void Merge(std::istream &in) final;
 
     std::vector<double> sumw_, sumw2_;
+    std::vector<double> var_sumw_, var_sumw2_;//!<Sums for weight variations, stored contiguously [row][variation]
+    std::vector<std::size_t> var_offset_;//!<Index in var_sumw_ of each row's first variation (size = number of rows+1)
 
   private:
     TableColumn() = delete;
@@ -32,7 +37,15 @@ public:
     TableColumn& operator=(TableColumn &&) = delete;
 
     std::vector<NamedFunc> proc_and_table_cut_;
+    std::vector<NamedFunc> conjuncts_;//!<Distinct scalar sub-cuts shared by all rows
+    std::vector<std::vector<std::size_t> > row_conjuncts_;//!<Indices in conjuncts_ making up each row's cut
+    std::vector<signed char> conjunct_pass_;//!<Per-event cache of conjuncts_ results (-1 if not yet evaluated)
+    std::vector<const BinGrid*> grids_;//!<Distinct grids used by region rows
+    std::vector<long> row_grid_;//!<Index in grids_ of each row's grid (-1 for plain cuts)
+    std::vector<long> grid_cell_;//!<Per-event cache of each grid's cell (-2 if not yet evaluated)
     NamedFunc::VectorType cut_vector_, wgt_vector_, val_vector_;
+
+    bool PassConjuncts(std::size_t irow, const Baby &baby);
   };
 
   Table(const std::string &name,
@@ -52,6 +65,7 @@ public:
   std::vector<GammaParams> Yield(const Process *process, double luminosity) const;
   std::vector<GammaParams> BackgroundYield(double luminosity) const;
   std::vector<GammaParams> DataYield() const;
+  std::vector<GammaParams> VariationYield(const Process *process, std::size_t irow, double luminosity) const;
   
   std::set<const Process*> GetProcesses() const final;
 
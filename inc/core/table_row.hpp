@@ -2,8 +2,11 @@
 #define H_TABLE_ROW
 
 #include <string>
+#include <memory>
+#include <vector>
 
 #include "core/named_func.hpp"
+#include "core/bin_grid.hpp"
 
 class TableRow{
 public:
@@ -16,16 +19,28 @@ public:
            std::size_t lines_before = 0,
            std::size_t line_after = 0,
            const NamedFunc &weight = "weight");
+
+  TableRow(const std::string &label,
+           const std::shared_ptr<const BinGrid> &grid,
+           const std::string &region,
+           std::size_t lines_before = 0,
+           std::size_t line_after = 0,
+           const NamedFunc &weight = "weight");
   TableRow(const TableRow &) = default;
   TableRow& operator=(const TableRow &) = default;
   TableRow(TableRow &&) = default;
   TableRow& operator=(TableRow &&) = default;
   ~TableRow() = default;
 
+  TableRow & WeightVariations(const std::vector<NamedFunc> &variations);
+
   std::string label_;
   NamedFunc cut_, weight_;
   std::size_t lines_before_, lines_after_;
   bool is_data_row_;
+  std::shared_ptr<const BinGrid> grid_;//!<Grid in which cut_ is a region. Null if row has a plain cut.
+  std::size_t region_;//!<Index of region in grid_
+  std::vector<NamedFunc> weight_variations_;//!<Factors multiplying weight_ for each systematic variation
 
 private:
   TableRow() = delete;
@@ -1,6 +1,9 @@
 #ifndef H_THREAD_POOL
 #define H_THREAD_POOL
 
+#include <cstddef>
+#include <cstdint>
+
 #include <algorithm>
 #include <thread>
 #include <future>
@@ -10,12 +13,16 @@
 #include <mutex>
 #include <vector>
 #include <atomic>
+#include <exception>
 #include <condition_variable>
 
 class ThreadPool{
 public:
+  class TaskGroup;
+
   ThreadPool();
   explicit ThreadPool(std::size_t num_threads);
+  ThreadPool(std::size_t num_threads, const std::function<void(std::size_t)> &on_start);
   ~ThreadPool();
 
   std::size_t Size() const;
@@ -24,24 +31,51 @@ public:
   template<typename FuncType, typename...ArgTypes>
   auto Push(FuncType &&func, ArgTypes&&... args) -> std::future<decltype(func(args...))>;
 
+  template<typename FuncType>
+  void ParallelFor(std::size_t begin, std::size_t end, FuncType func, std::size_t grain = 0);
+
 private:
+  using Task = std::function<void()>;
+
   ThreadPool(const ThreadPool &) = delete;
   ThreadPool& operator=(const ThreadPool &) = delete;
   ThreadPool(ThreadPool &&) = delete;
   ThreadPool& operator=(ThreadPool &&) = delete;
 
-  void DoTasksFromQueue(size_t ithread);
-  bool ReadyToAct(size_t ithread, std::unique_ptr<std::function<void()> > &task);
+  class Deque{
+  public:
+    Deque();
+    ~Deque();
+
+    void Push(Task *task);
+    Task * Take();
+    Task * Steal();
+
+  private:
+    Deque(const Deque &) = delete;
+    Deque& operator=(const Deque &) = delete;
+    Deque(Deque &&) = delete;
+    Deque& operator=(Deque &&) = delete;
+
+    struct Buffer{
+      explicit Buffer(std::int64_t size);
+      std::int64_t size_;//!<Capacity, always a power of 2
+      std::unique_ptr<std::atomic<Task*>[]> tasks_;//!<Circular array of tasks
+    };
+
+    std::atomic<std::int64_t> top_;//!<Index of oldest task, advanced by thieves
+    std::atomic<std::int64_t> bottom_;//!<Index past newest task, moved only by owner
+    std::atomic<Buffer*> buffer_;//!<Current circular array
+    std::vector<std::unique_ptr<Buffer> > buffers_;//!<All arrays ever used, kept for lagging thieves
+  };
 
   class Queue{
   public:
-    using FuncPtr = std::unique_ptr<std::function<void()> >;
-
     Queue() = default;
     ~Queue() = default;
 
-    void Push(FuncPtr &func);
-    FuncPtr Pop();
+    void Push(Task *task);
+    Task * Pop();
 
   private:
     Queue(const Queue &) = delete;
@@ -49,15 +83,54 @@ private:
     Queue(Queue &&) = delete;
     Queue& operator=(Queue &&) = delete;
 
-    std::queue<FuncPtr> queue_;
+    std::queue<Task*> queue_;
     std::mutex mutex_;
   };
 
-  Queue tasks_;
-  std::vector<std::unique_ptr<std::thread> > threads_;
-  std::vector<std::shared_ptr<std::atomic<bool> > > stop_thread_now_;
-  std::atomic<bool> stop_at_empty_;
+  void Start(std::size_t num_threads);
+  void Stop();
+  void Enqueue(Task *task);
+  Task * FindTask();
+  void Work(std::size_t iworker);
+  void Help();
+  static void Run(Task *task);
+
+  std::vector<std::unique_ptr<Deque> > deques_;//!<Per-worker deques, pushed and taken by owner
+  Queue injected_;//!<Tasks pushed from threads outside the pool
+  std::vector<std::thread> threads_;//!<Worker threads
+  std::function<void(std::size_t)> on_start_;//!<Called by each worker with its index before running tasks
+  std::atomic<std::size_t> num_queued_;//!<Tasks pushed but not yet taken
+  std::atomic<std::size_t> num_sleeping_;//!<Workers waiting on cv_
+  bool stop_;//!<Set (under mutex_) to make workers exit once no tasks remain
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+
+  static thread_local ThreadPool *current_pool_;//!<Pool owning the calling thread, if any
+  static thread_local std::size_t current_worker_;//!<Worker index of the calling thread in current_pool_
+};
+
+class ThreadPool::TaskGroup{
+public:
+  explicit TaskGroup(ThreadPool &pool);
+  ~TaskGroup();
+
+  template<typename FuncType>
+  void Run(FuncType &&func);
 
+  void Wait();
+
+private:
+  TaskGroup(const TaskGroup &) = delete;
+  TaskGroup& operator=(const TaskGroup &) = delete;
+  TaskGroup(TaskGroup &&) = delete;
+  TaskGroup& operator=(TaskGroup &&) = delete;
+
+  void Finish(std::exception_ptr error);
+
+  ThreadPool &pool_;//!<Pool running the group's tasks
+  std::atomic<std::size_t> pending_;//!<Tasks run but not yet finished
+  std::exception_ptr error_;//!<First exception thrown by a task
   std::mutex mutex_;
   std::condition_variable cv_;
 };
@@ -65,11 +138,41 @@ private:
 template<typename FuncType, typename...ArgTypes>
 auto ThreadPool::Push(FuncType &&func, ArgTypes&&... args) -> std::future<decltype(func(args...))>{
   auto task =  std::make_shared<std::packaged_task<decltype(func(args...))()> >(std::bind(std::forward<FuncType>(func), std::forward<ArgTypes>(args)...));
-  std::unique_ptr<std::function<void()> > pkg_func(new std::function<void()>([task](){(*task)();}));
-  tasks_.Push(pkg_func);
-  std::lock_guard<std::mutex> lock(mutex_);
-  cv_.notify_one();
+  Enqueue(new Task([task](){(*task)();}));
   return task->get_future();
 }
 
+/*!\brief Calls func(i) for each i in [begin, end), in parallel, and waits
+
+  Indices are handed out in contiguous chunks of size grain. A grain of 0 picks
+  a chunk size giving a few chunks per thread. May be called from inside a task.
+*/
+template<typename FuncType>
+void ThreadPool::ParallelFor(std::size_t begin, std::size_t end, FuncType func, std::size_t grain){
+  if(end <= begin) return;
+  if(grain == 0) grain = std::max<std::size_t>(1, (end-begin)/(4*std::max<std::size_t>(1, Size())));
+  TaskGroup group(*this);
+  for(std::size_t chunk = begin; chunk < end; chunk += grain){
+    std::size_t chunk_end = std::min(end, chunk+grain);
+    group.Run([&func, chunk, chunk_end](){
+        for(std::size_t i = chunk; i < chunk_end; ++i) func(i);
+      });
+  }
+  group.Wait();
+}
+
+template<typename FuncType>
+void ThreadPool::TaskGroup::Run(FuncType &&func){
+  ++pending_;
+  pool_.Enqueue(new Task([this, func](){
+        std::exception_ptr error;
+        try{
+          func();
+        }catch(...){
+          error = std::current_exception();
+        }
+        Finish(error);
+      }));
+}
+
 #endif
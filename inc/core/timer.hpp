@@ -58,7 +58,10 @@ private:
   std::string label_;
   TimeType start_time_;
   mutable TimeType last_print_;
+  TimeType last_check_;//!<Last time Iterate() read the clock
   std::size_t iteration_, num_iterations_;
+  std::size_t last_check_iteration_;//!<Iteration at which the clock was last read
+  std::size_t check_step_;//!<Iterations between clock reads, adapted to the rate
   std::chrono::duration<double> auto_print_;
   bool erase_lines_;
   static std::mutex mutex_;
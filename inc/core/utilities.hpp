@@ -13,7 +13,6 @@
 #include <algorithm>
 
 #include "TH1D.h"
-#include "TRandom3.h"
 #include "TLegend.h"
 #include "TH1.h"
 #include "TH2.h"
@@ -24,6 +23,9 @@
 
 namespace Multithreading{
   extern std::mutex root_mutex;
+  extern thread_local double lock_wait_seconds;
+
+  std::unique_lock<std::mutex> TimedLock(std::mutex &to_lock);
 }
 
 std::set<std::string> Glob(const std::string &pattern);
@@ -111,7 +113,6 @@ TString AddCommas(double num);
 TString RoundNumber(double num, int decimals, double denom=1.);
 
 double Significance(double Nobs, double Nbkg, double Eup_bkg, double Edown_bkg=-1.);
-double gsl_ran_gamma (const double a, const double b, TRandom3 &rand);
 double intGaus(double mean, double sigma, double minX, double maxX);
 float deltaR(float eta1, float phi1, float eta2, float phi2);
 double deltaPhi(double phi1, double phi2);
@@ -121,6 +122,8 @@ double deltaPhi(double phi1, double phi2);
 double calcKappa(std::vector<std::vector<float> > &entries, std::vector<std::vector<float> > &weights,
 		 std::vector<float> &powers, float &mSigma, float &pSigma, bool do_data=false, 
 		 bool verbose=false, double syst=-1., bool do_plot=false, int nrep=100000);
+// Keeps calcKappa results in path across runs, in addition to the in-memory cache
+void SetKappaCacheFile(const std::string &path);
 
 std::set<std::string> attach_folder(std::string folder, std::set<std::string> &fileset);
 
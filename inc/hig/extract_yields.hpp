@@ -120,5 +120,7 @@ void MakeCovarianceMatrix(RooWorkspace &w,
 std::string PrettyBinName(std::string name);
 
 double GetError(const RooAbsReal &var,  const RooFitResult &f, int errtype=0);
+std::vector<double> GetErrors(const std::vector<const RooAbsReal*> &vars,
+                              const RooFitResult &f, int errtype=0);
 
 #endif
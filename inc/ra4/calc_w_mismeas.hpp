@@ -1,11 +1,18 @@
 #ifndef H_CALC_W_MISMEAS
 #define H_CALC_W_MISMEAS
 
+#include <cstddef>
+
 #include <vector>
 #include <string>
+#include <array>
+#include <utility>
 
 #include "core/gamma_params.hpp"
 #include "core/named_func.hpp"
+#include "core/random_stream.hpp"
+
+typedef std::array<std::pair<double, double>, 12> OmegaDists;//!<(shape, scale) of the gamma posterior of each yield
 
 void PrintYield(const std::string &name, const std::vector<GammaParams> &yields);
 
@@ -29,7 +36,14 @@ double GetOmega(double mua_data, double mub_data, double muc_data, double mud_da
                 double mua_mc_good, double mub_mc_good, double muc_mc_good, double mud_mc_good,
                 double mua_mc_bad, double mub_mc_bad, double muc_mc_bad, double mud_mc_bad);
 
+void OmegaToys(const OmegaDists &dists, RandomStream &rng, std::vector<double> &omega);
+
+std::vector<std::size_t> OmegaHistogram(OmegaDists dists, RandomStream rng, std::size_t num,
+                                        double x_min, double x_max, std::size_t num_bins);
+
 void GetInterval(double &x_lo, double &x_hi, const std::vector<double> &x_vals);
+void GetInterval(double &x_lo, double &x_hi, const std::vector<std::size_t> &counts,
+                 double x_min, double x_max);
 
 void GetOptions(int argc, char *argv[]);
 
@@ -11,9 +11,10 @@ os.system("./compile.py")
 for mass in masses:
     print 100*"="
     infile = "*SMS-TChiHH*_mGluino-"+mass+"_mLSP-1_*.root"
-    os.system("./run/hig/write_datacards.exe -i "+infolder+" -f "+infile+" -o out/ -l 35.9 --bf 1.")
-    for bf in [str(x*.1) for x in range(0,10,1)]:
-        os.system("./run/hig/write_datacards.exe -i "+infolder+" -f "+infile+" -o out/ -l 35.9 --bf "+bf+" --incl_nonhh")
+    # one pass over the file writes the cards for every branching fraction
+    # (bf = 1 is the same with and without --incl_nonhh)
+    bfs = ",".join(["1."]+[str(x*.1) for x in range(0,10,1)])
+    os.system("./run/hig/write_datacards.exe -i "+infolder+" -f "+infile+" -o out/ -l 35.9 --bf "+bfs+" --incl_nonhh")
 
 
 #---------- For contamination studies
@@ -21,8 +22,6 @@ for mass in masses:
 # for mass in masses:
 #     print 100*"="
 #     infile = "*SMS-TChiHZ*_mGluino-"+mass+"_mLSP-1_*.root"
-#     os.system("./run/hig/write_datacards.exe -i "+infolder+" -f "+infile+" -o out/ -l 35.9 --bf 1.")
-#     os.system("./run/hig/write_datacards.exe -i "+infolder+" -f "+infile+" -o out/ -l 35.9 --bf 1. --incl_nonbb")
-#     for bf in [str(x*.1) for x in range(0,10,1)]:
-#         os.system("./run/hig/write_datacards.exe -i "+infolder+" -f "+infile+" -o out/ -l 35.9 --bf "+bf)
-#         os.system("./run/hig/write_datacards.exe -i "+infolder+" -f "+infile+" -o out/ -l 35.9 --bf "+bf+" --incl_nonhh --incl_nonbb")
+#     bfs = ",".join(["1."]+[str(x*.1) for x in range(0,10,1)])
+#     os.system("./run/hig/write_datacards.exe -i "+infolder+" -f "+infile+" -o out/ -l 35.9 --bf 1. --decay_modes hh,nonbb")
+#     os.system("./run/hig/write_datacards.exe -i "+infolder+" -f "+infile+" -o out/ -l 35.9 --bf "+bfs+" --decay_modes hh,nonhh_nonbb")
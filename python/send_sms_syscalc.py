@@ -5,7 +5,6 @@ from __future__ import print_function
 import argparse
 import os
 import subprocess
-import numpy
 
 def fullPath(path):
     return os.path.realpath(os.path.abspath(os.path.expanduser(path)))
@@ -17,7 +16,7 @@ def ensureDir(path):
         if not os.path.isdir(path):
             raise
 
-def sendSysCalc(in_dir, out_dir, num_jobs, fake_PU):
+def sendSysCalc(in_dir, out_dir, num_threads, fake_PU):
     in_dir = fullPath(in_dir)
     out_dir = fullPath(out_dir)
     run_dir = os.path.join(out_dir, "run")
@@ -30,44 +29,31 @@ def sendSysCalc(in_dir, out_dir, num_jobs, fake_PU):
 
     cmssw_dir = os.path.join(os.environ["CMSSW_BASE"],"src")
 
-    if num_jobs < 1:
-        num_jobs = 1
+    if num_threads < 0:
+        num_threads = 0
 
-    in_files = [ os.path.join(in_dir,f) for f in os.listdir(in_dir)
-                 if os.path.isfile(os.path.join(in_dir,f))
-                 and os.path.splitext(f)[1] == ".root" ]
-    in_files = numpy.array_split(numpy.array(in_files), num_jobs)
+    # syscalc_scan.exe processes every mass point in in_dir in one job, sharing the
+    # systematic definitions between files
+    run_path = os.path.join(run_dir,"syscalc_scan.sh")
+    with open(run_path, "w") as run_file:
+        os.fchmod(run_file.fileno(), 0755)
+        print("#! /bin/bash", file=run_file)
+        print("", file=run_file)
+        print("DIRECTORY=`pwd`", file=run_file)
+        print("cd {}".format(cmssw_dir), file=run_file)
+        print(". /net/cms2/cms2r0/babymaker/cmsset_default.sh", file=run_file)
+        print("eval `scramv1 runtime -sh`", file=run_file)
+        print("cd $DIRECTORY", file=run_file)
+        command = "{} -i {} -o {} -j {}".format(exe_path,in_dir,out_dir,num_threads)
+        if fake_PU:
+            command += " --fake_PU"
+        print("", file=run_file)
+        print(command, file=run_file)
+    subprocess.call(["JobSubmit.csh",run_path])
 
-    num_submitted = 0
-
-    for sublist in in_files:
-        if len(sublist) == 0:
-            continue
-        job_files = sublist.tolist()
-        run_path = os.path.join(run_dir,"syscalc_scan_{}.sh".format(num_submitted)) 
-        with open(run_path, "w") as run_file:
-            os.fchmod(run_file.fileno(), 0755)
-            print("#! /bin/bash", file=run_file)
-            print("", file=run_file)
-            print("DIRECTORY=`pwd`", file=run_file)
-            print("cd {}".format(cmssw_dir), file=run_file)
-            print(". /net/cms2/cms2r0/babymaker/cmsset_default.sh", file=run_file)
-            print("eval `scramv1 runtime -sh`", file=run_file)
-            print("cd $DIRECTORY", file=run_file)
-            for i in range(len(job_files)):
-                f = job_files[i]
-                command = "{} -i {} -f {} -o {}".format(exe_path,os.path.dirname(f),os.path.basename(f),out_dir)
-                if fake_PU:
-                    command += " --fake_PU"
-                print("", file=run_file)
-                print("echo Starting to process file {} of {}".format(i+1, len(job_files)), file=run_file)
-                print(command, file=run_file)
-        subprocess.call(["JobSubmit.csh",run_path])
-        num_submitted += 1
-        
-    print("\nSubmitted {} jobs.".format(num_submitted))
+    print("\nSubmitted 1 job.")
     print("Text systematics files sent to {}.".format(out_dir))
-    print("Shell scripts sent to {}.".format(run_dir))
+    print("Shell script sent to {}.".format(run_dir))
 
 if __name__ == "__main__":
     parser = argparse.ArgumentParser(description="Submits batch jobs to compute systematics in SMS mass plane",
@@ -76,8 +62,9 @@ if __name__ == "__main__":
                         help="Directory containing signal ntuples")
     parser.add_argument("-o","--out_dir", default="/net/cms2/cms2r0/babymaker/sys/2017_02_21/T1tttt/",
                         help="Directory in which to store text systematics files")
-    parser.add_argument("-n","--njobs", type=int, default=50, help="Number of jobs to submit")
+    parser.add_argument("-j","--threads", type=int, default=0,
+                        help="Number of files processed at once; 0 to use all cores")
     parser.add_argument("--fake_PU", action="store_true", help="Use dummy 10/15 percent PU systematic")
     args = parser.parse_args()
 
-    sendSysCalc(args.in_dir, args.out_dir, args.njobs, args.fake_PU)
+    sendSysCalc(args.in_dir, args.out_dir, args.threads, args.fake_PU)
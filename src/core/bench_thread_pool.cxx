@@ -0,0 +1,96 @@
+#include <cstdlib>
+#include <cstdio>
+
+#include <chrono>
+#include <vector>
+#include <future>
+#include <atomic>
+
+#include <getopt.h>
+
+#include "core/thread_pool.hpp"
+
+using namespace std;
+
+namespace{
+  size_t num_tasks = 100000;
+  size_t max_threads = 64;
+
+  using Clock = chrono::steady_clock;
+
+  double NanosecondsPerTask(Clock::time_point start, size_t num){
+    return chrono::duration<double, nano>(Clock::now()-start).count()/num;
+  }
+}
+
+void GetOptions(int argc, char *argv[]);
+
+int main(int argc, char *argv[]){
+  GetOptions(argc, argv);
+
+  printf("Overhead per empty task in ns, %zu tasks per measurement\n\n", num_tasks);
+  printf("%8s %14s %14s %14s\n", "Threads", "Push+future", "Nested group", "ParallelFor");
+  for(size_t num_threads = 1; num_threads <= max_threads; num_threads *= 2){
+    ThreadPool tp(num_threads);
+    atomic<size_t> counter(0);
+
+    // Tasks pushed from outside the pool, each returning a future
+    Clock::time_point start = Clock::now();
+    vector<future<void> > futures;
+    futures.reserve(num_tasks);
+    for(size_t i = 0; i < num_tasks; ++i){
+      futures.push_back(tp.Push([&counter](){++counter;}));
+    }
+    for(auto &f: futures) f.get();
+    double push_ns = NanosecondsPerTask(start, num_tasks);
+
+    // Tasks spawned by a task onto its worker's deque and stolen by the others
+    start = Clock::now();
+    tp.Push([&tp, &counter](){
+        ThreadPool::TaskGroup group(tp);
+        for(size_t i = 0; i < num_tasks; ++i){
+          group.Run([&counter](){++counter;});
+        }
+        group.Wait();
+      }).get();
+    double group_ns = NanosecondsPerTask(start, num_tasks);
+
+    // One index per task
+    start = Clock::now();
+    tp.ParallelFor(0, num_tasks, [&counter](size_t){++counter;}, 1);
+    double for_ns = NanosecondsPerTask(start, num_tasks);
+
+    if(counter != 3*num_tasks){
+      printf("Lost tasks: ran %zu of %zu\n", counter.load(), 3*num_tasks);
+      exit(1);
+    }
+    printf("%8zu %14.1f %14.1f %14.1f\n", num_threads, push_ns, group_ns, for_ns);
+  }
+}
+
+void GetOptions(int argc, char *argv[]){
+  while(true){
+    static struct option long_options[] = {
+      {"tasks", required_argument, 0, 'n'},       // Number of tasks per measurement
+      {"max_threads", required_argument, 0, 'j'}, // Largest pool size, doubling from 1
+      {0, 0, 0, 0}
+    };
+
+    char opt = -1;
+    int option_index;
+    opt = getopt_long(argc, argv, "n:j:", long_options, &option_index);
+    if(opt == -1) break;
+
+    switch(opt){
+    case 'n':
+      num_tasks = atoi(optarg);
+      break;
+    case 'j':
+      max_threads = atoi(optarg);
+      break;
+    default:
+      printf("Bad option! getopt_long returned character code 0%o\n", opt);
+      break;
+    }
+  }
+}
@@ -0,0 +1,405 @@
+/*! \class BinGrid
+
+  \brief Lattice of analysis bins with regions defined as unions of cells
+
+  A BinGrid is built from a selection and a list of named axes, each with a
+  variable and a set of bin edges. Each event passing the selection falls into
+  exactly one cell of the resulting lattice, so the event's position can be
+  computed once with BinGrid::CellIndex and then checked against any number of
+  regions with BinGrid::InRegion, instead of evaluating a separate cut string
+  for every region.
+
+  Bins follow the (low, high] convention used for analysis cuts, so that an axis
+  with edges {200, 350, 500, inf} reproduces "met>200&&met<=350",
+  "met>350&&met<=500", and "met>500". Events outside the edges of any axis are
+  not in the grid.
+
+  Regions are specified with a map from axis name to the (low, high] range
+  covered along that axis. Axes not in the map are covered in full. Range bounds
+  must coincide with bin edges (or be infinite) so that every region is an exact
+  union of cells.
+
+  The grid also accumulates per-cell sums of weights with BinGrid::Fill, from
+  which region yields are obtained by summing over the cells in the region.
+*/
+
+#include "core/bin_grid.hpp"
+
+#include <cmath>
+
+#include <algorithm>
+#include <memory>
+
+#include "core/utilities.hpp"
+
+using namespace std;
+
+/*!\brief Standard constructor
+
+  \param[in] cut Selection events must pass to be located in the grid
+*/
+BinGrid::BinGrid(const NamedFunc &cut):
+  cut_(cut),
+  names_(),
+  vars_(),
+  edges_(),
+  strides_(),
+  region_names_(),
+  region_cells_(),
+  region_mask_(),
+  region_cut_names_(),
+  sumw_(1, 0.),
+  sumw2_(1, 0.),
+  entries_(1, 0){
+  if(!cut_.IsScalar()) ERROR("BinGrid cut "+cut_.Name()+" must be scalar");
+}
+
+/*!\brief Adds an axis to the lattice
+
+  All axes must be added before any regions.
+
+  \param[in] name Name used to refer to the axis when defining regions
+
+  \param[in] var Scalar variable binned along the axis
+
+  \param[in] edges Sorted bin edges. Bins are (edges[i], edges[i+1]].
+
+  \return Reference to *this
+*/
+BinGrid & BinGrid::AddAxis(const string &name,
+                           const NamedFunc &var,
+                           const vector<double> &edges){
+  if(region_names_.size()) ERROR("Cannot add axis "+name+" after defining regions");
+  if(find(names_.cbegin(), names_.cend(), name) != names_.cend()) ERROR("Duplicate axis "+name);
+  if(!var.IsScalar()) ERROR("Axis variable "+var.Name()+" must be scalar");
+  if(edges.size() < 2) ERROR("Axis "+name+" needs at least two bin edges");
+  if(!is_sorted(edges.cbegin(), edges.cend())) ERROR("Bin edges of axis "+name+" must be sorted");
+
+  strides_.push_back(NumCells());
+  names_.push_back(name);
+  vars_.push_back(var);
+  edges_.push_back(edges);
+
+  sumw_.assign(NumCells(), 0.);
+  sumw2_.assign(NumCells(), 0.);
+  entries_.assign(NumCells(), 0);
+  return *this;
+}
+
+/*!\brief Defines a named region as a union of cells
+
+  \param[in] name Name of the region
+
+  \param[in] ranges Map from axis name to the (low, high] range covered. Axes
+  not in the map are covered in full.
+
+  \return Reference to *this
+*/
+BinGrid & BinGrid::AddRegion(const string &name,
+                             const Ranges &ranges){
+  if(find(region_names_.cbegin(), region_names_.cend(), name) != region_names_.cend()){
+    ERROR("Duplicate region "+name);
+  }
+
+  //First and one-past-last bin covered along each axis
+  vector<size_t> first(NumAxes(), 0), last(NumAxes(), 0);
+  for(size_t iaxis = 0; iaxis < NumAxes(); ++iaxis) last.at(iaxis) = edges_.at(iaxis).size()-1;
+  string cut_name = cut_.Name() == "1" ? "" : cut_.Name();
+  for(const auto &range: ranges){
+    size_t iaxis = AxisIndex(range.first);
+    const vector<double> &edges = edges_.at(iaxis);
+    double low = range.second.first, high = range.second.second;
+    if(!(low < high)) ERROR("Empty range for axis "+range.first+" in region "+name);
+    auto low_loc = lower_bound(edges.cbegin(), edges.cend(), low);
+    auto high_loc = lower_bound(edges.cbegin(), edges.cend(), high);
+    if((!isinf(low) && (low_loc == edges.cend() || *low_loc != low))
+       || (!isinf(high) && (high_loc == edges.cend() || *high_loc != high))){
+      ERROR("Range of axis "+range.first+" in region "+name+" does not lie on bin edges");
+    }
+    first.at(iaxis) = isinf(low) ? 0 : low_loc - edges.cbegin();
+    last.at(iaxis) = isinf(high) ? edges.size()-1 : high_loc - edges.cbegin();
+
+    const string &var = vars_.at(iaxis).Name();
+    if(!isinf(low)){
+      if(cut_name != "") cut_name += "&&";
+      cut_name += var+">"+ToString(low);
+    }
+    if(!isinf(high)){
+      if(cut_name != "") cut_name += "&&";
+      cut_name += var+"<="+ToString(high);
+    }
+  }
+
+  vector<size_t> cells;
+  vector<bool> mask(NumCells(), false);
+  for(size_t cell = 0; cell < NumCells(); ++cell){
+    bool in_region = true;
+    for(size_t iaxis = 0; in_region && iaxis < NumAxes(); ++iaxis){
+      size_t ibin = (cell/strides_.at(iaxis)) % (edges_.at(iaxis).size()-1);
+      in_region = ibin >= first.at(iaxis) && ibin < last.at(iaxis);
+    }
+    if(!in_region) continue;
+    cells.push_back(cell);
+    mask.at(cell) = true;
+  }
+
+  region_names_.push_back(name);
+  region_cells_.push_back(cells);
+  region_mask_.push_back(mask);
+  region_cut_names_.push_back(cut_name == "" ? "1" : cut_name);
+  return *this;
+}
+
+/*!\brief Sets selection applied before locating events in the grid
+
+  \param[in] cut New selection
+
+  \return Reference to *this
+*/
+BinGrid & BinGrid::Cut(const NamedFunc &cut){
+  if(!cut.IsScalar()) ERROR("BinGrid cut "+cut.Name()+" must be scalar");
+  cut_ = cut;
+  return *this;
+}
+
+/*!\brief Replaces the variable binned along an axis, keeping edges and regions
+
+  Useful for building grids for systematic variations (e.g., shifted MET) with
+  the same bins and regions as the nominal grid.
+
+  \param[in] name Name of axis
+
+  \param[in] var New scalar variable
+
+  \return Reference to *this
+*/
+BinGrid & BinGrid::AxisVariable(const string &name, const NamedFunc &var){
+  if(!var.IsScalar()) ERROR("Axis variable "+var.Name()+" must be scalar");
+  vars_.at(AxisIndex(name)) = var;
+  return *this;
+}
+
+/*!\brief Get selection applied before locating events in the grid
+
+  \return Selection
+*/
+const NamedFunc & BinGrid::Cut() const{
+  return cut_;
+}
+
+/*!\brief Get the variable binned along an axis
+
+  \param[in] name Name of axis
+
+  \return Variable binned along the axis
+*/
+const NamedFunc & BinGrid::AxisVariable(const string &name) const{
+  return vars_.at(AxisIndex(name));
+}
+
+/*!\brief Get number of axes
+
+  \return Number of axes
+*/
+size_t BinGrid::NumAxes() const{
+  return names_.size();
+}
+
+/*!\brief Get number of cells in the lattice
+
+  \return Product of number of bins on each axis (1 if there are no axes)
+*/
+size_t BinGrid::NumCells() const{
+  size_t num_cells = 1;
+  for(const auto &edges: edges_) num_cells *= edges.size()-1;
+  return num_cells;
+}
+
+/*!\brief Get number of regions
+
+  \return Number of regions
+*/
+size_t BinGrid::NumRegions() const{
+  return region_names_.size();
+}
+
+/*!\brief Get index of a region
+
+  \param[in] name Name of region
+
+  \return Index of region with given name
+*/
+size_t BinGrid::RegionIndex(const string &name) const{
+  auto loc = find(region_names_.cbegin(), region_names_.cend(), name);
+  if(loc == region_names_.cend()) ERROR("No region named "+name);
+  return loc - region_names_.cbegin();
+}
+
+/*!\brief Get name of a region
+
+  \param[in] iregion Index of region
+
+  \return Name of region
+*/
+const string & BinGrid::RegionName(size_t iregion) const{
+  return region_names_.at(iregion);
+}
+
+/*!\brief Check if a cell belongs to a region
+
+  \param[in] iregion Index of region
+
+  \param[in] cell Cell index as returned by BinGrid::CellIndex
+
+  \return True if cell is in the grid and belongs to region
+*/
+bool BinGrid::InRegion(size_t iregion, long cell) const{
+  return cell >= 0 && region_mask_.at(iregion).at(cell);
+}
+
+/*!\brief Get a cut equivalent to being in a region
+
+  The returned NamedFunc is named with the text of the equivalent cut, but is
+  evaluated by locating the event in a copy of the grid.
+
+  \param[in] name Name of region
+
+  \return Cut selecting events in the region
+*/
+NamedFunc BinGrid::RegionCut(const string &name) const{
+  size_t iregion = RegionIndex(name);
+  shared_ptr<BinGrid> grid = make_shared<BinGrid>(*this);
+  grid->Clear();
+  return NamedFunc(region_cut_names_.at(iregion), [grid, iregion](const Baby &b){
+      return grid->InRegion(iregion, grid->CellIndex(b));
+    });
+}
+
+/*!\brief Locate event in the lattice
+
+  \param[in] baby Baby providing the current event
+
+  \param[in] apply_cut If false, skip evaluation of the grid's selection (e.g.,
+  if already checked by the caller)
+
+  \return Index of cell containing event, or -1 if event fails selection or is
+  outside the bin edges
+*/
+long BinGrid::CellIndex(const Baby &baby, bool apply_cut) const{
+  if(apply_cut && !cut_.GetScalar(baby)) return -1;
+  size_t cell = 0;
+  for(size_t iaxis = 0; iaxis < NumAxes(); ++iaxis){
+    const vector<double> &edges = edges_.at(iaxis);
+    double val = vars_.at(iaxis).GetScalar(baby);
+    auto loc = lower_bound(edges.cbegin(), edges.cend(), val);
+    if(loc == edges.cbegin() || loc == edges.cend()) return -1;
+    cell += strides_.at(iaxis)*((loc - edges.cbegin())-1);
+  }
+  return cell;
+}
+
+/*!\brief Add weight to a cell
+
+  \param[in] cell Cell index as returned by BinGrid::CellIndex. Negative values
+  are ignored.
+
+  \param[in] weight Weight to add
+*/
+void BinGrid::Fill(long cell, double weight){
+  if(cell < 0 || weight == 0.) return;
+  sumw_.at(cell) += weight;
+  sumw2_.at(cell) += weight*weight;
+  ++entries_.at(cell);
+}
+
+/*!\brief Locate event in the lattice and add weight to its cell
+
+  \param[in] baby Baby providing the current event
+
+  \param[in] weight Weight to add
+
+  \return Index of cell containing event, or -1 if not in grid
+*/
+long BinGrid::Fill(const Baby &baby, double weight){
+  long cell = CellIndex(baby);
+  Fill(cell, weight);
+  return cell;
+}
+
+/*!\brief Reset accumulated weights to zero
+ */
+void BinGrid::Clear(){
+  fill(sumw_.begin(), sumw_.end(), 0.);
+  fill(sumw2_.begin(), sumw2_.end(), 0.);
+  fill(entries_.begin(), entries_.end(), 0);
+}
+
+/*!\brief Add weights accumulated by another grid with the same cells
+
+  \param[in] other Grid whose weights are added
+
+  \return Reference to *this
+*/
+BinGrid & BinGrid::operator+=(const BinGrid &other){
+  if(other.NumCells() != NumCells()) ERROR("Cannot merge grids with different numbers of cells");
+  for(size_t cell = 0; cell < NumCells(); ++cell){
+    sumw_.at(cell) += other.sumw_.at(cell);
+    sumw2_.at(cell) += other.sumw2_.at(cell);
+    entries_.at(cell) += other.entries_.at(cell);
+  }
+  return *this;
+}
+
+/*!\brief Get sum of weights in a region
+
+  \param[in] iregion Index of region
+
+  \return Sum of weights over cells in region
+*/
+double BinGrid::SumW(size_t iregion) const{
+  double sumw = 0.;
+  for(const auto &cell: region_cells_.at(iregion)) sumw += sumw_.at(cell);
+  return sumw;
+}
+
+/*!\brief Get sum of squared weights in a region
+
+  \param[in] iregion Index of region
+
+  \return Sum of squared weights over cells in region
+*/
+double BinGrid::SumW2(size_t iregion) const{
+  double sumw2 = 0.;
+  for(const auto &cell: region_cells_.at(iregion)) sumw2 += sumw2_.at(cell);
+  return sumw2;
+}
+
+/*!\brief Get number of events with non-zero weight in a region
+
+  \param[in] iregion Index of region
+
+  \return Number of filled entries over cells in region
+*/
+long BinGrid::Entries(size_t iregion) const{
+  long entries = 0;
+  for(const auto &cell: region_cells_.at(iregion)) entries += entries_.at(cell);
+  return entries;
+}
+
+/*!\brief Get yield and uncertainty in a region
+
+  \param[in] iregion Index of region
+
+  \return Yield with sqrt(sum of squared weights) uncertainty
+*/
+GammaParams BinGrid::Yield(size_t iregion) const{
+  GammaParams gp;
+  gp.SetYieldAndUncertainty(SumW(iregion), sqrt(SumW2(iregion)));
+  return gp;
+}
+
+size_t BinGrid::AxisIndex(const string &name) const{
+  auto loc = find(names_.cbegin(), names_.cend(), name);
+  if(loc == names_.cend()) ERROR("No axis named "+name);
+  return loc - names_.cbegin();
+}
@@ -5,8 +5,10 @@
 #include <tuple>
 #include <array>
 #include <random>
+#include <unordered_map>
 
 #include "core/utilities.hpp"
+#include "core/serialization.hpp"
 
 using namespace std;
 using namespace Clustering;
@@ -19,6 +21,21 @@ namespace{
     seed_seq ss(begin(sd), end(sd));
     return mt19937_64(ss);
   }
+
+  long InitialGridSize(long max_points){
+    //Start with cells a few times finer than needed to hold max_points
+    long grid_size = 1;
+    while(grid_size*grid_size < 4*max_points) grid_size <<= 1;
+    return grid_size;
+  }
+
+  long GridIndex(float val, float low, float high, long grid_size){
+    if(!(high > low)) return 0;
+    long index = static_cast<long>(grid_size*(val-low)/(high-low));
+    if(index < 0) index = 0;
+    if(index >= grid_size) index = grid_size-1;
+    return index;
+  }
 }
 
 Point::Point(float x, float y, float w):
@@ -63,39 +80,66 @@ Clusterizer::Clusterizer(const TH2D &hist_template, long max_points):
   hist_mode_(max_points == 0),
   hist_(hist_template),
   orig_points_(),
+  grid_size_(0),
   nodes_(),
   final_points_(),
   clustered_lumi_(-1.){
   if(max_points_ >= 0 && max_points_ < hist_.GetNcells()){
     max_points_ = hist_.GetNcells();
   }
+  grid_size_ = InitialGridSize(max_points_);
 }
 
+/*!\brief Add a weighted point
+
+  Once max_points points are stored, nearby points are merged into their
+  weighted centroid on a grid which coarsens as needed (see Compact()), so
+  memory stays bounded and the scatter degrades gradually instead of falling
+  back to the histogram.
+*/
 void Clusterizer::AddPoint(float x, float y, float w){
   clustered_lumi_ = -1.;
-  if(orig_points_.size() >= static_cast<size_t>(max_points_)
-     && max_points_ >= 0){
-    hist_mode_ = true;
-    orig_points_.clear();
-  }
   hist_.Fill(x, y, w);
-  if(!hist_mode_){
-    orig_points_.emplace_back(x, y, w);
+  if(hist_mode_) return;
+  if(max_points_ >= 0 && orig_points_.size() >= static_cast<size_t>(max_points_)){
+    Compact();
+  }
+  orig_points_.emplace_back(x, y, w);
+}
+
+/*!\brief Writes the histogram and stored points
+ */
+void Clusterizer::Serialize(ostream &out) const{
+  Serialization::WriteHist(out, hist_);
+  Serialization::WriteVector(out, orig_points_);
+}
+
+/*!\brief Adds the histogram and points written by Serialize() of a Clusterizer
+  with the same binning
+
+  Points are added as with AddPoint(), so the point limit still applies.
+*/
+void Clusterizer::Merge(istream &in){
+  clustered_lumi_ = -1.;
+  Serialization::AddHist(in, hist_);
+  vector<Point> points = Serialization::ReadVector<Point>(in);
+  if(hist_mode_) return;
+  for(const auto &p: points){
+    if(max_points_ >= 0 && orig_points_.size() >= static_cast<size_t>(max_points_)){
+      Compact();
+    }
+    orig_points_.push_back(p);
   }
 }
 
 void Clusterizer::SetPoints(const vector<Point> &points){
   clustered_lumi_ = -1.;
   EmptyHistogram();
-  if(points.size() > static_cast<size_t>(max_points_) && max_points_ >= 0){
-    hist_mode_ = true;
-    orig_points_.clear();
-  }else{
-    hist_mode_ = false;
-    orig_points_ = points;
-  }
+  hist_mode_ = (max_points_ == 0);
+  grid_size_ = InitialGridSize(max_points_);
+  orig_points_.clear();
   for(const auto &p: points){
-    hist_.Fill(p.x_, p.y_, p.w_);
+    AddPoint(p.x_, p.y_, p.w_);
   }
 }
 
@@ -263,6 +307,54 @@ void Clusterizer::EmptyHistogram(){
   hist_.SetEntries(0.);
 }
 
+/*!\brief Merge stored points sharing a grid cell until at most half of
+  max_points remain
+
+  Each merged point sits at the |w|-weighted centroid of its constituents and
+  carries their summed weight, so the total yield is preserved exactly. The grid
+  is halved in resolution each time a pass does not free enough space.
+*/
+void Clusterizer::Compact(){
+  float xmin = hist_.GetXaxis()->GetBinLowEdge(1);
+  float xmax = hist_.GetXaxis()->GetBinUpEdge(hist_.GetNbinsX());
+  float ymin = hist_.GetYaxis()->GetBinLowEdge(1);
+  float ymax = hist_.GetYaxis()->GetBinUpEdge(hist_.GetNbinsY());
+  size_t target = max_points_/2;
+
+  while(orig_points_.size() > target){
+    unordered_map<long, size_t> cell_map;
+    vector<Point> merged;
+    vector<float> sum_abs_w;
+    merged.reserve(orig_points_.size());
+    sum_abs_w.reserve(orig_points_.size());
+    for(const auto &p: orig_points_){
+      long cell = GridIndex(p.x_, xmin, xmax, grid_size_)*grid_size_
+        + GridIndex(p.y_, ymin, ymax, grid_size_);
+      auto loc = cell_map.find(cell);
+      float aw = fabs(p.w_);
+      if(loc == cell_map.end()){
+        cell_map.emplace(cell, merged.size());
+        merged.push_back(p);
+        sum_abs_w.push_back(aw);
+      }else{
+        Point &m = merged.at(loc->second);
+        float &m_aw = sum_abs_w.at(loc->second);
+        if(m_aw + aw > 0.){
+          m.x_ = (m_aw*m.x_ + aw*p.x_)/(m_aw + aw);
+          m.y_ = (m_aw*m.y_ + aw*p.y_)/(m_aw + aw);
+        }
+        m.w_ += p.w_;
+        m_aw += aw;
+      }
+    }
+    orig_points_.swap(merged);
+    if(orig_points_.size() > target){
+      if(grid_size_ <= 1) break;
+      grid_size_ >>= 1;
+    }
+  }
+}
+
 void Clusterizer::Cluster(double luminosity) const{
   if(luminosity == clustered_lumi_) return;
 
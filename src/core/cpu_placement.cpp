@@ -0,0 +1,180 @@
+/*! \class CpuPlacement
+
+  \brief Pins worker threads to CPUs following a placement policy
+
+  The CPUs considered are those in the process affinity mask, so limits set
+  with taskset or by the batch system are respected. They are grouped by NUMA
+  node, read from /sys/devices/system/node. With Policy::compact, workers fill
+  the CPUs of one node before moving to the next. With Policy::scatter, they
+  are dealt round-robin across nodes. Policy::none leaves scheduling to the
+  kernel.
+
+  Each worker calls Pin() with its index before touching any data, so memory
+  it allocates afterwards (ntuple read buffers, histograms) is placed on its
+  own node by the kernel's first-touch policy. Report() lists the CPU and node
+  each worker actually ran on.
+
+  Pinning is only implemented on Linux. Elsewhere Pin() does nothing and all
+  CPUs are reported as unpinned.
+*/
+
+#include "core/cpu_placement.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include "core/utilities.hpp"
+
+using namespace std;
+
+namespace{
+  // Parses a sysfs CPU list such as "0-7,16-23"
+  vector<int> ParseCpuList(const string &list){
+    vector<int> cpus;
+    for(const auto &range: Tokenize(list, ",\n")){
+      size_t dash = range.find('-');
+      int first = stoi(range.substr(0, dash));
+      int last = dash == string::npos ? first : stoi(range.substr(dash+1));
+      for(int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+    }
+    return cpus;
+  }
+}
+
+/*!\brief Plans the CPU of each worker
+
+  \param[in] policy How workers are spread over the allowed CPUs
+
+  \param[in] num_threads Number of workers. Workers beyond the number of
+  allowed CPUs wrap around.
+*/
+CpuPlacement::CpuPlacement(Policy policy, size_t num_threads):
+  policy_(policy),
+  planned_cpus_(num_threads, -1),
+  observed_cpus_(num_threads, -1),
+  node_of_cpu_(),
+  mutex_(){
+  for(const auto &node_dir: Glob("/sys/devices/system/node/node*")){
+    ifstream cpulist(node_dir+"/cpulist");
+    string list;
+    if(!getline(cpulist, list)) continue;
+    int node = stoi(node_dir.substr(node_dir.rfind("node")+4));
+    for(int cpu: ParseCpuList(list)){
+      if(cpu >= static_cast<int>(node_of_cpu_.size())) node_of_cpu_.resize(cpu+1, 0);
+      node_of_cpu_.at(cpu) = node;
+    }
+  }
+
+  vector<int> allowed = AllowedCpus();
+  if(policy_ == Policy::none || allowed.empty()) return;
+
+  // Order CPUs node by node, then interleave the nodes for the scatter policy
+  stable_sort(allowed.begin(), allowed.end(), [this](int a, int b){return Node(a) < Node(b);});
+  if(policy_ == Policy::scatter){
+    vector<vector<int> > by_node;
+    for(int cpu: allowed){
+      if(by_node.empty() || Node(by_node.back().front()) != Node(cpu)) by_node.emplace_back();
+      by_node.back().push_back(cpu);
+    }
+    allowed.clear();
+    for(size_t i = 0; true; ++i){
+      bool added = false;
+      for(const auto &node_cpus: by_node){
+        if(i < node_cpus.size()){
+          allowed.push_back(node_cpus.at(i));
+          added = true;
+        }
+      }
+      if(!added) break;
+    }
+  }
+  for(size_t iworker = 0; iworker < num_threads; ++iworker){
+    planned_cpus_.at(iworker) = allowed.at(iworker % allowed.size());
+  }
+}
+
+/*!\brief Pins the calling thread to the CPU planned for a worker
+
+  \param[in] iworker Index of the worker the calling thread runs
+*/
+void CpuPlacement::Pin(size_t iworker){
+  if(iworker >= planned_cpus_.size()) return;
+#ifdef __linux__
+  int cpu = planned_cpus_.at(iworker);
+  if(cpu >= 0){
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    CPU_SET(cpu, &mask);
+    if(sched_setaffinity(0, sizeof(mask), &mask) != 0){
+      DBG("Could not pin worker " << iworker << " to CPU " << cpu);
+    }
+  }
+  lock_guard<mutex> lock(mutex_);
+  observed_cpus_.at(iworker) = sched_getcpu();
+#endif
+}
+
+/*!\brief Describes the placement of each worker that has called Pin()
+ */
+string CpuPlacement::Report() const{
+  lock_guard<mutex> lock(mutex_);
+  ostringstream oss;
+  oss << "Thread placement (" << PolicyName(policy_) << "):";
+  for(size_t iworker = 0; iworker < observed_cpus_.size(); ++iworker){
+    int cpu = observed_cpus_.at(iworker);
+    oss << (iworker % 8 == 0 ? "\n  " : ", ") << "worker " << iworker << " -> ";
+    if(cpu < 0) oss << "unknown";
+    else oss << "cpu " << cpu << " (node " << Node(cpu) << ")";
+    if(planned_cpus_.at(iworker) < 0) oss << " unpinned";
+  }
+  return oss.str();
+}
+
+/*!\brief CPUs in the process affinity mask, in increasing order
+ */
+vector<int> CpuPlacement::AllowedCpus(){
+  vector<int> cpus;
+#ifdef __linux__
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+  if(sched_getaffinity(0, sizeof(mask), &mask) == 0){
+    for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu){
+      if(CPU_ISSET(cpu, &mask)) cpus.push_back(cpu);
+    }
+  }
+#endif
+  if(cpus.empty()){
+    for(unsigned cpu = 0; cpu < thread::hardware_concurrency(); ++cpu) cpus.push_back(cpu);
+  }
+  return cpus;
+}
+
+/*!\brief Converts "none", "compact" or "scatter" to a Policy
+ */
+CpuPlacement::Policy CpuPlacement::ParsePolicy(const string &name){
+  if(name == "" || name == "none") return Policy::none;
+  else if(name == "compact") return Policy::compact;
+  else if(name == "scatter") return Policy::scatter;
+  ERROR("Unknown CPU affinity policy "+name+". Use none, compact or scatter.");
+  return Policy::none;
+}
+
+string CpuPlacement::PolicyName(Policy policy){
+  switch(policy){
+  case Policy::none: return "none";
+  case Policy::compact: return "compact";
+  case Policy::scatter: return "scatter";
+  default: return "unknown";
+  }
+}
+
+int CpuPlacement::Node(int cpu) const{
+  if(cpu < 0 || cpu >= static_cast<int>(node_of_cpu_.size())) return 0;
+  return node_of_cpu_.at(cpu);
+}
@@ -1,7 +1,9 @@
 #include "core/event_scan.hpp"
 
+#include <cstdio>
+
 #include <iostream>
-#include <iomanip>
+#include <utility>
 
 #include <sys/stat.h>
 
@@ -16,13 +18,37 @@ EventScan::SingleScan::SingleScan(const EventScan &event_scan,
   full_cut_(event_scan.cut_ && process->cut_),
   cut_vector_(),
   val_vectors_(event_scan.columns_.size()),
-  row_(0){
-  out_.precision(event_scan.Precision());
+  row_(0),
+  precision_(event_scan.Precision()),
+  batch_(),
+  queue_(),
+  queue_mutex_(),
+  queue_cv_(),
+  writing_(false),
+  done_(false),
+  writer_(){
+  writer_ = thread(&EventScan::SingleScan::WriteBatches, this);
+}
+
+EventScan::SingleScan::~SingleScan(){
+  QueueBatch();
+  {
+    lock_guard<mutex> lock(queue_mutex_);
+    done_ = true;
+  }
+  queue_cv_.notify_all();
+  writer_.join();
 }
 
+/*!\brief Copies values to be printed into the current batch
+
+  Formatting and writing to disk happen on a separate thread, so the event loop
+  only pays for copying the values.
+
+  \param[in] baby Baby providing the current event
+*/
 void EventScan::SingleScan::RecordEvent(const Baby &baby){
   const EventScan &scan = static_cast<const EventScan&>(figure_);
-  int w = scan.width_;
 
   if(full_cut_.IsScalar()){
     if(!full_cut_.GetScalar(baby)) return;
@@ -35,6 +61,7 @@ void EventScan::SingleScan::RecordEvent(const Baby &baby){
     const NamedFunc& col = scan.columns_.at(icol);
     if(col.IsScalar()){
       if(max_size < 1) max_size = 1;
+      val_vectors_.at(icol).assign(1, col.GetScalar(baby));
     }else{
       val_vectors_.at(icol) = col.GetVector(baby);
       if(val_vectors_.at(icol).size() > max_size){
@@ -46,36 +73,119 @@ void EventScan::SingleScan::RecordEvent(const Baby &baby){
     max_size = cut_vector_.size();
   }
 
-  if(max_size > 0 && !(row_ & 0x7)){
-    out_ << "      Row Instance";
-    for(const auto &col: scan.columns_){
-      out_ << ' ' << setw(w) << col.Name().substr(0,scan.width_);
-    }
-    out_.put('\n');
-  }
-
   for(size_t instance = 0; instance < max_size; ++instance){
-    out_ << setw(9) << row_ << ' ' << setw(8) << instance;
+    batch_.rows_.push_back(row_);
+    batch_.instances_.push_back(instance);
     for(size_t icol = 0; icol < scan.columns_.size(); ++icol){
-      const NamedFunc& col = scan.columns_.at(icol);
-      if(col.IsScalar()){
-        out_ << ' ' << setw(w) << col.GetScalar(baby);
+      const NamedFunc::VectorType &vals = val_vectors_.at(icol);
+      if(scan.columns_.at(icol).IsScalar()){
+        batch_.values_.push_back(vals.front());
+        batch_.filled_.push_back(true);
+      }else if(instance < vals.size()){
+        batch_.values_.push_back(vals[instance]);
+        batch_.filled_.push_back(true);
       }else{
-        if(instance < val_vectors_.at(icol).size()){
-          out_ << ' ' << setw(w) << val_vectors_.at(icol).at(instance);
-        }else{
-	  out_ << ' ' << setw(w) << ' ';
-	}
+        batch_.values_.push_back(0.);
+        batch_.filled_.push_back(false);
       }
     }
-    out_.put('\n');
   }
 
   if(max_size > 0) ++row_;
+  if(batch_.values_.size() >= max_batch_values_) QueueBatch();
 }
 
 void EventScan::SingleScan::Precision(unsigned precision){
-  out_.precision(precision);
+  precision_ = precision;
+}
+
+/*!\brief Writes all recorded rows to disk, returning once the file is complete
+ */
+void EventScan::SingleScan::Flush(){
+  QueueBatch();
+  unique_lock<mutex> lock(queue_mutex_);
+  queue_cv_.wait(lock, [this]{return queue_.empty() && !writing_;});
+}
+
+/*!\brief Hands the current batch to the writer thread
+
+  Blocks if the writer has fallen too far behind, bounding memory use.
+*/
+void EventScan::SingleScan::QueueBatch(){
+  if(batch_.rows_.empty()) return;
+  batch_.precision_ = precision_;
+  {
+    unique_lock<mutex> lock(queue_mutex_);
+    queue_cv_.wait(lock, [this]{return queue_.size() < max_queued_batches_;});
+    queue_.push_back(move(batch_));
+  }
+  queue_cv_.notify_all();
+  batch_ = Batch();
+  batch_.values_.reserve(max_batch_values_);
+}
+
+/*!\brief Writer thread loop, formatting batches until told to stop
+ */
+void EventScan::SingleScan::WriteBatches(){
+  unique_lock<mutex> lock(queue_mutex_);
+  while(true){
+    queue_cv_.wait(lock, [this]{return done_ || !queue_.empty();});
+    if(queue_.empty()) break;
+    Batch batch = move(queue_.front());
+    queue_.pop_front();
+    writing_ = true;
+    lock.unlock();
+    queue_cv_.notify_all();
+
+    WriteBatch(batch);
+
+    lock.lock();
+    writing_ = false;
+    queue_cv_.notify_all();
+  }
+}
+
+/*!\brief Formats a batch of rows and writes it to out_
+
+  Lines are formatted with snprintf, reproducing the layout of iostream's setw
+  and default floating point notation with the given precision.
+
+  \param[in] batch Rows to write
+*/
+void EventScan::SingleScan::WriteBatch(const Batch &batch){
+  const EventScan &scan = static_cast<const EventScan&>(figure_);
+  const size_t ncols = scan.columns_.size();
+  const int w = batch.precision_+6;
+  const int p = batch.precision_;
+
+  string text;
+  text.reserve(batch.rows_.size()*(18+ncols*(w+1)+1));
+  vector<char> buf(w+64);
+  for(size_t iline = 0; iline < batch.rows_.size(); ++iline){
+    size_t row = batch.rows_[iline], instance = batch.instances_[iline];
+    if(instance == 0 && !(row & 0x7)){
+      text += "      Row Instance";
+      for(const auto &col: scan.columns_){
+        snprintf(buf.data(), buf.size(), " %*s", w, col.Name().substr(0, w).c_str());
+        text += buf.data();
+      }
+      text += '\n';
+    }
+    snprintf(buf.data(), buf.size(), "%9zu %8zu", row, instance);
+    text += buf.data();
+    for(size_t icol = 0; icol < ncols; ++icol){
+      size_t ival = iline*ncols+icol;
+      if(batch.filled_[ival]){
+        snprintf(buf.data(), buf.size(), " %*.*g", w, p, batch.values_[ival]);
+        text += buf.data();
+      }else{
+        text.append(w+1, ' ');
+      }
+    }
+    text += '\n';
+  }
+  out_.write(text.data(), text.size());
+  out_.flush();
 }
 
 EventScan::EventScan(const string &name,
@@ -97,6 +207,7 @@ EventScan::EventScan(const string &name,
 void EventScan::Print(double /*luminosity*/,
                       const std::string & /*subdir*/){
   for(const auto &scan: scans_){
+    scan->Flush();
     cout << "less " << (CodeToPlainText(name_+"_SCAN_"+scan->process_->name_)+".txt") << endl;
   }
 }
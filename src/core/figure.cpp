@@ -10,3 +10,28 @@ Figure::FigureComponent::FigureComponent(const Figure &figure,
   process_(process),
   mutex_(){
 }
+
+/*!\brief Whether Serialize() and Merge() are implemented
+
+  Components that are filled in separate processes and combined afterwards
+  must return true.
+*/
+bool Figure::FigureComponent::Mergeable() const{
+  return false;
+}
+
+/*!\brief Writes everything accumulated by RecordEvent()
+
+  \param[in,out] out Stream to which the accumulators are written
+*/
+void Figure::FigureComponent::Serialize(ostream &/*out*/) const{
+  ERROR("Component for process "+process_->name_+" cannot be serialized");
+}
+
+/*!\brief Adds accumulators written by Serialize() of an identical component
+
+  \param[in,out] in Stream from which the accumulators are read
+*/
+void Figure::FigureComponent::Merge(istream &/*in*/){
+  ERROR("Component for process "+process_->name_+" cannot be merged");
+}
@@ -0,0 +1,214 @@
+/*! \class FileCatalog
+
+  \brief Persistent cache of glob expansions and ntuple entry counts
+
+  Expanding the file patterns of every Process and counting the entries of
+  every Baby otherwise requires listing directories, resolving each file with
+  realpath and opening each file, which takes minutes for thousands of files on
+  NFS. The catalog remembers these results across runs so that a file only
+  needs to be stat'ed.
+
+  A cached glob expansion is reused while the modification time of the
+  directory it lists is unchanged, which is the case until files are added,
+  removed or renamed. Only patterns whose wildcards are in the file name, not
+  in the directory part, are cached. A cached entry count is reused while the
+  size and modification time of the file are unchanged.
+
+  The catalog is stored in ~/.cache/ra4_draw/file_catalog.txt, or in the file
+  named by the RA4_DRAW_CATALOG environment variable. Setting it to an empty
+  string keeps the catalog in memory only. The file is read on first use and
+  rewritten at exit if anything changed, merging in entries written by other
+  processes in the meantime.
+*/
+
+#include "core/file_catalog.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+
+#include <fstream>
+#include <sstream>
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "core/utilities.hpp"
+
+using namespace std;
+
+/*!\brief Catalog shared by the whole process, loaded on first use
+ */
+FileCatalog & FileCatalog::Get(){
+  static FileCatalog catalog;
+  return catalog;
+}
+
+/*!\brief Expands a file pattern like ::Glob(), reusing the previous result if the
+  directory has not changed
+
+  \param[in] pattern Pattern with wildcards
+
+  \return Real paths of the matching files
+*/
+set<string> FileCatalog::Glob(const string &pattern){
+  size_t slash = pattern.rfind('/');
+  string dir = slash == string::npos ? "." : pattern.substr(0, slash+1);
+  int64_t size, dir_mtime;
+  if(pattern.find('~') == 0
+     || dir.find_first_of("*?[") != string::npos
+     || !Stat(dir, size, dir_mtime)){
+    return ::Glob(pattern);
+  }
+
+  lock_guard<mutex> lock(mutex_);
+  auto found = globs_.find(pattern);
+  if(found != globs_.end() && found->second.dir_mtime == dir_mtime){
+    return found->second.matches;
+  }
+  GlobInfo &info = globs_[pattern];
+  info.dir_mtime = dir_mtime;
+  info.matches = ::Glob(pattern);
+  modified_ = true;
+  return info.matches;
+}
+
+/*!\brief Number of entries in a file, if known and the file is unchanged
+
+  \param[in] path Real path of the file
+
+  \return Number of entries, or -1 if unknown
+*/
+long FileCatalog::Entries(const string &path){
+  int64_t size, mtime;
+  if(!Stat(path, size, mtime)) return -1;
+  lock_guard<mutex> lock(mutex_);
+  auto found = files_.find(path);
+  if(found == files_.end()
+     || found->second.size != size
+     || found->second.mtime != mtime) return -1;
+  return found->second.entries;
+}
+
+/*!\brief Records the number of entries in a file
+
+  \param[in] path Real path of the file
+
+  \param[in] entries Number of entries in its tree
+*/
+void FileCatalog::SetEntries(const string &path, long entries){
+  {
+    lock_guard<mutex> lock(mutex_);
+    auto found = files_.find(path);
+    if(found != files_.end() && found->second.entries == entries) return;
+  }
+  int64_t size, mtime;
+  if(!Stat(path, size, mtime)) return;
+  lock_guard<mutex> lock(mutex_);
+  files_[path] = FileInfo{size, mtime, entries};
+  modified_ = true;
+}
+
+const string & FileCatalog::Path() const{
+  return path_;
+}
+
+FileCatalog::FileCatalog():
+  files_(),
+  globs_(),
+  path_(),
+  modified_(false),
+  mutex_(){
+  const char *env_path = getenv("RA4_DRAW_CATALOG");
+  const char *home = getenv("HOME");
+  if(env_path != nullptr){
+    path_ = env_path;
+  }else if(home != nullptr){
+    string dir = string(home)+"/.cache";
+    mkdir(dir.c_str(), 0755);
+    dir += "/ra4_draw";
+    mkdir(dir.c_str(), 0755);
+    path_ = dir+"/file_catalog.txt";
+  }
+  if(path_ != "") Load(path_);
+  modified_ = false;
+}
+
+FileCatalog::~FileCatalog(){
+  try{
+    Save();
+  }catch(...){
+  }
+}
+
+/*!\brief Adds the entries of a catalog file that are not already known
+
+  Each line is either "F size mtime entries path" for a file, or "G mtime
+  num_matches pattern" for a glob, followed by its matches one per line.
+*/
+void FileCatalog::Load(const string &path){
+  ifstream file(path);
+  string line;
+  while(getline(file, line)){
+    istringstream iss(line);
+    char kind;
+    if(!(iss >> kind)) continue;
+    if(kind == 'F'){
+      FileInfo info;
+      string name;
+      if(!(iss >> info.size >> info.mtime >> info.entries) || !getline(iss >> ws, name)) continue;
+      files_.emplace(name, info);
+    }else if(kind == 'G'){
+      GlobInfo info;
+      size_t num_matches;
+      string pattern;
+      if(!(iss >> info.dir_mtime >> num_matches) || !getline(iss >> ws, pattern)) continue;
+      string match;
+      for(size_t i = 0; i < num_matches && getline(file, match); ++i){
+        info.matches.insert(match);
+      }
+      if(info.matches.size() == num_matches) globs_.emplace(pattern, info);
+    }
+  }
+}
+
+/*!\brief Writes the catalog to disk if it changed
+
+  Entries added to the file by other processes since it was loaded are kept.
+  The file is replaced atomically so a concurrent reader never sees it half
+  written.
+*/
+void FileCatalog::Save(){
+  lock_guard<mutex> lock(mutex_);
+  if(path_ == "" || !modified_) return;
+  Load(path_);
+
+  string tmp_path = path_+"."+to_string(getpid());
+  ofstream file(tmp_path);
+  if(!file) return;
+  for(const auto &entry: files_){
+    file << "F " << entry.second.size << ' ' << entry.second.mtime << ' '
+         << entry.second.entries << ' ' << entry.first << '\n';
+  }
+  for(const auto &entry: globs_){
+    file << "G " << entry.second.dir_mtime << ' ' << entry.second.matches.size()
+         << ' ' << entry.first << '\n';
+    for(const auto &match: entry.second.matches){
+      file << match << '\n';
+    }
+  }
+  file.close();
+  if(!file || rename(tmp_path.c_str(), path_.c_str()) != 0){
+    DBG("Could not write file catalog " << path_);
+    remove(tmp_path.c_str());
+  }
+  modified_ = false;
+}
+
+bool FileCatalog::Stat(const string &path, int64_t &size, int64_t &mtime){
+  struct stat info;
+  if(stat(path.c_str(), &info) != 0) return false;
+  size = info.st_size;
+  mtime = INT64_C(1000000000)*info.st_mtim.tv_sec+info.st_mtim.tv_nsec;
+  return true;
+}
@@ -194,16 +194,18 @@ void FunctionParser::ResolveVariables() const{
 	token = Functions::n_mus_bad_dupl;
       }
       else {
-	token.function_ = Baby::GetFunction(token.string_rep_);
+	token.function_ = Baby::GetFunction(token.string_rep_).MarkVariable(token.string_rep_);
 	token.type_ = token.function_.IsScalar() ? Token::Type::resolved_scalar : Token::Type::resolved_vector;
       }
+      //A variable name always resolves to the same function
+      if(token.function_.Name() == token.string_rep_) token.function_.NameDefinesFunction(true);
     }else if(token.type_ == Token::Type::number){
       char *cp = nullptr;
       NamedFunc::ScalarType val = strtod(&token.string_rep_[0], &cp);
       token.function_ = NamedFunc(token.string_rep_,
                                   [val](const Baby &){
                                     return val;
-                                  });
+                                  }).NameDefinesFunction(true);
       token.type_ = Token::Type::resolved_scalar;
     }
   }
@@ -243,7 +245,7 @@ void FunctionParser::MergeParentheses() const{
 
     string name = ConcatenateTokenStrings(i, i+3);
     NamedFunc merged_func = inner.function_;
-    merged_func.Name(name);
+    merged_func.Name(name).NameDefinesFunction(inner.function_.NameDefinesFunction());
     Token merged(merged_func);
 
     CondenseTokens(i, i+3, merged);
@@ -270,13 +272,11 @@ void FunctionParser::ApplySubscripts() const{
       continue;
     }
 
-    function<VectorFunc> vec_func = vec.function_.VectorFunction();
-    function<ScalarFunc> sub_func = sub.function_.ScalarFunction();
-    function<ScalarFunc> function = [vec_func,sub_func](const Baby &b){
-      return vec_func(b).at(sub_func(b));
-    };
     string name = ConcatenateTokenStrings(i, i+4);
-    Token merged(NamedFunc(name, function));
+    NamedFunc merged_func = vec.function_[sub.function_];
+    bool defines = merged_func.NameDefinesFunction();
+    merged_func.Name(name).NameDefinesFunction(defines);
+    Token merged(merged_func);
 
     CondenseTokens(i, i+4, merged);
   }
@@ -561,8 +561,10 @@ void FunctionParser::CheckSolved() const{
 */
 void FunctionParser::CleanupName() const{
   if(tokens_.size() == 1){
+    NamedFunc &function = tokens_.at(0).function_;
+    bool defines = function.NameDefinesFunction();
     tokens_.at(0).string_rep_ = input_string_;
-    tokens_.at(0).function_.Name(input_string_);
+    function.Name(input_string_).NameDefinesFunction(defines);
   }
 }
 
@@ -489,6 +489,7 @@ void WriteBaseHeader(const set<Variable> &vars,
   file << "  Baby& operator=(const Baby &) = delete;\n\n";
 
   file << "  std::set<std::string> file_names_;//!<Files loaded into TChain\n";
+  file << "  std::size_t num_activators_;//!<Live Activators. The chain is open while this is positive.\n";
   file << "  int sample_type_;//!< Integer indicating what kind of sample the first file has\n";
   file << "  mutable long total_entries_;//!<Cached number of events in TChain\n";
   file << "  mutable bool cached_total_entries_;//!<Flag if cached event count up to date\n\n";
@@ -544,12 +545,15 @@ void WriteBaseSource(const set<Variable> &vars){
   file << "#include \"core/baby.hpp\"\n\n";
 
   file << "#include <mutex>\n";
+  file << "#include <vector>\n";
   file << "#include <type_traits>\n";
   file << "#include <utility>\n";
   file << "#include <stdexcept>\n\n";
 
   file << "#include \"core/named_func.hpp\"\n";
-  file << "#include \"core/utilities.hpp\"\n\n";
+  file << "#include \"core/utilities.hpp\"\n";
+  file << "#include \"core/file_catalog.hpp\"\n";
+  file << "#include \"core/staging_cache.hpp\"\n\n";
 
   file << "using namespace std;\n\n";
 
@@ -623,13 +627,17 @@ void WriteBaseSource(const set<Variable> &vars){
   }
   file << "}\n\n";
 
+  file << "/*!\\brief Opens the chain unless another Activator already holds it open\n\n";
+  file << "  Activators of the same Baby must be created and destroyed by one thread at\n";
+  file << "  a time. Holding one keeps the files open across passes over the Baby.\n";
+  file << "*/\n";
   file << "Baby::Activator::Activator(Baby &baby):\n";
   file << "  baby_(baby){\n";
-  file << "  baby_.ActivateChain();\n";
+  file << "  if(baby_.num_activators_++ == 0) baby_.ActivateChain();\n";
   file << "}\n\n";
 
   file << "Baby::Activator::~Activator(){\n";
-  file << "  baby_.DeactivateChain();\n";
+  file << "  if(--baby_.num_activators_ == 0) baby_.DeactivateChain();\n";
   file << "}\n\n";
 
   file << "/*!\\brief Standard constructor\n\n";
@@ -641,6 +649,7 @@ void WriteBaseSource(const set<Variable> &vars){
   file << "  processes_(processes),\n";
   file << "  chain_(nullptr),\n";
   file << "  file_names_(file_names),\n";
+  file << "  num_activators_(0),\n";
   file << "  total_entries_(0),\n";
   auto last_base = vars.cbegin();
   bool found_in_base = false;
@@ -676,8 +685,16 @@ void WriteBaseSource(const set<Variable> &vars){
   file << "long Baby::GetEntries() const{\n";
   file << "  if(!cached_total_entries_){\n";
   file << "    cached_total_entries_ = true;\n";
-  file << "    lock_guard<mutex> lock(Multithreading::root_mutex);\n";
+  file << "    auto lock = Multithreading::TimedLock(Multithreading::root_mutex);\n";
   file << "    total_entries_ = chain_->GetEntries();\n";
+  file << "    if(chain_->GetNtrees() == static_cast<int>(file_names_.size())){\n";
+  file << "      const auto offsets = chain_->GetTreeOffset();\n";
+  file << "      int ifile = 0;\n";
+  file << "      for(const auto &file: file_names_){\n";
+  file << "        FileCatalog::Get().SetEntries(file, offsets[ifile+1]-offsets[ifile]);\n";
+  file << "        ++ifile;\n";
+  file << "      }\n";
+  file << "    }\n";
   file << "  }\n";
   file << "  return total_entries_;\n";
   file << "}\n\n";
@@ -691,7 +708,7 @@ void WriteBaseSource(const set<Variable> &vars){
     if(!var.ImplementInBase()) continue;
     file << "  c_" << var.Name() << "_ = false;\n";
   }
-  file << "  lock_guard<mutex> lock(Multithreading::root_mutex);\n";
+  file << "  auto lock = Multithreading::TimedLock(Multithreading::root_mutex);\n";
   file << "  entry_ = chain_->LoadTree(entry);\n";
   file << "}\n\n";
 
@@ -771,16 +788,23 @@ void WriteBaseSource(const set<Variable> &vars){
 
   file << "void Baby::ActivateChain(){\n";
   file << "  if(chain_) ERROR(\"Chain has already been initialized\");\n";
-  file << "  lock_guard<mutex> lock(Multithreading::root_mutex);\n";
-  file << "  chain_ = unique_ptr<TChain>(new TChain(\"tree\"));\n";
+  file << "  // Staging may copy files, so it is done before taking the ROOT lock\n";
+  file << "  vector<pair<string, long> > inputs;\n";
   file << "  for(const auto &file: file_names_){\n";
-  file << "    chain_->Add(file.c_str());\n";
+  file << "    inputs.emplace_back(StagingCache::Get().Local(file), FileCatalog::Get().Entries(file));\n";
+  file << "  }\n";
+  file << "  auto lock = Multithreading::TimedLock(Multithreading::root_mutex);\n";
+  file << "  chain_ = unique_ptr<TChain>(new TChain(\"tree\"));\n";
+  file << "  for(const auto &input: inputs){\n";
+  file << "    // With a known entry count, the chain does not open the file until it is read\n";
+  file << "    if(input.second > 0) chain_->Add(input.first.c_str(), input.second);\n";
+  file << "    else chain_->Add(input.first.c_str());\n";
   file << "  }\n";
   file << "  Initialize();\n";
   file << "}\n\n";
 
   file << "void Baby::DeactivateChain(){\n";
-  file << "  lock_guard<mutex> lock(Multithreading::root_mutex);\n";
+  file << "  auto lock = Multithreading::TimedLock(Multithreading::root_mutex);\n";
   file << "  chain_.reset();\n";
   file << "}\n\n";
 
@@ -44,6 +44,7 @@
 #include "TLegendEntry.h"
 
 #include "core/utilities.hpp"
+#include "core/serialization.hpp"
 
 using namespace std;
 using namespace PlotOptTypes;
@@ -200,6 +201,18 @@ void Hist1D::SingleHist1D::RecordEvent(const Baby &baby){
   }
 }
 
+bool Hist1D::SingleHist1D::Mergeable() const{
+  return true;
+}
+
+void Hist1D::SingleHist1D::Serialize(ostream &out) const{
+  Serialization::WriteHist(out, raw_hist_);
+}
+
+void Hist1D::SingleHist1D::Merge(istream &in){
+  Serialization::AddHist(in, raw_hist_);
+}
+
 /*! Get the maximum of the histogram
 
   \param[in] max_bound Returns the highest bin content c satisfying
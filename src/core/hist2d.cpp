@@ -16,6 +16,7 @@
 #include "TColor.h"
 #include "TArrow.h"
 #include "core/named_func.hpp"
+#include "core/serialization.hpp"
 
 using namespace std;
 using namespace PlotOptTypes;
@@ -95,6 +96,18 @@ void Hist2D::SingleHist2D::RecordEvent(const Baby &baby){
   }
 }
 
+bool Hist2D::SingleHist2D::Mergeable() const{
+  return true;
+}
+
+void Hist2D::SingleHist2D::Serialize(ostream &out) const{
+  clusterizer_.Serialize(out);
+}
+
+void Hist2D::SingleHist2D::Merge(istream &in){
+  clusterizer_.Merge(in);
+}
+
 Hist2D::Hist2D(const Axis &xaxis, const Axis &yaxis, const NamedFunc &cut,
                const std::vector<std::shared_ptr<Process> > &processes,
                const std::vector<PlotOpt> &plot_options):
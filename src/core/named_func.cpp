@@ -38,13 +38,25 @@
   extra vectors being constructed (and often copied if care is not taken with
   results) even when evaluating a simple scalar value.
 
+  Functions built from Baby variables by FunctionParser (and anything built
+from those with the operators above) remember which variables they depend on
+and the operands they were built from. NamedFunc::Rebind() uses this to produce
+a copy of the function in which some variables are replaced by other functions,
+e.g. a systematically shifted version of each kinematic variable. Only the
+operations which depend on a replaced variable are rebuilt, so all other
+sub-expressions are shared with the original function and the expression string
+is never parsed again. Replacement is by whole variable, so "met" is rebound
+without touching "met_calo".
+
   \see FunctionParser for allowed expression syntax for constructing a
   NamedFunc.
 */
 #include "core/named_func.hpp"
 
+#include <cstdlib>
 #include <iostream>
 #include <utility>
+#include <set>
 
 #include "core/utilities.hpp"
 #include "core/function_parser.hpp"
@@ -55,6 +67,26 @@ using ScalarType = NamedFunc::ScalarType;
 using VectorType = NamedFunc::VectorType;
 using ScalarFunc = NamedFunc::ScalarFunc;
 using VectorFunc = NamedFunc::VectorFunc;
+using Bindings = NamedFunc::Bindings;
+
+/*!\brief Record of how a NamedFunc was built, used to rebuild it with some
+  variables replaced
+*/
+struct NamedFunc::Rebinder{
+  set<string> variables_;//!<Names of variables the function depends on
+  function<NamedFunc(const Bindings &)> rebuild_;//!<Rebuilds the function from its rebound operands
+};
+
+/*!\brief Operands of a chain of "&&", kept as a tree of shared nodes so that
+  joining two chains does not copy either
+*/
+struct NamedFunc::Conjunction{
+  static shared_ptr<const Conjunction> Of(const NamedFunc &f);
+
+  vector<NamedFunc> operand_;//!<The operand if this node is a single operand; empty otherwise
+  shared_ptr<const Conjunction> first_;//!<Left hand chain if this node joins two chains
+  shared_ptr<const Conjunction> second_;//!<Right hand chain if this node joins two chains
+};
 
 namespace{
   /*!\brief Get a functor applying unary operator op to f
@@ -311,7 +343,10 @@ NamedFunc::NamedFunc(const std::string &name,
                      const std::function<ScalarFunc> &function):
   name_(name),
   scalar_func_(function),
-  vector_func_(){
+  vector_func_(),
+  conjunction_(),
+  rebinder_(),
+  name_defines_function_(false){
   CleanName();
 }
 
@@ -325,7 +360,10 @@ NamedFunc::NamedFunc(const std::string &name,
                      const std::function<VectorFunc> &function):
   name_(name),
   scalar_func_(),
-  vector_func_(function){
+  vector_func_(function),
+  conjunction_(),
+  rebinder_(),
+  name_defines_function_(false){
   CleanName();
   }
 
@@ -366,7 +404,13 @@ NamedFunc::NamedFunc(const TString &function):
 NamedFunc::NamedFunc(ScalarType x):
   name_(ToString(x)),
   scalar_func_([x](const Baby&){return x;}),
-  vector_func_(){
+  vector_func_(),
+  conjunction_(),
+  rebinder_(),
+  name_defines_function_(false){
+  //The name is only a definition if it reads back as exactly x
+  char *end = nullptr;
+  name_defines_function_ = strtod(name_.c_str(), &end) == x && *end == '\0';
 }
 
 /*!\brief Get the string representation of this function
@@ -384,6 +428,34 @@ const string & NamedFunc::Name() const{
 NamedFunc & NamedFunc::Name(const string &name){
   name_ = name;
   CleanName();
+  name_defines_function_ = false;
+  return *this;
+}
+
+/*!\brief Check if the name fully determines the function
+
+  True for functions parsed from a string and for anything built from them
+  with operators, since parsing Name() reproduces the function. False once a
+  user-supplied functor or name is involved, in which case two functions with
+  the same name may differ.
+
+  \return True if functions with equal names that both return true are equal
+*/
+bool NamedFunc::NameDefinesFunction() const{
+  return name_defines_function_;
+}
+
+/*!\brief Declare whether parsing the name gives this function
+
+  Set by FunctionParser; only set it elsewhere if the name parses to exactly
+  *this.
+
+  \param[in] defines True if parsing Name() gives this function
+
+  \return Reference to *this
+*/
+NamedFunc & NamedFunc::NameDefinesFunction(bool defines){
+  name_defines_function_ = defines;
   return *this;
 }
 
@@ -400,6 +472,9 @@ NamedFunc & NamedFunc::Function(const std::function<ScalarFunc> &f){
   if(!static_cast<bool>(f)) return *this;
   scalar_func_ = f;
   vector_func_ = function<VectorFunc>();
+  conjunction_.reset();
+  rebinder_.reset();
+  name_defines_function_ = false;
   return *this;
 }
 
@@ -416,6 +491,9 @@ NamedFunc & NamedFunc::Function(const std::function<VectorFunc> &f){
   if(!static_cast<bool>(f)) return *this;
   scalar_func_ = function<ScalarFunc>();
   vector_func_ = f;
+  conjunction_.reset();
+  rebinder_.reset();
+  name_defines_function_ = false;
   return *this;
 }
 
@@ -451,6 +529,83 @@ bool NamedFunc::IsVector() const{
   return static_cast<bool>(vector_func_);
 }
 
+/*!\brief Get the scalar operands of a chain of "&&"
+
+  For a scalar function built as a&&b&&c (either with operator&& or from a
+  parsed string), returns {a, b, c} in evaluation order. For any other function,
+  returns {*this}. Used to share evaluation of common sub-cuts, e.g. between
+  cut-flow rows of a Table.
+
+  \return Operands whose conjunction is equivalent to *this
+*/
+vector<NamedFunc> NamedFunc::Conjuncts() const{
+  if(!conjunction_) return vector<NamedFunc>{*this};
+  vector<NamedFunc> conjuncts;
+  vector<const Conjunction*> pending(1, conjunction_.get());
+  while(pending.size()){
+    const Conjunction *node = pending.back();
+    pending.pop_back();
+    if(node->operand_.size()){
+      conjuncts.push_back(node->operand_.front());
+    }else{
+      pending.push_back(node->second_.get());
+      pending.push_back(node->first_.get());
+    }
+  }
+  return conjuncts;
+}
+
+/*!\brief Mark *this as the Baby variable with the given name
+
+  Allows the variable to be replaced in *this and in any function built from it
+  using NamedFunc::Rebind(). Done automatically by FunctionParser for every Baby
+  variable in a parsed expression.
+
+  \param[in] variable Name of the variable *this evaluates
+
+  \return Reference to *this
+*/
+NamedFunc & NamedFunc::MarkVariable(const string &variable){
+  auto rebinder = make_shared<Rebinder>();
+  rebinder->variables_.insert(variable);
+  rebinder->rebuild_ = [variable](const Bindings &bindings){
+    return bindings.at(variable);
+  };
+  rebinder_ = rebinder;
+  return *this;
+}
+
+/*!\brief Check if *this depends on a rebindable variable
+
+  \param[in] variable Name of the variable
+
+  \return True if replacing variable with NamedFunc::Rebind() would change *this
+*/
+bool NamedFunc::DependsOn(const string &variable) const{
+  return rebinder_ && rebinder_->variables_.count(variable);
+}
+
+/*!\brief Get copy of *this with some variables replaced by other functions
+
+  Only operations depending on a replaced variable are rebuilt. Everything else,
+  including *this if it depends on none of the replaced variables, is shared
+  with the original function, so no string is parsed and unchanged
+  sub-expressions keep their compiled functors. Variables are matched by whole
+  name, and functions built from custom functors (rather than parsed strings or
+  operators) are treated as opaque and left as is.
+
+  \param[in] bindings Map from variable name to the function replacing it
+
+  \return Function equivalent to *this evaluated with the replacements
+*/
+NamedFunc NamedFunc::Rebind(const Bindings &bindings) const{
+  if(!rebinder_) return *this;
+  for(const auto &binding: bindings){
+    if(rebinder_->variables_.count(binding.first)) return rebinder_->rebuild_(bindings);
+  }
+  return *this;
+}
+
 /*!\brief Evaluate scalar function with b as argument
 
   \param[in] b Baby to pass to scalar function
@@ -478,12 +633,15 @@ VectorType NamedFunc::GetVector(const Baby &b) const{
   \return Reference to *this
 */
 NamedFunc & NamedFunc::operator += (const NamedFunc &func){
+  const NamedFunc f(*this), g(func);
   name_ = "("+name_ + ")+(" + func.name_ + ")";
   auto fp = ApplyOp(scalar_func_, vector_func_,
                     func.scalar_func_, func.vector_func_,
                     plus<ScalarType>());
   scalar_func_ = fp.first;
   vector_func_ = fp.second;
+  conjunction_.reset();
+  RecordOperands(f, g, static_cast<BinaryOp>(::operator+));
   return *this;
 }
 
@@ -494,12 +652,15 @@ NamedFunc & NamedFunc::operator += (const NamedFunc &func){
   \return Reference to *this
 */
 NamedFunc & NamedFunc::operator -= (const NamedFunc &func){
+  const NamedFunc f(*this), g(func);
   name_ = "("+name_ + ")-(" + func.name_ + ")";
   auto fp = ApplyOp(scalar_func_, vector_func_,
                     func.scalar_func_, func.vector_func_,
                     minus<ScalarType>());
   scalar_func_ = fp.first;
   vector_func_ = fp.second;
+  conjunction_.reset();
+  RecordOperands(f, g, static_cast<BinaryOp>(::operator-));
   return *this;
 }
 
@@ -510,12 +671,15 @@ NamedFunc & NamedFunc::operator -= (const NamedFunc &func){
   \return Reference to *this
 */
 NamedFunc & NamedFunc::operator *= (const NamedFunc &func){
+  const NamedFunc f(*this), g(func);
   name_ = "("+name_ + ")*(" + func.name_ + ")";
   auto fp = ApplyOp(scalar_func_, vector_func_,
                     func.scalar_func_, func.vector_func_,
                     multiplies<ScalarType>());
   scalar_func_ = fp.first;
   vector_func_ = fp.second;
+  conjunction_.reset();
+  RecordOperands(f, g, static_cast<BinaryOp>(::operator*));
   return *this;
 }
 
@@ -526,12 +690,15 @@ NamedFunc & NamedFunc::operator *= (const NamedFunc &func){
   \return Reference to *this
 */
 NamedFunc & NamedFunc::operator /= (const NamedFunc &func){
+  const NamedFunc f(*this), g(func);
   name_ = "("+name_ + ")/(" + func.name_ + ")";
   auto fp = ApplyOp(scalar_func_, vector_func_,
                     func.scalar_func_, func.vector_func_,
                     divides<ScalarType>());
   scalar_func_ = fp.first;
   vector_func_ = fp.second;
+  conjunction_.reset();
+  RecordOperands(f, g, static_cast<BinaryOp>(::operator/));
   return *this;
 }
 
@@ -542,12 +709,15 @@ NamedFunc & NamedFunc::operator /= (const NamedFunc &func){
   \return Reference to *this
 */
 NamedFunc & NamedFunc::operator %= (const NamedFunc &func){
+  const NamedFunc f(*this), g(func);
   name_ = "("+name_ + ")%(" + func.name_ + ")";
   auto fp = ApplyOp(scalar_func_, vector_func_,
                     func.scalar_func_, func.vector_func_,
                     static_cast<ScalarType (*)(ScalarType ,ScalarType)>(fmod));
   scalar_func_ = fp.first;
   vector_func_ = fp.second;
+  conjunction_.reset();
+  RecordOperands(f, g, static_cast<BinaryOp>(::operator%));
   return *this;
 }
 
@@ -558,9 +728,25 @@ NamedFunc NamedFunc::operator [] (const NamedFunc &func) const{
   if(func.IsVector()) ERROR("Cannot use vector "+func.Name()+" as index");
   const auto &vec = VectorFunction();
   const auto &index = func.ScalarFunction();
-  return NamedFunc("("+Name()+")["+func.Name()+"]", [vec, index](const Baby &b){
+  NamedFunc result("("+Name()+")["+func.Name()+"]", [vec, index](const Baby &b){
       return vec(b).at(index(b));
     });
+  result.RecordOperands(*this, func, [](NamedFunc v, NamedFunc i){return v[i];});
+  return result;
+}
+
+/*!\brief Get the chain of "&&" operands of f, or a single-operand node for f
+  if it is not such a chain
+
+  \param[in] f Function whose operands are wanted
+
+  \return Node shared with f if f is a chain; a new single-operand node otherwise
+*/
+shared_ptr<const NamedFunc::Conjunction> NamedFunc::Conjunction::Of(const NamedFunc &f){
+  if(f.conjunction_) return f.conjunction_;
+  auto node = make_shared<Conjunction>();
+  node->operand_.push_back(f);
+  return node;
 }
 
 /*!\brief Strip spaces from name
@@ -569,6 +755,54 @@ void NamedFunc::CleanName(){
   ReplaceAll(name_, " ", "");
 }
 
+/*!\brief Record that *this was built by applying op to f
+
+  *this inherits whether its name defines it from f.
+
+  \param[in] f Operand
+
+  \param[in] op Operator producing a new function from the rebound operand
+*/
+void NamedFunc::RecordOperand(const NamedFunc &f, UnaryOp op){
+  name_defines_function_ = f.name_defines_function_;
+  if(!f.rebinder_){
+    rebinder_.reset();
+    return;
+  }
+  auto rebinder = make_shared<Rebinder>();
+  rebinder->variables_ = f.rebinder_->variables_;
+  rebinder->rebuild_ = [f, op](const Bindings &bindings){
+    return op(f.Rebind(bindings));
+  };
+  rebinder_ = rebinder;
+}
+
+/*!\brief Record that *this was built by applying op to f and g
+
+  The name of *this defines it if the names of both f and g do.
+
+  \param[in] f Left hand operand
+
+  \param[in] g Right hand operand
+
+  \param[in] op Operator producing a new function from the rebound operands
+*/
+void NamedFunc::RecordOperands(const NamedFunc &f, const NamedFunc &g, BinaryOp op){
+  name_defines_function_ = f.name_defines_function_ && g.name_defines_function_;
+  if(!f.rebinder_ && !g.rebinder_){
+    rebinder_.reset();
+    return;
+  }
+  auto rebinder = make_shared<Rebinder>();
+  if(f.rebinder_) rebinder->variables_ = f.rebinder_->variables_;
+  if(g.rebinder_) rebinder->variables_.insert(g.rebinder_->variables_.cbegin(),
+                                              g.rebinder_->variables_.cend());
+  rebinder->rebuild_ = [f, g, op](const Bindings &bindings){
+    return op(f.Rebind(bindings), g.Rebind(bindings));
+  };
+  rebinder_ = rebinder;
+}
+
 /*!\brief Add two \link NamedFunc NamedFuncs\endlink
 
   \param[in] f Augend
@@ -648,9 +882,11 @@ NamedFunc operator + (NamedFunc f){
   \return NamedFunc returing the negative of the result of f
 */
 NamedFunc operator - (NamedFunc f){
+  const NamedFunc operand(f);
   f.Name("-(" + f.Name() + ")");
   f.Function(ApplyOp(f.ScalarFunction(), negate<ScalarType>()));
   f.Function(ApplyOp(f.VectorFunction(), negate<ScalarType>()));
+  f.RecordOperand(operand, static_cast<NamedFunc::UnaryOp>(::operator-));
   return f;
 }
 
@@ -663,12 +899,14 @@ NamedFunc operator - (NamedFunc f){
   \return NamedFunc returning whether the results of f and g are equal
 */
 NamedFunc operator == (NamedFunc f, NamedFunc g){
+  const NamedFunc lhs(f);
   f.Name("(" + f.Name() + ")==(" + g.Name() + ")");
   auto fp = ApplyOp(f.ScalarFunction(), f.VectorFunction(),
                     g.ScalarFunction(), g.VectorFunction(),
                     equal_to<ScalarType>());
   f.Function(fp.first);
   f.Function(fp.second);
+  f.RecordOperands(lhs, g, static_cast<NamedFunc::BinaryOp>(::operator==));
   return f;
 }
 
@@ -681,12 +919,14 @@ NamedFunc operator == (NamedFunc f, NamedFunc g){
   \return NamedFunc returning whether the results of f and g are not equal
 */
 NamedFunc operator != (NamedFunc f, NamedFunc g){
+  const NamedFunc lhs(f);
   f.Name("(" + f.Name() + ")!=(" + g.Name() + ")");
   auto fp = ApplyOp(f.ScalarFunction(), f.VectorFunction(),
                     g.ScalarFunction(), g.VectorFunction(),
                     not_equal_to<ScalarType>());
   f.Function(fp.first);
   f.Function(fp.second);
+  f.RecordOperands(lhs, g, static_cast<NamedFunc::BinaryOp>(::operator!=));
   return f;
 }
 
@@ -700,12 +940,14 @@ NamedFunc operator != (NamedFunc f, NamedFunc g){
   g
 */
 NamedFunc operator > (NamedFunc f, NamedFunc g){
+  const NamedFunc lhs(f);
   f.Name("(" + f.Name() + ")>(" + g.Name() + ")");
   auto fp = ApplyOp(f.ScalarFunction(), f.VectorFunction(),
                     g.ScalarFunction(), g.VectorFunction(),
                     greater<ScalarType>());
   f.Function(fp.first);
   f.Function(fp.second);
+  f.RecordOperands(lhs, g, static_cast<NamedFunc::BinaryOp>(::operator>));
   return f;
 }
 
@@ -718,12 +960,14 @@ NamedFunc operator > (NamedFunc f, NamedFunc g){
   \return NamedFunc returning whether the results of f is less than result of g
 */
 NamedFunc operator < (NamedFunc f, NamedFunc g){
+  const NamedFunc lhs(f);
   f.Name("(" + f.Name() + ")<(" + g.Name() + ")");
   auto fp = ApplyOp(f.ScalarFunction(), f.VectorFunction(),
                     g.ScalarFunction(), g.VectorFunction(),
                     less<ScalarType>());
   f.Function(fp.first);
   f.Function(fp.second);
+  f.RecordOperands(lhs, g, static_cast<NamedFunc::BinaryOp>(::operator<));
   return f;
 }
 
@@ -738,12 +982,14 @@ NamedFunc operator < (NamedFunc f, NamedFunc g){
   to result of g
 */
 NamedFunc operator >= (NamedFunc f, NamedFunc g){
+  const NamedFunc lhs(f);
   f.Name("(" + f.Name() + ")>=(" + g.Name() + ")");
   auto fp = ApplyOp(f.ScalarFunction(), f.VectorFunction(),
                     g.ScalarFunction(), g.VectorFunction(),
                     greater_equal<ScalarType>());
   f.Function(fp.first);
   f.Function(fp.second);
+  f.RecordOperands(lhs, g, static_cast<NamedFunc::BinaryOp>(::operator>=));
   return f;
 }
 
@@ -758,12 +1004,14 @@ NamedFunc operator >= (NamedFunc f, NamedFunc g){
   result of g
 */
 NamedFunc operator <= (NamedFunc f, NamedFunc g){
+  const NamedFunc lhs(f);
   f.Name("(" + f.Name() + ")<=(" + g.Name() + ")");
   auto fp = ApplyOp(f.ScalarFunction(), f.VectorFunction(),
                     g.ScalarFunction(), g.VectorFunction(),
                     less_equal<ScalarType>());
   f.Function(fp.first);
   f.Function(fp.second);
+  f.RecordOperands(lhs, g, static_cast<NamedFunc::BinaryOp>(::operator<=));
   return f;
 }
 
@@ -776,12 +1024,21 @@ NamedFunc operator <= (NamedFunc f, NamedFunc g){
   \return NamedFunc returning whether the results of both f and g are true
 */
 NamedFunc operator && (NamedFunc f, NamedFunc g){
+  const NamedFunc lhs(f);
+  shared_ptr<NamedFunc::Conjunction> conjunction;
+  if(f.IsScalar() && g.IsScalar()){
+    conjunction = make_shared<NamedFunc::Conjunction>();
+    conjunction->first_ = NamedFunc::Conjunction::Of(f);
+    conjunction->second_ = NamedFunc::Conjunction::Of(g);
+  }
   f.Name("(" + f.Name() + ")&&(" + g.Name() + ")");
   auto fp = ApplyOp(f.ScalarFunction(), f.VectorFunction(),
                     g.ScalarFunction(), g.VectorFunction(),
                     logical_and<ScalarType>());
   f.Function(fp.first);
   f.Function(fp.second);
+  f.conjunction_ = conjunction;
+  f.RecordOperands(lhs, g, static_cast<NamedFunc::BinaryOp>(::operator&&));
   return f;
 }
 
@@ -794,12 +1051,14 @@ NamedFunc operator && (NamedFunc f, NamedFunc g){
   \return NamedFunc returning whether the results of f or g is true
 */
 NamedFunc operator || (NamedFunc f, NamedFunc g){
+  const NamedFunc lhs(f);
   f.Name("(" + f.Name() + ")||(" + g.Name() + ")");
   auto fp = ApplyOp(f.ScalarFunction(), f.VectorFunction(),
                     g.ScalarFunction(), g.VectorFunction(),
                     logical_or<ScalarType>());
   f.Function(fp.first);
   f.Function(fp.second);
+  f.RecordOperands(lhs, g, static_cast<NamedFunc::BinaryOp>(::operator||));
   return f;
 }
 
@@ -810,9 +1069,11 @@ NamedFunc operator || (NamedFunc f, NamedFunc g){
   \return NamedFunc returning logical inverse of result of f
 */
 NamedFunc operator ! (NamedFunc f){
+  const NamedFunc operand(f);
   f.Name("!(" + f.Name() + ")");
   f.Function(ApplyOp(f.ScalarFunction(), logical_not<ScalarType>()));
   f.Function(ApplyOp(f.VectorFunction(), logical_not<ScalarType>()));
+  f.RecordOperand(operand, static_cast<NamedFunc::UnaryOp>(::operator!));
   return f;
 }
 
@@ -7,11 +7,17 @@
   the next palette or the end of the file. Within each palette, colors are
   defined on separate lines using their RGB values as "color_name red green
   blue".
+
+  The first color requested from a file loads every palette in it. Later
+  Palette objects using the same file, whatever their palette, look their
+  colors up in memory, so editing the color file while a job runs does not
+  change the colors it draws.
 */
 #include "core/palette.hpp"
 
 #include <fstream>
 #include <sstream>
+#include <mutex>
 
 #include "TColor.h"
 
@@ -102,38 +108,13 @@ Palette & Palette::PaletteName(const string &file,
   \return Number of color as used by ROOT's TColor system
 */
 Int_t Palette::operator()(const string &color_name) const{
-  ifstream file(file_);
-  string line;
-  string current_palette_ = "";
-  int line_num = 0;
-  while(getline(file, line)){
-    ++line_num;
-    ReplaceAll(line, "=", " ");
-    ReplaceAll(line, "\t", " ");
-    auto start  = line.find('[');
-    auto end = line.find(']');
-    if(start==string::npos && end!=string::npos){
-      ERROR("Could not find opening brace in line "+to_string(line_num));
-    }
-    if(start!=string::npos && end==string::npos){
-      ERROR("Could not find closing brace in line "+to_string(line_num));
-    }
-    if(start<end && start != string::npos && end != string::npos){
-      current_palette_ = line.substr(start+1, end-start-1);
-    }else if(current_palette_ == palette_
-             && line.size()
-             && line.at(0)!='#'){
-      istringstream iss(line);
-      string color;
-      iss >> color;
-      if(color != color_name) continue;
-      Int_t r, g, b;
-      iss >> r >> g >> b;
-      return RGB(r, g, b);
-    }
+  const ColorMap &colors = Colors(file_, palette_);
+  auto color = colors.find(color_name);
+  if(color == colors.end()){
+    DBG("No color " << color_name << " in palette " << palette_ << " in file " << file_);
+    return 0;
   }
-  DBG("No color " << color_name << " in palette " << palette_ << " in file " << file_);
-  return 0;
+  return RGB(color->second.at(0), color->second.at(1), color->second.at(2));
 }
 
 /*!\brief Gets the ROOT color number corresponding to a given RGB color
@@ -211,3 +192,62 @@ Int_t Palette::HLS(Float_t h, Float_t l, Float_t s){
   TColor::HLS2RGB(h, l, s, r, g, b);
   return RGB(r, g, b);
 }
+
+/*!\brief Colors of a palette, reading the file if it is not loaded yet.
+  Thread-safe.
+
+  \return Colors of the palette, empty if the file or palette does not exist
+*/
+const Palette::ColorMap & Palette::Colors(const string &file,
+                                          const string &palette){
+  static mutex registry_mutex;
+  static unordered_map<string, unordered_map<string, ColorMap> > registry;
+  static const ColorMap no_colors;
+
+  // Callers read the returned map after the lock is released. A file's palettes are
+  // inserted once and never modified, so the map cannot change under them.
+  lock_guard<mutex> lock(registry_mutex);
+  auto loaded = registry.find(file);
+  if(loaded == registry.end()) loaded = registry.emplace(file, ReadFile(file)).first;
+  auto colors = loaded->second.find(palette);
+  return colors == loaded->second.end() ? no_colors : colors->second;
+}
+
+/*!\brief Parses every palette in a color file
+
+  If a color is defined more than once in a palette, the first definition is
+  used.
+
+  \return Colors of each palette, keyed by palette name
+*/
+unordered_map<string, Palette::ColorMap> Palette::ReadFile(const string &file_name){
+  unordered_map<string, ColorMap> palettes;
+  ifstream file(file_name);
+  string line;
+  string current_palette = "";
+  int line_num = 0;
+  while(getline(file, line)){
+    ++line_num;
+    ReplaceAll(line, "=", " ");
+    ReplaceAll(line, "\t", " ");
+    auto start  = line.find('[');
+    auto end = line.find(']');
+    if(start==string::npos && end!=string::npos){
+      ERROR("Could not find opening brace in line "+to_string(line_num));
+    }
+    if(start!=string::npos && end==string::npos){
+      ERROR("Could not find closing brace in line "+to_string(line_num));
+    }
+    if(start<end && start != string::npos && end != string::npos){
+      current_palette = line.substr(start+1, end-start-1);
+    }else if(line.size()
+             && line.at(0)!='#'){
+      istringstream iss(line);
+      string color;
+      Int_t r, g, b;
+      if(!(iss >> color >> r >> g >> b)) continue;
+      palettes[current_palette].emplace(color, array<Int_t, 3>{{r, g, b}});
+    }
+  }
+  return palettes;
+}
@@ -0,0 +1,83 @@
+#include <cstdlib>
+#include <cstdio>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <getopt.h>
+
+#include "core/plot_server.hpp"
+
+using namespace std;
+
+namespace{
+  string socket_path = PlotServer::DefaultSocket();
+  bool stop_server = false;
+}
+
+void GetOptions(int argc, char *argv[]);
+
+int main(int argc, char *argv[]){
+  GetOptions(argc, argv);
+
+  // Requests are read from the files given after the options, or from stdin
+  ostringstream request;
+  if(optind < argc){
+    for(int iarg = optind; iarg < argc; ++iarg){
+      ifstream file(argv[iarg]);
+      if(!file){
+        printf("Could not open %s\n", argv[iarg]);
+        exit(1);
+      }
+      request << file.rdbuf() << '\n';
+    }
+  }else if(!stop_server){
+    request << cin.rdbuf();
+  }
+  if(stop_server) request << "stop\n";
+
+  string answer;
+  try{
+    answer = PlotServer::Submit(socket_path, request.str());
+  }catch(const exception &e){
+    printf("%s\n", e.what());
+    exit(1);
+  }
+  cout << answer << flush;
+  if(answer.compare(0, 2, "ok") != 0) exit(1);
+}
+
+void GetOptions(int argc, char *argv[]){
+  while(true){
+    static struct option long_options[] = {
+      {"socket", required_argument, 0, 's'}, // Unix socket of the server
+      {"stop", no_argument, 0, 0},           // Shut down the server after the request
+      {0, 0, 0, 0}
+    };
+
+    char opt = -1;
+    int option_index;
+    opt = getopt_long(argc, argv, "s:", long_options, &option_index);
+    if(opt == -1) break;
+
+    string optname;
+    switch(opt){
+    case 's':
+      socket_path = optarg;
+      break;
+    case 0:
+      optname = long_options[option_index].name;
+      if(optname == "stop"){
+        stop_server = true;
+      }else{
+        printf("Bad option! Found option name %s\n", optname.c_str());
+      }
+      break;
+    default:
+      printf("Bad option! getopt_long returned character code 0%o\n", opt);
+      break;
+    }
+  }
+}
@@ -8,20 +8,52 @@
   PlotMaker::MakePlots() determines the full set of \link Process
   Processes\endlink used by all plots, loops once over each Process to fill all
   histograms using that Process, and then prints the plots.
+
+  A heavy executable can be spread over several machines without changes to
+  its code. With PLOTMAKER_SHARD=k/n, each MakePlots() call fills the figures
+  from shard k (counting from 0) of the babies only, and writes the
+  accumulators to PLOTMAKER_SHARD_DIR (default "shards") instead of printing.
+  Running the same executable with the same arguments and
+  PLOTMAKER_MERGE=<shard directory> then skips the event loop, adds up the
+  results of all n shards, and prints the figures as usual. The shards a
+  baby goes to depend only on its files, so every shard and the merge step
+  agree without coordinating.
 */
 #include "core/plot_maker.hpp"
 
+#include <cstdlib>
+#include <cstdio>
+#include <cstdint>
+#include <cerrno>
+
 #include <functional>
+#include <algorithm>
+#include <tuple>
 #include <mutex>
 #include <chrono>
 #include <map>
 #include <iomanip>  // setw
+#include <sstream>
+#include <fstream>
+#include <typeinfo>
+
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 #include "TLegend.h"
+#include "TChain.h"
+#include "TFile.h"
+#include "TBranch.h"
+#include "TObjArray.h"
 
 #include "core/utilities.hpp"
-#include "core/timer.hpp"
+#include "core/progress.hpp"
+#include "core/plot_metrics.hpp"
+#include "core/staging_cache.hpp"
+#include "core/serialization.hpp"
 #include "core/thread_pool.hpp"
+#include "core/cpu_placement.hpp"
 #include "core/named_func.hpp"
 #include "core/process.hpp"
 
@@ -36,7 +68,107 @@ using VectorFunc = NamedFunc::VectorFunc;
 using Clock = chrono::steady_clock;
 
 namespace{
-  mutex print_mutex;
+  // The chain closes each file when it moves on to the next, so this must be
+  // called for each file while it is still the current one
+  void AddFileBytes(const TChain &chain, long &bytes_read, long &bytes_unzipped){
+    TFile *file = chain.GetCurrentFile();
+    if(file != nullptr) bytes_read += file->GetBytesRead();
+    TTree *tree = chain.GetTree();
+    if(tree == nullptr) return;
+    TObjArray *branches = tree->GetListOfBranches();
+    for(int ibranch = 0; ibranch < branches->GetEntriesFast(); ++ibranch){
+      TBranch *branch = static_cast<TBranch*>(branches->UncheckedAt(ibranch));
+      if(branch->GetReadEntry() >= 0) bytes_unzipped += branch->GetTotBytes();
+    }
+  }
+
+  const uint64_t worker_magic = UINT64_C(0x706c6f746d6b7231);//!<Marks the start and end of a worker's results
+  const uint64_t shard_magic = UINT64_C(0x706c6f7473686431);//!<Marks the start of a shard results file
+
+  size_t num_passes = 0;//!<MakePlots() calls so far, used to match shard results to calls
+
+  // Positive count set in an environment variable, or 0 to keep the default if the variable is
+  // unset, empty, not a number or not positive
+  size_t CountFromEnv(const char *variable){
+    const char *value = getenv(variable);
+    if(value == nullptr || string(value) == "") return 0;
+    char *end = nullptr;
+    errno = 0;
+    long count = strtol(value, &end, 10);
+    if(errno != 0 || end == value || *end != '\0' || count <= 0){
+      DBG("Ignoring " << variable << "=" << value << ", which is not a positive integer. Using the default.");
+      return 0;
+    }
+    return count;
+  }
+
+  void WriteRecord(ostream &out, const PlotMetrics::BabyRecord &record){
+    using namespace Serialization;
+    WriteString(out, record.tag);
+    Write(out, record.entries);
+    Write(out, record.wall_seconds);
+    Write(out, record.cpu_seconds);
+    Write(out, record.lock_seconds);
+    Write(out, record.bytes_read);
+    Write(out, record.bytes_unzipped);
+    Write<uint64_t>(out, record.figures);
+    Write<uint64_t>(out, record.passed.size());
+    for(const auto &passed: record.passed){
+      WriteString(out, passed.first);
+      Write(out, passed.second);
+    }
+  }
+
+  PlotMetrics::BabyRecord ReadRecord(istream &in){
+    using namespace Serialization;
+    PlotMetrics::BabyRecord record;
+    record.tag = ReadString(in);
+    record.thread = 0;
+    record.entries = Read<long>(in);
+    record.wall_seconds = Read<double>(in);
+    record.cpu_seconds = Read<double>(in);
+    record.lock_seconds = Read<double>(in);
+    record.bytes_read = Read<long>(in);
+    record.bytes_unzipped = Read<long>(in);
+    record.figures = Read<uint64_t>(in);
+    uint64_t num_passed = Read<uint64_t>(in);
+    for(uint64_t i = 0; i < num_passed; ++i){
+      string name = ReadString(in);
+      record.passed.emplace_back(name, Read<long>(in));
+    }
+    return record;
+  }
+
+  void WriteAll(int fd, const string &data){
+    size_t done = 0;
+    while(done < data.size()){
+      ssize_t written = write(fd, data.data()+done, data.size()-done);
+      if(written < 0 && errno == EINTR) continue;
+      if(written <= 0) ERROR("Could not write worker results");
+      done += written;
+    }
+  }
+
+  string ReadAll(int fd){
+    string data;
+    char buffer[1 << 16];
+    while(true){
+      ssize_t num_read = read(fd, buffer, sizeof(buffer));
+      if(num_read < 0 && errno == EINTR) continue;
+      if(num_read <= 0) break;
+      data.append(buffer, num_read);
+    }
+    return data;
+  }
+
+  int64_t TotalFileSize(const Baby &baby){
+    int64_t size = 0;
+    for(const auto &file: baby.FileNames()){
+      struct stat info;
+      if(stat(file.c_str(), &info) == 0) size += info.st_size;
+    }
+    return size;
+  }
 }
 
 /*!\brief Standard constructor
@@ -44,7 +176,35 @@ namespace{
 PlotMaker::PlotMaker():
   multithreaded_(true),
   min_print_(false),
+  num_threads_(0),
+  num_processes_(0),
+  affinity_(CpuPlacement::Policy::none),
+  metrics_file_(),
+  shard_index_(0),
+  num_shards_(0),
+  shard_dir_("shards"),
+  merge_shards_(false),
   figures_(){
+  // Defaults for shared nodes can be set without recompiling
+  num_threads_ = CountFromEnv("PLOTMAKER_THREADS");
+  num_processes_ = CountFromEnv("PLOTMAKER_PROCESSES");
+  const char *affinity = getenv("PLOTMAKER_AFFINITY");
+  if(affinity != nullptr) affinity_ = CpuPlacement::ParsePolicy(affinity);
+  const char *metrics_file = getenv("PLOTMAKER_METRICS");
+  if(metrics_file != nullptr) metrics_file_ = metrics_file;
+  const char *shard = getenv("PLOTMAKER_SHARD");
+  if(shard != nullptr && string(shard) != ""){
+    if(sscanf(shard, "%zu/%zu", &shard_index_, &num_shards_) != 2 || shard_index_ >= num_shards_){
+      ERROR("PLOTMAKER_SHARD must be k/n with 0 <= k < n, not "+string(shard));
+    }
+  }
+  const char *shard_dir = getenv("PLOTMAKER_SHARD_DIR");
+  if(shard_dir != nullptr && string(shard_dir) != "") shard_dir_ = shard_dir;
+  const char *merge_dir = getenv("PLOTMAKER_MERGE");
+  if(merge_dir != nullptr && string(merge_dir) != ""){
+    shard_dir_ = merge_dir;
+    merge_shards_ = true;
+  }
 }
 
 /*!\brief Prints all added plots with given luminosity
@@ -53,10 +213,32 @@ PlotMaker::PlotMaker():
 */
 void PlotMaker::MakePlots(double luminosity,
                           const string &subdir){
-  GetYields();
+  size_t pass = num_passes++;
+  PlotMetrics metrics;
+  bool print = true;
+  if(merge_shards_){
+    MergeShards(pass, metrics);
+  }else if(num_shards_ > 1){
+    if(!Mergeable()) ERROR("Some figures cannot be merged, so they cannot be filled in shards");
+    auto shards = AssignBabies(GetBabies(), num_shards_);
+    set<Baby*> babies(shards.at(shard_index_).cbegin(), shards.at(shard_index_).cend());
+    GetYields(babies, metrics);
+    WriteShard(pass, babies, metrics);
+    print = false;
+  }else{
+    GetYields(GetBabies(), metrics);
+  }
 
-  for(auto &figure: figures_){
-    figure->Print(luminosity, subdir);
+  if(print){
+    for(auto &figure: figures_){
+      figure->Print(luminosity, subdir);
+    }
+  }
+  metrics.FinishPrint(print ? figures_.size() : 0);
+  if(metrics_file_ != ""){
+    string metrics_path = PlotMetrics::PassPath(metrics_file_, pass);
+    metrics.Write(metrics_path);
+    cout << "Wrote performance metrics to " << metrics_path << endl << endl;
   }
 }
 
@@ -70,45 +252,85 @@ void PlotMaker::Clear(){
   figures_.clear();
 }
 
-void PlotMaker::GetYields(){
+void PlotMaker::GetYields(const set<Baby*> &babies, PlotMetrics &metrics){
   auto start_time = Clock::now();
 
-  auto babies = GetBabies();
-  size_t num_threads = multithreaded_ ? min(babies.size(), static_cast<size_t>(thread::hardware_concurrency())) : 1;
-  cout << "Processing " << babies.size() << " babies with " << num_threads << " threads." << endl;
+  size_t max_threads = num_threads_ > 0 ? num_threads_ : CpuPlacement::AllowedCpus().size();
+  size_t num_threads = multithreaded_ ? min(babies.size(), max_threads) : 1;
+  size_t num_processes = min(babies.size(), num_processes_);
+  if(num_processes > 1 && !Mergeable()){
+    cout << "Some figures cannot be merged across processes. Using threads instead." << endl;
+    num_processes = 1;
+  }
+  if(num_processes > 1){
+    num_threads = 1;
+    cout << "Processing " << babies.size() << " babies with " << num_processes << " processes." << endl;
+  }else{
+    num_processes = 1;
+    cout << "Processing " << babies.size() << " babies with " << num_threads << " threads." << endl;
+  }
+  metrics.Start(num_threads, CpuPlacement::PolicyName(affinity_), num_processes);
+
+  // Copy files to local scratch ahead of the workers, if staging is enabled.
+  // Forked workers stage their own files, as the prefetch thread would not survive the fork.
+  if(num_processes == 1 && StagingCache::Get().Enabled()){
+    vector<string> files;
+    for(const auto &baby: babies){
+      files.insert(files.end(), baby->FileNames().cbegin(), baby->FileNames().cend());
+    }
+    StagingCache::Get().Prefetch(files);
+  }
 
   long num_entries = 0;
 
-  if(multithreaded_ && num_threads>1){
+  // One status line for the whole pass instead of one per baby
+  unique_ptr<Progress> progress;
+  if(!min_print_ && num_processes == 1) progress.reset(new Progress(babies.size()));
+
+  if(num_processes > 1){
+    num_entries = GetYieldsForked(babies, num_processes, metrics);
+  }else if(multithreaded_ && num_threads>1){
     vector<future<long> > num_entries_future(babies.size());
 
-    ThreadPool tp(num_threads);
-    size_t Nbabies = 0;
-    for(const auto &baby: babies){
-      num_entries_future.at(Nbabies) = tp.Push(bind(&PlotMaker::GetYield, this, ref(baby)));
-      ++Nbabies;
-    }
-    size_t Nfiles=0;
-    long printStep=Nbabies/20+1; // Print up to 20 lines of info
-    auto start_entries_time = Clock::now();
-    for(auto& entries: num_entries_future){
-      num_entries += entries.get();
-      Nfiles++;
-      if(min_print_ && ((Nfiles-1)%printStep==0 || Nfiles==Nbabies)){
-	double seconds = chrono::duration<double>(Clock::now()-start_entries_time).count();
-	cout<<"Done "<<setw(log10(Nbabies)+1)<<Nfiles<<"/"<<Nbabies<<" files: "<<setw(10)<<AddCommas(num_entries)
-	    <<" entries in "<<HoursMinSec(seconds)<<"  ->  "<<setw(5)<<RoundNumber(num_entries/1000.,1,seconds)
-	    <<" kHz "<<endl;
+    // Workers pin themselves before opening any file, so their buffers are allocated on their node
+    CpuPlacement placement(affinity_, num_threads);
+    {
+      ThreadPool tp(num_threads, [&placement](size_t iworker){placement.Pin(iworker);});
+      size_t Nbabies = 0;
+      for(const auto &baby: babies){
+        num_entries_future.at(Nbabies) = tp.Push(bind(&PlotMaker::GetYield, this, ref(baby), progress.get(), &metrics));
+        ++Nbabies;
       }
+      size_t Nfiles=0;
+      long printStep=Nbabies/20+1; // Print up to 20 lines of info
+      auto start_entries_time = Clock::now();
+      for(auto& entries: num_entries_future){
+        num_entries += entries.get();
+        Nfiles++;
+        if(min_print_ && ((Nfiles-1)%printStep==0 || Nfiles==Nbabies)){
+	  double seconds = chrono::duration<double>(Clock::now()-start_entries_time).count();
+	  cout<<"Done "<<setw(log10(Nbabies)+1)<<Nfiles<<"/"<<Nbabies<<" files: "<<setw(10)<<AddCommas(num_entries)
+	      <<" entries in "<<HoursMinSec(seconds)<<"  ->  "<<setw(5)<<RoundNumber(num_entries/1000.,1,seconds)
+	      <<" kHz "<<endl;
+        }
+      }
+    } // Joins the workers, so each has recorded its placement
+    if(affinity_ != CpuPlacement::Policy::none){
+      if(progress) progress->Log(placement.Report());
+      else cout << placement.Report() << endl;
     }
   }else{
     for(const auto &baby: babies){
-      num_entries += GetYield(ref(baby));
+      num_entries += GetYield(ref(baby), progress.get(), &metrics);
     }
   }
+  if(progress) progress->Stop();
+  metrics.FinishYields();
   auto end_time = Clock::now();
   double num_seconds = chrono::duration<double>(end_time-start_time).count();
-  if(!min_print_) cout << endl << num_threads << " threads processed "
+  if(!min_print_) cout << endl
+                       << (num_processes > 1 ? num_processes : num_threads)
+                       << (num_processes > 1 ? " processes" : " threads") << " processed "
 		       << babies.size() << " babies with "
 		       << AddCommas(num_entries) << " events in "
 		       << num_seconds << " seconds = "
@@ -117,8 +339,346 @@ void PlotMaker::GetYields(){
   cout << endl;
 }
 
-long PlotMaker::GetYield(Baby *baby_ptr){
+/*!\brief Fills all figures using forked worker processes instead of threads
+
+  Each worker gets its own copy of the figures and babies at the fork, loops
+  over its share of the babies in a single thread, and sends back its
+  accumulators and metrics through a pipe. The parent adds them into its own
+  figures. Since workers share no ROOT state, they never contend for
+  Multithreading::root_mutex. Babies are split between workers by
+  AssignBabies().
+
+  \return Total number of entries processed
+*/
+long PlotMaker::GetYieldsForked(const set<Baby*> &babies,
+                                size_t num_processes,
+                                PlotMetrics &metrics){
+  vector<vector<Baby*> > assigned = AssignBabies(babies, num_processes);
+
+  // Otherwise each worker would print the parent's pending output again
+  cout.flush();
+  clog.flush();
+  fflush(nullptr);
+
+  vector<pid_t> pids;
+  vector<int> fds;
+  for(size_t iproc = 0; iproc < num_processes; ++iproc){
+    int pipe_fds[2];
+    if(pipe(pipe_fds) != 0) ERROR("Could not create pipe for worker process");
+    pid_t pid = fork();
+    if(pid < 0) ERROR("Could not fork worker process");
+    if(pid == 0){
+      close(pipe_fds[0]);
+      for(int fd: fds) close(fd);
+      _exit(RunWorker(assigned.at(iproc), pipe_fds[1]));
+    }
+    close(pipe_fds[1]);
+    pids.push_back(pid);
+    fds.push_back(pipe_fds[0]);
+  }
+
+  // Workers only write once they are done, so reading them in turn loses no parallelism
+  long num_entries = 0;
+  string error;
+  for(size_t iproc = 0; iproc < num_processes; ++iproc){
+    string data = ReadAll(fds.at(iproc));
+    close(fds.at(iproc));
+    int status = 0;
+    waitpid(pids.at(iproc), &status, 0);
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != 0){
+      if(error == "") error = "Worker process "+to_string(iproc)+" failed";
+      continue;
+    }
+    if(error != "") continue;
+    istringstream in(data);
+    long worker_entries = ReadResults(in, "worker process "+to_string(iproc), iproc, metrics);
+    num_entries += worker_entries;
+    if(!min_print_){
+      cout << "Worker process " << iproc << " finished " << assigned.at(iproc).size()
+           << " babies with " << AddCommas(worker_entries) << " entries." << endl;
+    }
+  }
+  if(error != "") ERROR(error);
+  return num_entries;
+}
+
+/*!\brief Body of a forked worker: fills yields and writes results to a pipe
+
+  \return Exit status of the worker process
+*/
+int PlotMaker::RunWorker(const vector<Baby*> &babies, int fd){
+  try{
+    PlotMetrics worker_metrics;
+    for(const auto &baby: babies){
+      GetYield(baby, nullptr, &worker_metrics);
+    }
+
+    ostringstream out;
+    WriteResults(out, worker_metrics);
+    WriteAll(fd, out.str());
+    close(fd);
+    return 0;
+  }catch(const exception &e){
+    cerr << "Worker process failed: " << e.what() << endl;
+    return 1;
+  }
+}
+
+/*!\brief Writes the metrics and the accumulators of every figure component
+
+  Used both by forked workers and by shards. Each component is preceded by
+  its key from ComponentKeys(), so the reader matches components by figure
+  index and process rather than by address, which differs between
+  executables.
+*/
+void PlotMaker::WriteResults(ostream &out, const PlotMetrics &metrics) const{
+  Serialization::Write(out, worker_magic);
+  vector<PlotMetrics::BabyRecord> records = metrics.Babies();
+  Serialization::Write<uint64_t>(out, records.size());
+  for(const auto &record: records){
+    WriteRecord(out, record);
+  }
+  bool unique = true;
+  auto components = ComponentKeys(unique);
+  if(!unique) ERROR("Figure components cannot be told apart, so their results cannot be written");
+  Serialization::Write<uint64_t>(out, components.size());
+  for(const auto &component: components){
+    Serialization::WriteString(out, component.first);
+    component.second->Serialize(out);
+  }
+  Serialization::Write(out, worker_magic);
+}
+
+/*!\brief Adds the results written by WriteResults() to the figures and metrics
+
+  \param[in,out] in Stream positioned at the start of the results
+
+  \param[in] source Description of the writer, for error messages
+
+  \param[in] iworker Index under which the writer's babies are recorded
+
+  \param[in,out] metrics Metrics to which the writer's records are added
+
+  \return Number of entries processed by the writer
+*/
+long PlotMaker::ReadResults(istream &in, const string &source,
+                            size_t iworker, PlotMetrics &metrics){
+  if(Serialization::Read<uint64_t>(in) != worker_magic) ERROR("Corrupt results from "+source);
+  long num_entries = 0;
+  uint64_t num_records = Serialization::Read<uint64_t>(in);
+  for(uint64_t irecord = 0; irecord < num_records; ++irecord){
+    PlotMetrics::BabyRecord record = ReadRecord(in);
+    num_entries += record.entries;
+    metrics.Add(move(record), iworker);
+  }
+  bool unique = true;
+  auto components = ComponentKeys(unique);
+  if(!unique) ERROR("Figure components cannot be told apart, so results from "+source+" cannot be merged");
+  set<string> merged;
+  uint64_t num_written = Serialization::Read<uint64_t>(in);
+  for(uint64_t icomponent = 0; icomponent < num_written; ++icomponent){
+    string key = Serialization::ReadString(in);
+    auto component = components.find(key);
+    if(component == components.end()) ERROR("Results from "+source+" have unknown figure component "+key);
+    if(!merged.insert(key).second) ERROR("Results from "+source+" have figure component "+key+" twice");
+    component->second->Merge(in);
+  }
+  if(merged.size() != components.size()){
+    ERROR("Results from "+source+" have "+to_string(merged.size())
+          +" figure components, expected "+to_string(components.size()));
+  }
+  if(Serialization::Read<uint64_t>(in) != worker_magic) ERROR("Corrupt results from "+source);
+  return num_entries;
+}
+
+/*!\brief Whether every figure component can be filled in separate processes
+ */
+bool PlotMaker::Mergeable() const{
+  bool unique = true;
+  for(const auto &component: ComponentKeys(unique)){
+    if(!component.second->Mergeable()) return false;
+  }
+  return unique;
+}
+
+/*!\brief Figure components keyed by what identifies them in every executable
+
+  The key is the index of the figure and the name and cut of the process, so
+  it does not depend on where objects happen to be allocated.
+
+  \param[out] unique Set to false if two processes of a figure have the same
+  name and cut, in which case their components cannot be told apart
+
+  \return Components keyed by figure index, process name and cut
+*/
+map<string, Figure::FigureComponent*> PlotMaker::ComponentKeys(bool &unique) const{
+  map<string, Figure::FigureComponent*> components;
+  unique = true;
+  for(size_t ifig = 0; ifig < figures_.size(); ++ifig){
+    const auto &figure = figures_.at(ifig);
+    for(const auto &process: figure->GetProcesses()){
+      string key = "figure "+to_string(ifig)+": "+process->name_+" ["+process->cut_.Name()+"]";
+      if(!components.emplace(key, figure->GetComponent(process)).second) unique = false;
+    }
+  }
+  return components;
+}
+
+/*!\brief Writes the results of this shard for a MakePlots() call
+
+  The file lists the babies of the shard, so that MergeShards() can check
+  that every baby was filled exactly once. It is written under a temporary
+  name and renamed, so a shard killed while writing leaves no results behind.
+
+  \param[in] pass Index of the MakePlots() call in this process
+
+  \param[in] babies Babies filled by this shard
+
+  \param[in] metrics Records of the babies
+*/
+void PlotMaker::WriteShard(size_t pass, const set<Baby*> &babies,
+                           const PlotMetrics &metrics) const{
+  mkdir(shard_dir_.c_str(), 0755);
+  string path = ShardPath(pass);
+  string part = path+".part"+to_string(getpid());
+  {
+    ofstream out(part, ios::binary);
+    if(!out) ERROR("Could not open "+part);
+    Serialization::Write(out, shard_magic);
+    Serialization::Write<uint64_t>(out, num_shards_);
+    Serialization::Write<uint64_t>(out, shard_index_);
+    Serialization::Write<uint64_t>(out, babies.size());
+    for(const auto &baby: babies){
+      Serialization::WriteString(out, BabyKey(*baby));
+    }
+    WriteResults(out, metrics);
+    if(!out) ERROR("Could not write "+part);
+  }
+  if(rename(part.c_str(), path.c_str()) != 0) ERROR("Could not rename "+part+" to "+path);
+  cout << "Wrote shard " << shard_index_ << " of " << num_shards_ << " ("
+       << babies.size() << " babies) to " << path << endl << endl;
+}
+
+/*!\brief Fills the figures of a MakePlots() call from the results of all
+  shards
+
+  Fails unless shard_dir_ holds results for every shard of a single split,
+  and together they cover every baby used by the figures exactly once.
+
+  \param[in] pass Index of the MakePlots() call in this process
+
+  \param[in,out] metrics Metrics to which the shards' records are added
+
+  \return Total number of entries processed by the shards
+*/
+long PlotMaker::MergeShards(size_t pass, PlotMetrics &metrics){
+  auto start_time = Clock::now();
+  set<string> expected;
+  for(const auto &baby: GetBabies()){
+    expected.insert(BabyKey(*baby));
+  }
+
+  set<string> files = Glob(shard_dir_+"/pass"+to_string(pass)+"_shard*.bin");
+  if(files.empty()) ERROR("No shard results for MakePlots call "+to_string(pass)+" in "+shard_dir_);
+  metrics.Start(1, CpuPlacement::PolicyName(affinity_), files.size());
+
+  uint64_t num_shards = 0;
+  set<uint64_t> shards;
+  set<string> merged;
+  long num_entries = 0;
+  for(const auto &file: files){
+    ifstream in(file, ios::binary);
+    if(!in) ERROR("Could not open "+file);
+    if(Serialization::Read<uint64_t>(in) != shard_magic) ERROR(file+" is not a PlotMaker shard");
+    uint64_t file_shards = Serialization::Read<uint64_t>(in);
+    uint64_t ishard = Serialization::Read<uint64_t>(in);
+    if(num_shards == 0) num_shards = file_shards;
+    if(file_shards != num_shards){
+      ERROR(shard_dir_+" mixes results split into "+to_string(num_shards)+" and "
+            +to_string(file_shards)+" shards");
+    }
+    if(!shards.insert(ishard).second) ERROR("Shard "+to_string(ishard)+" found twice in "+shard_dir_);
+    uint64_t num_babies = Serialization::Read<uint64_t>(in);
+    for(uint64_t ibaby = 0; ibaby < num_babies; ++ibaby){
+      string key = Serialization::ReadString(in);
+      if(expected.find(key) == expected.end()) ERROR(file+" has a baby not used by these figures: "+key);
+      if(!merged.insert(key).second) ERROR("Baby in more than one shard: "+key);
+    }
+    num_entries += ReadResults(in, file, ishard, metrics);
+  }
+  if(shards.size() != num_shards){
+    ERROR("Found "+to_string(shards.size())+" of "+to_string(num_shards)+" shards in "+shard_dir_);
+  }
+  if(merged.size() != expected.size()){
+    ERROR(to_string(expected.size()-merged.size())+" babies are missing from the shards in "+shard_dir_);
+  }
+  metrics.FinishYields();
+
+  double num_seconds = chrono::duration<double>(Clock::now()-start_time).count();
+  cout << "Merged " << num_shards << " shards with " << merged.size() << " babies and "
+       << AddCommas(num_entries) << " events from " << shard_dir_ << " in "
+       << num_seconds << " seconds." << endl << endl;
+  return num_entries;
+}
+
+string PlotMaker::ShardPath(size_t pass) const{
+  return shard_dir_+"/pass"+to_string(pass)+"_shard"+to_string(shard_index_)
+    +"of"+to_string(num_shards_)+".bin";
+}
+
+/*!\brief Splits babies into parts with similar total file size
+
+  Babies are assigned largest first to the least loaded part, by total file
+  size, so no file needs to be opened. Ties are broken by BabyKey(), so the
+  result is the same in every process that sees the same files.
+
+  \param[in] babies Babies to split
+
+  \param[in] num_parts Number of parts
+
+  \return Babies of each part
+*/
+vector<vector<Baby*> > PlotMaker::AssignBabies(const set<Baby*> &babies,
+                                              size_t num_parts){
+  vector<tuple<int64_t, string, Baby*> > sizes;
+  for(const auto &baby: babies){
+    sizes.emplace_back(-TotalFileSize(*baby), BabyKey(*baby), baby);
+  }
+  sort(sizes.begin(), sizes.end());
+  vector<vector<Baby*> > assigned(num_parts);
+  vector<int64_t> load(num_parts, 0);
+  for(const auto &size: sizes){
+    size_t ipart = min_element(load.cbegin(), load.cend())-load.cbegin();
+    assigned.at(ipart).push_back(get<2>(size));
+    load.at(ipart) -= get<0>(size);
+  }
+  return assigned;
+}
+
+/*!\brief Identifies a baby the same way in every process
+
+  \return Baby type, files, and processes using the baby
+*/
+string PlotMaker::BabyKey(const Baby &baby){
+  string key = typeid(baby).name();
+  for(const auto &file: baby.FileNames()){
+    key += " "+file;
+  }
+  set<string> names;
+  for(const auto &process: baby.processes_){
+    names.insert(process->name_);
+  }
+  key += " |";
+  for(const auto &name: names){
+    key += " "+name;
+  }
+  return key;
+}
+
+long PlotMaker::GetYield(Baby *baby_ptr, Progress *progress, PlotMetrics *metrics){
   auto start_time = Clock::now();
+  double start_cpu = PlotMetrics::ThreadCpuSeconds();
+  double start_lock_wait = Multithreading::lock_wait_seconds;
   Baby &baby = *baby_ptr;
   auto activator = baby.Activate();
   string tag = "";
@@ -137,6 +697,7 @@ long PlotMaker::GetYield(Baby *baby_ptr){
   tag += oss.str();
 
   long num_entries = baby.GetEntries();
+  if(progress) progress->StartTask(num_entries);
 
   vector<pair<const Process*, set<Figure::FigureComponent*> > > proc_figs(baby.processes_.size());
   size_t iproc = 0;
@@ -146,31 +707,72 @@ long PlotMaker::GetYield(Baby *baby_ptr){
     ++iproc;
   }
 
-  Timer timer(tag, num_entries, 10.);
+  // First entry of each file after the first, where the chain closes the previous file
+  const TChain &chain = *baby.GetTree();
+  vector<long> file_starts;
+  for(int itree = 1; itree < chain.GetNtrees(); ++itree){
+    file_starts.push_back(chain.GetTreeOffset()[itree]);
+  }
+  size_t next_file = 0;
+  long bytes_read = 0, bytes_unzipped = 0;
+  vector<long> num_passed(proc_figs.size(), 0);
+
+  long unreported = 0;
   for(long entry = 0; entry < num_entries; ++entry){
-    if(!min_print_) timer.Iterate();
+    if(progress && ++unreported == Progress::batch_size_){
+      progress->AddEvents(unreported);
+      unreported = 0;
+    }
+    if(next_file < file_starts.size() && entry >= file_starts.at(next_file)){
+      AddFileBytes(chain, bytes_read, bytes_unzipped);
+      // Empty files start at the same entry as the file after them and are never opened
+      while(next_file < file_starts.size() && entry >= file_starts.at(next_file)) ++next_file;
+    }
     baby.GetEntry(entry);
 
-    for(const auto &proc_fig: proc_figs){
+    for(size_t ipf = 0; ipf < proc_figs.size(); ++ipf){
+      const auto &proc_fig = proc_figs[ipf];
       if(proc_fig.first->cut_.IsScalar()){
         if(!proc_fig.first->cut_.GetScalar(baby)) continue;
       }else{
         if(!HavePass(proc_fig.first->cut_.GetVector(baby))) continue;
       }
+      ++num_passed[ipf];
       for(const auto &component: proc_fig.second){
-	lock_guard<mutex> lock(component->mutex_);
+        auto lock = Multithreading::TimedLock(component->mutex_);
         component->RecordEvent(baby);
       }
     }
   }
+  AddFileBytes(chain, bytes_read, bytes_unzipped);
 
   auto end_time = Clock::now();
   double num_seconds = chrono::duration<double>(end_time - start_time).count();
-  {
-    lock_guard<mutex> lock(print_mutex);
-    if(!min_print_) cout << setw(9) << num_entries << " entries/"
-                         << setw(10) << num_seconds << " sec.="
-                         << setw(10) << 0.001*num_entries/num_seconds << " kHz for " << tag << endl;
+  if(metrics){
+    PlotMetrics::BabyRecord record;
+    record.tag = tag;
+    record.thread = 0;
+    record.entries = num_entries;
+    record.wall_seconds = num_seconds;
+    record.cpu_seconds = PlotMetrics::ThreadCpuSeconds()-start_cpu;
+    record.lock_seconds = Multithreading::lock_wait_seconds-start_lock_wait;
+    record.bytes_read = bytes_read;
+    record.bytes_unzipped = bytes_unzipped;
+    record.figures = 0;
+    for(size_t ipf = 0; ipf < proc_figs.size(); ++ipf){
+      record.figures += proc_figs.at(ipf).second.size();
+      record.passed.emplace_back(proc_figs.at(ipf).first->name_, num_passed.at(ipf));
+    }
+    metrics->Add(move(record));
+  }
+  if(progress){
+    progress->AddEvents(unreported);
+    progress->FinishTask();
+    ostringstream line;
+    line << setw(9) << num_entries << " entries/"
+         << setw(10) << num_seconds << " sec.="
+         << setw(10) << 0.001*num_entries/num_seconds << " kHz for " << tag;
+    progress->Log(line.str());
   }
   return num_entries;
 }
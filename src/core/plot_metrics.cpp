@@ -0,0 +1,265 @@
+/*! \class PlotMetrics
+
+  \brief Collects performance measurements of a PlotMaker pass and writes them
+  as JSON
+
+  PlotMaker::GetYield() adds one BabyRecord per Baby, from whichever thread
+  processed it. Records are grouped by thread to compute the fraction of the
+  yield-filling wall time each thread spent busy. Write() produces a single
+  JSON object with the run settings, totals, per-thread utilization and
+  per-Baby records, so throughput can be compared across code and ntuple
+  versions without parsing the printed output. Each pass is written to its own
+  file, named by PassPath(), so later passes do not overwrite earlier ones.
+*/
+
+#include "core/plot_metrics.hpp"
+
+#include <ctime>
+
+#include <algorithm>
+
+#include <fstream>
+#include <iomanip>
+#include <set>
+#include <sstream>
+
+#include <unistd.h>
+
+#include "core/utilities.hpp"
+
+using namespace std;
+
+namespace{
+  string Quote(const string &str){
+    ostringstream oss;
+    oss << '"';
+    for(char c: str){
+      switch(c){
+      case '"': oss << "\\\""; break;
+      case '\\': oss << "\\\\"; break;
+      case '\n': oss << "\\n"; break;
+      case '\t': oss << "\\t"; break;
+      default:
+        if(static_cast<unsigned char>(c) < 0x20){
+          oss << "\\u" << hex << setw(4) << setfill('0') << static_cast<int>(c) << dec << setfill(' ');
+        }else{
+          oss << c;
+        }
+      }
+    }
+    oss << '"';
+    return oss.str();
+  }
+
+  double Ratio(double num, double den){
+    return den > 0. ? num/den : 0.;
+  }
+}
+
+PlotMetrics::PlotMetrics():
+  num_threads_(0),
+  num_processes_(1),
+  affinity_(),
+  start_(Clock::now()),
+  yields_seconds_(0.),
+  print_seconds_(0.),
+  num_figures_(0),
+  babies_(),
+  thread_index_(),
+  mutex_(){
+}
+
+/*!\brief Starts the clock for a pass
+
+  \param[in] num_threads Number of worker threads
+
+  \param[in] affinity Name of the CPU placement policy
+
+  \param[in] num_processes Number of worker processes
+*/
+void PlotMetrics::Start(size_t num_threads, const string &affinity,
+                        size_t num_processes){
+  lock_guard<mutex> lock(mutex_);
+  num_threads_ = num_threads;
+  num_processes_ = num_processes;
+  affinity_ = affinity;
+  start_ = Clock::now();
+}
+
+/*!\brief Records a processed Baby. Thread-safe.
+
+  \param[in] record Measurements for the Baby. The thread field is filled here
+  from the calling thread.
+*/
+void PlotMetrics::Add(BabyRecord record){
+  lock_guard<mutex> lock(mutex_);
+  auto index = thread_index_.emplace(this_thread::get_id(), thread_index_.size());
+  record.thread = index.first->second;
+  babies_.push_back(move(record));
+}
+
+/*!\brief Records a Baby processed by a worker process
+
+  \param[in] record Measurements for the Baby
+
+  \param[in] worker Index of the worker process, used in place of the thread
+*/
+void PlotMetrics::Add(BabyRecord record, size_t worker){
+  lock_guard<mutex> lock(mutex_);
+  record.thread = worker;
+  babies_.push_back(move(record));
+}
+
+vector<PlotMetrics::BabyRecord> PlotMetrics::Babies() const{
+  lock_guard<mutex> lock(mutex_);
+  return babies_;
+}
+
+/*!\brief Marks the end of the loop over babies
+ */
+void PlotMetrics::FinishYields(){
+  lock_guard<mutex> lock(mutex_);
+  yields_seconds_ = chrono::duration<double>(Clock::now()-start_).count();
+}
+
+/*!\brief Marks the end of printing
+
+  \param[in] num_figures Number of figures printed
+*/
+void PlotMetrics::FinishPrint(size_t num_figures){
+  lock_guard<mutex> lock(mutex_);
+  print_seconds_ = chrono::duration<double>(Clock::now()-start_).count()-yields_seconds_;
+  num_figures_ = num_figures;
+}
+
+/*!\brief Writes all measurements to a JSON file
+
+  \param[in] path Output file name
+*/
+void PlotMetrics::Write(const string &path) const{
+  lock_guard<mutex> lock(mutex_);
+
+  struct Totals{
+    long entries = 0;
+    double wall_seconds = 0., cpu_seconds = 0., lock_seconds = 0.;
+    long bytes_read = 0, bytes_unzipped = 0;
+    size_t babies = 0;
+  };
+  Totals total;
+  size_t num_workers = 0;
+  for(const auto &baby: babies_) num_workers = max(num_workers, baby.thread+1);
+  vector<Totals> per_thread(num_workers);
+  for(const auto &baby: babies_){
+    for(Totals *t: {&total, &per_thread.at(baby.thread)}){
+      t->entries += baby.entries;
+      t->wall_seconds += baby.wall_seconds;
+      t->cpu_seconds += baby.cpu_seconds;
+      t->lock_seconds += baby.lock_seconds;
+      t->bytes_read += baby.bytes_read;
+      t->bytes_unzipped += baby.bytes_unzipped;
+      ++t->babies;
+    }
+  }
+
+  char host[256] = "";
+  gethostname(host, sizeof(host)-1);
+  time_t now = time(nullptr);
+  char date[64] = "";
+  strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+
+  ofstream out(path);
+  if(!out) ERROR("Could not open "+path+" for writing");
+  out << setprecision(6);
+  out << "{\n";
+  out << "  \"date\": " << Quote(date) << ",\n";
+  out << "  \"host\": " << Quote(host) << ",\n";
+  out << "  \"threads\": " << num_threads_ << ",\n";
+  out << "  \"processes\": " << num_processes_ << ",\n";
+  out << "  \"affinity\": " << Quote(affinity_) << ",\n";
+  out << "  \"figures\": " << num_figures_ << ",\n";
+  out << "  \"totals\": {\n";
+  out << "    \"babies\": " << total.babies << ",\n";
+  out << "    \"entries\": " << total.entries << ",\n";
+  out << "    \"yields_wall_seconds\": " << yields_seconds_ << ",\n";
+  out << "    \"print_wall_seconds\": " << print_seconds_ << ",\n";
+  out << "    \"cpu_seconds\": " << total.cpu_seconds << ",\n";
+  out << "    \"lock_seconds\": " << total.lock_seconds << ",\n";
+  out << "    \"bytes_read\": " << total.bytes_read << ",\n";
+  out << "    \"bytes_unzipped\": " << total.bytes_unzipped << ",\n";
+  out << "    \"khz\": " << Ratio(0.001*total.entries, yields_seconds_) << ",\n";
+  out << "    \"read_mb_per_second\": " << Ratio(1e-6*total.bytes_read, yields_seconds_) << "\n";
+  out << "  },\n";
+
+  out << "  \"threads_detail\": [";
+  for(size_t ithread = 0; ithread < per_thread.size(); ++ithread){
+    const Totals &t = per_thread.at(ithread);
+    out << (ithread == 0 ? "\n" : ",\n")
+        << "    {\"thread\": " << ithread
+        << ", \"babies\": " << t.babies
+        << ", \"entries\": " << t.entries
+        << ", \"busy_seconds\": " << t.wall_seconds
+        << ", \"cpu_seconds\": " << t.cpu_seconds
+        << ", \"lock_seconds\": " << t.lock_seconds
+        << ", \"utilization\": " << Ratio(t.wall_seconds, yields_seconds_)
+        << ", \"cpu_utilization\": " << Ratio(t.cpu_seconds, yields_seconds_) << "}";
+  }
+  out << "\n  ],\n";
+
+  out << "  \"babies\": [";
+  for(size_t ibaby = 0; ibaby < babies_.size(); ++ibaby){
+    const BabyRecord &baby = babies_.at(ibaby);
+    out << (ibaby == 0 ? "\n" : ",\n")
+        << "    {\"tag\": " << Quote(baby.tag)
+        << ", \"thread\": " << baby.thread
+        << ", \"entries\": " << baby.entries
+        << ", \"wall_seconds\": " << baby.wall_seconds
+        << ", \"cpu_seconds\": " << baby.cpu_seconds
+        << ", \"lock_seconds\": " << baby.lock_seconds
+        << ", \"bytes_read\": " << baby.bytes_read
+        << ", \"bytes_unzipped\": " << baby.bytes_unzipped
+        << ", \"figures\": " << baby.figures
+        << ", \"khz\": " << Ratio(0.001*baby.entries, baby.wall_seconds)
+        << ", \"passed\": {";
+    // Processes may share a name, so repeated names get a " (2)", " (3)", ... suffix to keep keys unique
+    set<string> keys;
+    for(size_t iproc = 0; iproc < baby.passed.size(); ++iproc){
+      if(iproc != 0) out << ", ";
+      const string &name = baby.passed.at(iproc).first;
+      string key = name;
+      for(size_t copy = 2; !keys.insert(key).second; ++copy) key = name+" ("+to_string(copy)+")";
+      out << Quote(key) << ": " << baby.passed.at(iproc).second;
+    }
+    out << "}}";
+  }
+  out << "\n  ]\n";
+  out << "}\n";
+}
+
+/*!\brief CPU time used so far by the calling thread
+ */
+double PlotMetrics::ThreadCpuSeconds(){
+  timespec ts;
+  if(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) return 0.;
+  return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+/*!\brief File name for the metrics of a given pass
+
+  The first pass uses path unchanged. Later passes insert "_pass<N>" before the
+  extension, e.g. metrics.json, metrics_pass1.json, metrics_pass2.json.
+
+  \param[in] path Metrics file name requested by the user
+
+  \param[in] pass Index of the MakePlots() call in the process, starting at 0
+
+  \return File name to write the metrics of this pass to
+*/
+string PlotMetrics::PassPath(const string &path, size_t pass){
+  if(pass == 0) return path;
+  size_t slash = path.rfind('/');
+  size_t dot = path.rfind('.');
+  if(dot == string::npos || (slash != string::npos && dot < slash) || dot == slash+1){
+    dot = path.size();
+  }
+  return path.substr(0, dot)+"_pass"+to_string(pass)+path.substr(dot);
+}
@@ -4,6 +4,7 @@
 
 #include <algorithm>
 #include <fstream>
+#include <mutex>
 
 #include "core/utilities.hpp"
 
@@ -58,35 +59,22 @@ PlotOpt PlotOpt::operator()() const{
   return *this;
 }
 
+/*!\brief Applies the properties of a style in a configuration file
+
+  The properties of every style in file_name are kept after the first
+  PlotOpt loads from it, and each later PlotOpt copies them from memory. A
+  style edited in the file after that is not picked up.
+
+  \param[in] file_name Configuration file, usually "txt/plot_styles.txt"
+
+  \param[in] config_name Style within the file
+
+  \return Reference to *this
+*/
 PlotOpt & PlotOpt::LoadOptions(const string &file_name,
                                const string &config_name){
-  ifstream file(file_name);
-  string line;
-  string current_config = "";
-  int line_num = 0;
-  while(getline(file, line)){
-    ++line_num;
-    ReplaceAll(line, " ", "");
-    ReplaceAll(line, "\t", "");
-    auto start  = line.find('[');
-    auto end = line.find(']');
-    if(start==string::npos && end!=string::npos){
-      ERROR("Could not find opening brace in line "+to_string(line_num));
-    }
-    if(start!=string::npos && end==string::npos){
-      ERROR("Could not find closing brace in line "+to_string(line_num));
-    }
-    if(start<end && start != string::npos && end != string::npos){
-      current_config = line.substr(start+1, end-start-1);
-    }else if(current_config == config_name
-             && line.size()
-             && line.at(0)!='#'){
-      auto pos = line.find("=");
-      if(pos == string::npos) continue;
-      string prop_name = line.substr(0,pos);
-      string value = line.substr(pos+1);
-      SetProperty(prop_name, value);
-    }
+  for(const auto &property: Styles(file_name, config_name)){
+    SetProperty(property.first, property.second);
   }
   return *this;
 }
@@ -583,3 +571,57 @@ void PlotOpt::SetProperty(const string &property,
     DBG("Did not understand property name "<<property);
   }
 }
+
+/*!\brief Properties of a style, reading the file if it is not loaded yet.
+  Thread-safe.
+
+  \return Properties of the style, empty if the file or style does not exist
+*/
+const PlotOpt::Properties & PlotOpt::Styles(const string &file_name,
+                                            const string &config_name){
+  static mutex registry_mutex;
+  static unordered_map<string, unordered_map<string, Properties> > registry;
+  static const Properties no_properties;
+
+  // LoadOptions() iterates the returned properties without holding the lock, which is safe
+  // because the registry only gains files and ReadFile() output is never edited
+  lock_guard<mutex> lock(registry_mutex);
+  auto file = registry.find(file_name);
+  if(file == registry.end()) file = registry.emplace(file_name, ReadFile(file_name)).first;
+  auto config = file->second.find(config_name);
+  return config == file->second.end() ? no_properties : config->second;
+}
+
+/*!\brief Parses every style in a configuration file
+
+  \return Properties of each style, keyed by style name
+*/
+unordered_map<string, PlotOpt::Properties> PlotOpt::ReadFile(const string &file_name){
+  unordered_map<string, Properties> configs;
+  ifstream file(file_name);
+  string line;
+  string current_config = "";
+  int line_num = 0;
+  while(getline(file, line)){
+    ++line_num;
+    ReplaceAll(line, " ", "");
+    ReplaceAll(line, "\t", "");
+    auto start  = line.find('[');
+    auto end = line.find(']');
+    if(start==string::npos && end!=string::npos){
+      ERROR("Could not find opening brace in line "+to_string(line_num));
+    }
+    if(start!=string::npos && end==string::npos){
+      ERROR("Could not find closing brace in line "+to_string(line_num));
+    }
+    if(start<end && start != string::npos && end != string::npos){
+      current_config = line.substr(start+1, end-start-1);
+    }else if(line.size()
+             && line.at(0)!='#'){
+      auto pos = line.find("=");
+      if(pos == string::npos) continue;
+      configs[current_config].emplace_back(line.substr(0,pos), line.substr(pos+1));
+    }
+  }
+  return configs;
+}
@@ -0,0 +1,367 @@
+/*! \class PlotServer
+
+  \brief Long-running process that fills and prints figures on request
+
+  Every executable pays for ROOT start-up, globbing the ntuples, and opening
+  and reading the same files before filling a single histogram. A PlotServer
+  does this once: it loads a set of processes from a text file, activates the
+  chains of all their babies, and then answers requests on a Unix socket. Each
+  request describes a batch of figures, which are filled in a single
+  PlotMaker pass over the already open babies and printed as usual. The
+  standard output of the pass, including the names of the files written, is
+  sent back to the client, so iterating on a plot does not restart anything.
+
+  The process file has one process per line, with fields separated by
+  semicolons:
+
+  name; type; color; cut; file pattern[; file pattern...]
+
+  The type is data, background or signal, and the color is either a name from
+  the default palette of txt/colors.txt or a ROOT color number. Use "1" as the
+  cut to select all events.
+
+  A request is text with one directive per line, fields also separated by
+  semicolons:
+
+  - lumi <luminosity>: luminosity with which figures are printed (default 1)
+  - subdir <name>: subdirectory of plots/ and tables/ for the output
+  - style <name>: style from txt/plot_styles.txt for following histograms
+  (default CMSPaper)
+  - processes <name>[; <name>...]: processes of following figures (default
+  all)
+  - weight <expression>: weight of following figures (default weight)
+  - hist <nbins>; <min>; <max>; <variable>; <title>; <cut>
+  - table <name>; <label>; <cut>[; <label>; <cut>...]
+  - stop: shut down the server after answering
+
+  The answer starts with "ok" or "error: <message>", followed by the output of
+  the pass. Table yields are also listed as "yield <table>; <row>; <process>;
+  <yield>; <uncertainty>" lines.
+
+  Requests are served one at a time, since a pass already uses every CPU
+  allowed to PlotMaker.
+*/
+
+#include "core/plot_server.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <set>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "core/baby_full.hpp"
+#include "core/process.hpp"
+#include "core/named_func.hpp"
+#include "core/plot_maker.hpp"
+#include "core/plot_opt.hpp"
+#include "core/palette.hpp"
+#include "core/axis.hpp"
+#include "core/hist1d.hpp"
+#include "core/table.hpp"
+#include "core/table_row.hpp"
+#include "core/utilities.hpp"
+
+using namespace std;
+
+namespace{
+  // Sends cout to a string for the lifetime of the object
+  class CaptureCout{
+  public:
+    explicit CaptureCout(ostringstream &out):
+      old_(cout.rdbuf(out.rdbuf())){
+    }
+    ~CaptureCout(){
+      cout.flush();
+      cout.rdbuf(old_);
+    }
+
+  private:
+    streambuf *old_;
+
+    CaptureCout(const CaptureCout &) = delete;
+    CaptureCout& operator=(const CaptureCout &) = delete;
+  };
+
+  vector<string> Fields(const string &text){
+    vector<string> fields;
+    for(const auto &field: Tokenize(text, ";")){
+      string stripped = Strip(field);
+      if(stripped != "") fields.push_back(stripped);
+    }
+    return fields;
+  }
+
+  sockaddr_un SocketAddress(const string &path){
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(path.size() >= sizeof(address.sun_path)) ERROR("Socket path too long: "+path);
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path)-1);
+    return address;
+  }
+
+  int Connect(const string &path){
+    sockaddr_un address = SocketAddress(path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) ERROR("Could not create socket");
+    if(connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0){
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  void SendAll(int fd, const string &data){
+    size_t done = 0;
+    while(done < data.size()){
+      // A client that went away must not kill the server with SIGPIPE
+      ssize_t sent = send(fd, data.data()+done, data.size()-done, MSG_NOSIGNAL);
+      if(sent < 0 && errno == EINTR) continue;
+      if(sent <= 0) return;
+      done += sent;
+    }
+  }
+
+  string ReceiveAll(int fd){
+    string data;
+    char buffer[1 << 16];
+    while(true){
+      ssize_t num_read = read(fd, buffer, sizeof(buffer));
+      if(num_read < 0 && errno == EINTR) continue;
+      if(num_read <= 0) break;
+      data.append(buffer, num_read);
+    }
+    return data;
+  }
+}
+
+/*!\brief Loads processes and opens all their babies
+
+  \param[in] socket_path Unix socket on which to accept requests
+
+  \param[in] process_file Text file defining the processes, as described above
+*/
+PlotServer::PlotServer(const string &socket_path,
+                       const string &process_file):
+  socket_path_(socket_path),
+  processes_(),
+  activators_(),
+  listen_fd_(-1){
+  LoadProcesses(process_file);
+
+  set<Baby*> babies;
+  for(const auto &process: processes_){
+    for(const auto &baby: process->Babies()){
+      babies.insert(baby);
+    }
+  }
+  long num_entries = 0;
+  for(const auto &baby: babies){
+    activators_.emplace_back(baby->Activate());
+    num_entries += baby->GetEntries();
+  }
+  cout << "Loaded " << processes_.size() << " processes with " << babies.size()
+       << " babies and " << AddCommas(num_entries) << " entries." << endl;
+}
+
+PlotServer::~PlotServer(){
+  if(listen_fd_ >= 0){
+    close(listen_fd_);
+    unlink(socket_path_.c_str());
+  }
+}
+
+/*!\brief Answers requests until one of them asks the server to stop
+ */
+void PlotServer::Run(){
+  int running = Connect(socket_path_);
+  if(running >= 0){
+    close(running);
+    ERROR("A server is already listening on "+socket_path_);
+  }
+  // Left behind by a server that did not shut down cleanly
+  unlink(socket_path_.c_str());
+
+  sockaddr_un address = SocketAddress(socket_path_);
+  listen_fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(listen_fd_ < 0) ERROR("Could not create socket");
+  if(bind(listen_fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+     || listen(listen_fd_, 16) != 0){
+    ERROR("Could not listen on "+socket_path_+": "+strerror(errno));
+  }
+  cout << "Listening on " << socket_path_ << endl;
+
+  bool stop = false;
+  while(!stop){
+    int fd = accept(listen_fd_, nullptr, nullptr);
+    if(fd < 0){
+      if(errno == EINTR) continue;
+      ERROR("Could not accept connection: "+string(strerror(errno)));
+    }
+    string request = ReceiveAll(fd);
+    cout << "Serving request of " << request.size() << " bytes" << endl;
+    SendAll(fd, HandleRequest(request, stop));
+    close(fd);
+  }
+  cout << "Stopped by request" << endl;
+}
+
+/*!\brief Sends a request to a running server and waits for the answer
+
+  \param[in] socket_path Unix socket of the server
+
+  \param[in] request Request text, as described above
+
+  \return Answer of the server
+*/
+string PlotServer::Submit(const string &socket_path,
+                          const string &request){
+  int fd = Connect(socket_path);
+  if(fd < 0) ERROR("No server listening on "+socket_path);
+  SendAll(fd, request);
+  shutdown(fd, SHUT_WR);
+  string answer = ReceiveAll(fd);
+  close(fd);
+  return answer;
+}
+
+/*!\brief Socket used when none is given
+
+  \return $RA4_DRAW_SERVER_SOCKET, or a per-user path in /tmp
+*/
+string PlotServer::DefaultSocket(){
+  const char *path = getenv("RA4_DRAW_SERVER_SOCKET");
+  if(path != nullptr && string(path) != "") return path;
+  return "/tmp/ra4_draw_plot_server_"+to_string(getuid())+".sock";
+}
+
+/*!\brief Fills and prints the figures of one request
+
+  \param[in] request Request text
+
+  \param[out] stop Set if the request asks the server to shut down
+
+  \return Answer to send to the client
+*/
+string PlotServer::HandleRequest(const string &request, bool &stop){
+  ostringstream output;
+  string error = "";
+  {
+    CaptureCout capture(output);
+    try{
+      PlotMaker pm;
+      // The server's babies are already in this process, so there is nothing to shard
+      pm.num_shards_ = 0;
+      pm.merge_shards_ = false;
+
+      double luminosity = 1.;
+      string subdir = "";
+      PlotOpt style("txt/plot_styles.txt", "CMSPaper");
+      NamedFunc weight = "weight";
+      vector<shared_ptr<Process> > procs = processes_;
+      vector<Table*> tables;
+
+      istringstream lines(request);
+      string line;
+      size_t iline = 0;
+      while(getline(lines, line)){
+        ++iline;
+        line = Strip(line);
+        if(line == "" || line.front() == '#') continue;
+        size_t split = line.find_first_of(" \t");
+        string directive = line.substr(0, split);
+        vector<string> fields = Fields(split == string::npos ? "" : line.substr(split));
+
+        if(directive == "lumi" && fields.size() == 1){
+          luminosity = stod(fields.at(0));
+        }else if(directive == "subdir" && fields.size() == 1){
+          subdir = fields.at(0);
+        }else if(directive == "style" && fields.size() == 1){
+          style = PlotOpt("txt/plot_styles.txt", fields.at(0));
+        }else if(directive == "weight" && fields.size() == 1){
+          weight = fields.at(0);
+        }else if(directive == "processes" && fields.size() >= 1){
+          procs.clear();
+          for(const auto &name: fields){
+            auto proc = find_if(processes_.cbegin(), processes_.cend(),
+                                [&name](const shared_ptr<Process> &p){return p->name_ == name;});
+            if(proc == processes_.cend()) ERROR("Unknown process "+name+" on line "+to_string(iline));
+            procs.push_back(*proc);
+          }
+        }else if(directive == "hist" && fields.size() == 6){
+          pm.Push<Hist1D>(Axis(stoul(fields.at(0)), stod(fields.at(1)), stod(fields.at(2)),
+                               fields.at(3), fields.at(4)),
+                          fields.at(5), procs, vector<PlotOpt>{style}).Weight(weight);
+        }else if(directive == "table" && fields.size() >= 3 && fields.size()%2 == 1){
+          vector<TableRow> rows;
+          for(size_t ifield = 1; ifield < fields.size(); ifield += 2){
+            rows.emplace_back(fields.at(ifield), fields.at(ifield+1), 0, 0, weight);
+          }
+          tables.push_back(&pm.Push<Table>(fields.at(0), rows, procs));
+        }else if(directive == "stop" && fields.empty()){
+          stop = true;
+        }else{
+          ERROR("Bad request on line "+to_string(iline)+": "+line);
+        }
+      }
+
+      if(!pm.Figures().empty()) pm.MakePlots(luminosity, subdir);
+
+      for(const auto &table: tables){
+        for(const auto &process: table->GetProcesses()){
+          double scale = process->type_ == Process::Type::data ? 1. : luminosity;
+          vector<GammaParams> yields = table->Yield(process, scale);
+          for(size_t irow = 0; irow < yields.size(); ++irow){
+            cout << "yield " << table->name_ << "; " << table->rows_.at(irow).label_ << "; "
+                 << process->name_ << "; " << yields.at(irow).Yield() << "; "
+                 << yields.at(irow).Uncertainty() << endl;
+          }
+        }
+      }
+    }catch(const exception &e){
+      error = e.what();
+    }
+  }
+  if(error != "") cout << "Request failed: " << error << endl;
+  return (error == "" ? string("ok") : "error: "+error)+"\n"+output.str();
+}
+
+/*!\brief Reads the process definitions
+
+  \param[in] process_file Text file defining the processes, as described above
+*/
+void PlotServer::LoadProcesses(const string &process_file){
+  ifstream file(process_file);
+  if(!file) ERROR("Could not open "+process_file);
+  Palette colors("txt/colors.txt", "default");
+  string line;
+  while(getline(file, line)){
+    line = Strip(line);
+    if(line == "" || line.front() == '#') continue;
+    vector<string> fields = Fields(line);
+    if(fields.size() < 5) ERROR("Process needs a name, type, color, cut and files: "+line);
+
+    Process::Type type;
+    if(fields.at(1) == "data") type = Process::Type::data;
+    else if(fields.at(1) == "background") type = Process::Type::background;
+    else if(fields.at(1) == "signal") type = Process::Type::signal;
+    else ERROR("Unknown process type "+fields.at(1));
+
+    const string &color = fields.at(2);
+    int color_number = color.find_first_not_of("0123456789") == string::npos
+      ? atoi(color.c_str()) : colors(color);
+    set<string> files(fields.cbegin()+4, fields.cend());
+    processes_.push_back(Process::MakeShared<Baby_full>(fields.at(0), type, color_number,
+                                                        files, fields.at(3)));
+  }
+  if(processes_.empty()) ERROR("No processes defined in "+process_file);
+}
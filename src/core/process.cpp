@@ -5,6 +5,7 @@
 using namespace std;
 
 set<unique_ptr<Baby> > Process::baby_pool_{};
+unordered_map<string, Baby*> Process::baby_index_{};
 mutex Process::mutex_{};
 
 set<Baby*> Process::Babies() const{
@@ -27,7 +28,14 @@ Process::~Process(){
     Baby &baby = *(current_iter->get());
     baby.processes_.erase(this);
     if(baby.processes_.size() == 0){
+      for(const auto &file: baby.FileNames()){
+        baby_index_.erase(IndexKey(typeid(baby), file));
+      }
       baby_pool_.erase(current_iter);
     }
   }
 }
+
+string Process::IndexKey(const type_info &baby_type, const string &file){
+  return string(baby_type.name())+'\n'+file;
+}
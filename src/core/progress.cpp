@@ -0,0 +1,142 @@
+/*! \class Progress
+
+  \brief Combined progress report for tasks running on several threads
+
+  Workers report the number of events in each task with StartTask() and then
+  add processed events with AddEvents(). These only update atomic counters, so
+  workers should count locally and call AddEvents() every batch_size_ events
+  to keep the cost negligible. A separate thread prints the total number of
+  events, the rate and the estimated time left every refresh seconds.
+
+  On a terminal the status is redrawn on a single line of std::clog. Otherwise
+  a new line is written every 10 refresh periods so that log files stay short.
+  Other messages should be printed with Log(), which moves the status line out
+  of the way.
+
+  The total number of events is only known once every task has started. Until
+  then it is extrapolated from the tasks started so far.
+*/
+
+#include "core/progress.hpp"
+
+#include <cstdio>
+
+#include <iostream>
+#include <iomanip>
+
+#include <unistd.h>
+
+#include "core/utilities.hpp"
+
+using namespace std;
+
+const long Progress::batch_size_;
+
+/*!\brief Starts the status printer
+
+  \param[in] num_tasks Number of tasks that will be started
+
+  \param[in] refresh Seconds between status updates
+*/
+Progress::Progress(size_t num_tasks,
+                   double refresh):
+  num_tasks_(num_tasks),
+  tasks_started_(0),
+  tasks_done_(0),
+  events_total_(0),
+  events_done_(0),
+  start_time_(Clock::now()),
+  refresh_(refresh),
+  erase_lines_(isatty(fileno(stderr))),
+  line_shown_(false),
+  stop_(false),
+  mutex_(),
+  cv_(),
+  printer_(){
+  printer_ = thread(&Progress::Run, this);
+}
+
+Progress::~Progress(){
+  Stop();
+}
+
+/*!\brief Records the start of a task
+
+  \param[in] num_events Number of events the task will process
+*/
+void Progress::StartTask(long num_events){
+  events_total_ += num_events;
+  ++tasks_started_;
+}
+
+/*!\brief Adds processed events
+
+  \param[in] num_events Number of events processed since the last call
+*/
+void Progress::AddEvents(long num_events){
+  events_done_.fetch_add(num_events, memory_order_relaxed);
+}
+
+void Progress::FinishTask(){
+  ++tasks_done_;
+}
+
+/*!\brief Prints a line to std::cout without garbling the status line
+
+  \param[in] message Line to print, without trailing newline
+*/
+void Progress::Log(const string &message){
+  lock_guard<mutex> lock(mutex_);
+  if(line_shown_){
+    clog << "\r\33[2K" << flush;
+    line_shown_ = false;
+  }
+  cout << message << endl;
+}
+
+/*!\brief Prints the final status and joins the printer. Safe to call twice.
+ */
+void Progress::Stop(){
+  {
+    lock_guard<mutex> lock(mutex_);
+    if(stop_) return;
+    stop_ = true;
+  }
+  cv_.notify_all();
+  if(printer_.joinable()) printer_.join();
+
+  lock_guard<mutex> lock(mutex_);
+  Print(Clock::now());
+  if(erase_lines_) clog << endl;
+  line_shown_ = false;
+}
+
+void Progress::Run(){
+  unique_lock<mutex> lock(mutex_);
+  size_t num_refreshes = 0;
+  while(!cv_.wait_for(lock, refresh_, [this](){return stop_;})){
+    ++num_refreshes;
+    if(erase_lines_ || num_refreshes % 10 == 0) Print(Clock::now());
+  }
+}
+
+//! Must be called with mutex_ locked
+void Progress::Print(Clock::time_point now){
+  double elapsed = chrono::duration<double>(now - start_time_).count();
+  long done = events_done_.load(memory_order_relaxed);
+  long total = events_total_;
+  size_t started = tasks_started_;
+  double expected = started > 0 ? static_cast<double>(total)*num_tasks_/started : 0.;
+  double rate = elapsed > 0. ? done/elapsed : 0.;
+  double remaining = rate > 0. && expected > done ? (expected-done)/rate : 0.;
+
+  if(erase_lines_) clog << "\r\33[2K";
+  clog << "Processed " << AddCommas(done) << '/';
+  if(started < num_tasks_) clog << '~';
+  clog << AddCommas(expected) << " events (" << tasks_done_.load() << '/' << num_tasks_ << " babies) in "
+       << HoursMinSec(elapsed) << " at " << RoundNumber(0.001*rate, 1) << " kHz. "
+       << HoursMinSec(remaining) << " left.";
+  if(erase_lines_) clog << flush;
+  else clog << endl;
+  line_shown_ = erase_lines_;
+}
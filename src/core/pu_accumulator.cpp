@@ -0,0 +1,152 @@
+/*! \class PUAccumulator
+
+  \brief Accumulates the MC pile-up distribution and computes the pile-up
+  systematic from it
+
+  The pile-up systematic compares the selection efficiency in data and MC by
+  measuring the efficiency in a low (N_PV<=max_low) and a high (N_PV>max_low)
+  pile-up category, interpolating linearly in N_PV, and averaging over the N_PV
+  distributions of data and MC.
+
+  A PUAccumulator holds all of the state needed for this: the data N_PV
+  distribution, given on construction, and the MC N_PV distribution, filled
+  event by event. Each task (e.g. each file processed by a thread) fills its own
+  instance, so no global state is shared, and instances filled from different
+  parts of the same sample can be combined with operator+=.
+*/
+
+#include "core/pu_accumulator.hpp"
+
+#include <algorithm>
+
+#include "core/utilities.hpp"
+
+using namespace std;
+
+/*!\brief Standard constructor
+
+  \param[in] data_npv N_PV distribution in data, with entry i holding N_PV=i.
+  Need not be normalized.
+
+  \param[in] max_low Largest N_PV in the low pile-up category
+*/
+PUAccumulator::PUAccumulator(const vector<double> &data_npv,
+                             size_t max_low):
+  data_npv_(data_npv),
+  mc_npv_(data_npv.size(), 0.),
+  max_low_(max_low){
+  if(data_npv_.size() <= max_low_+1) ERROR("Data N_PV distribution must extend past the low pile-up category");
+  double integral = 0.;
+  for(const auto &val: data_npv_) integral += val;
+  if(integral <= 0.) ERROR("Data N_PV distribution is empty");
+  for(auto &val: data_npv_) val /= integral;
+}
+
+/*!\brief Adds an MC event to the N_PV distribution
+
+  Events outside the range of the data distribution are ignored.
+
+  \param[in] npv Number of primary vertices of the event
+
+  \param[in] weight Event weight
+*/
+void PUAccumulator::Fill(int npv, double weight){
+  if(npv < 0 || npv >= static_cast<int>(mc_npv_.size())) return;
+  mc_npv_[npv] += weight;
+}
+
+/*!\brief Resets the MC distribution, keeping the data distribution
+ */
+void PUAccumulator::Clear(){
+  fill(mc_npv_.begin(), mc_npv_.end(), 0.);
+}
+
+/*!\brief Adds the MC distribution filled by another accumulator
+
+  \param[in] other Accumulator with the same data distribution
+
+  \return Reference to *this
+*/
+PUAccumulator & PUAccumulator::operator+=(const PUAccumulator &other){
+  if(other.mc_npv_.size() != mc_npv_.size() || other.max_low_ != max_low_){
+    ERROR("Cannot merge PUAccumulators with different binning");
+  }
+  for(size_t i = 0; i < mc_npv_.size(); ++i) mc_npv_[i] += other.mc_npv_[i];
+  return *this;
+}
+
+/*!\brief Get normalized data N_PV distribution
+
+  \param[in] npv Number of primary vertices
+
+  \return Fraction of data events with N_PV=npv
+*/
+double PUAccumulator::DataFraction(size_t npv) const{
+  return data_npv_.at(npv);
+}
+
+/*!\brief Get normalized MC N_PV distribution
+
+  \param[in] npv Number of primary vertices
+
+  \return Fraction of MC weight with N_PV=npv
+*/
+double PUAccumulator::MCFraction(size_t npv) const{
+  return mc_npv_.at(npv)/MCSum(0, mc_npv_.size());
+}
+
+/*!\brief Get mean MC N_PV in the low pile-up category
+
+  \return Weighted mean N_PV for MC events with N_PV<=max_low
+*/
+double PUAccumulator::MeanLow() const{
+  return MCMean(0, max_low_+1);
+}
+
+/*!\brief Get mean MC N_PV in the high pile-up category
+
+  \return Weighted mean N_PV for MC events with N_PV>max_low
+*/
+double PUAccumulator::MeanHigh() const{
+  return MCMean(max_low_+1, mc_npv_.size());
+}
+
+/*!\brief Get relative difference between data and MC efficiency
+
+  \param[in] eff_low Selection efficiency in MC in the low pile-up category
+
+  \param[in] eff_high Selection efficiency in MC in the high pile-up category
+
+  \return (eff_data-eff_mc)/eff_mc, with both efficiencies obtained by
+  averaging the linear interpolation of eff_low and eff_high over the
+  respective N_PV distributions
+*/
+double PUAccumulator::Uncertainty(double eff_low, double eff_high) const{
+  double pu_low = MeanLow(), pu_high = MeanHigh();
+  double m = (eff_high-eff_low)/(pu_high-pu_low);
+  double b = (eff_low*pu_high-eff_high*pu_low)/(pu_high-pu_low);
+  double mc_norm = MCSum(0, mc_npv_.size());
+  double eff_data = 0., eff_mc = 0.;
+  for(size_t i = 0; i < mc_npv_.size(); ++i){
+    double fx = m*static_cast<double>(i)+b;
+    eff_data += fx*data_npv_[i];
+    eff_mc += fx*mc_npv_[i]/mc_norm;
+  }
+  return (eff_data-eff_mc)/eff_mc;
+}
+
+/*!\brief Sum of MC weights in N_PV range [begin, end)
+ */
+double PUAccumulator::MCSum(size_t begin, size_t end) const{
+  double sum = 0.;
+  for(size_t i = begin; i < end && i < mc_npv_.size(); ++i) sum += mc_npv_[i];
+  return sum;
+}
+
+/*!\brief Weighted mean MC N_PV in range [begin, end)
+ */
+double PUAccumulator::MCMean(size_t begin, size_t end) const{
+  double sum = 0.;
+  for(size_t i = begin; i < end && i < mc_npv_.size(); ++i) sum += i*mc_npv_[i];
+  return sum/MCSum(begin, end);
+}
@@ -0,0 +1,262 @@
+/*! \class RandomStream
+
+  \brief Counter-based random number stream with batched gamma, Poisson and
+  normal samplers for toy-based statistics
+
+  Each draw is the splitmix64 finalizer applied to key+counter*golden_gamma, so
+  the state of a stream is just its key and the number of words drawn. Filling
+  a batch of uniforms has no dependency between elements, and independent
+  streams for threads or chunks of toys are obtained with Split(), which derives
+  a new key from the parent key and an index. A given (seed, index) always
+  yields the same sequence, regardless of which thread consumes it.
+
+  A RandomStream is not meant to be shared between threads: give each thread its
+  own stream, typically via Split().
+
+  Gamma variates use the Marsaglia-Tsang method. The batched version draws
+  normals and uniforms for all pending elements at once and redraws only the
+  rejected ones, which typically takes one or two passes. Poisson variates use
+  inversion by multiplication for small means and Hormann's transformed
+  rejection (PTRS) otherwise.
+*/
+
+#include "core/random_stream.hpp"
+
+#include <cmath>
+
+#include <numeric>
+
+#include "core/utilities.hpp"
+
+using namespace std;
+
+namespace{
+  const uint64_t golden_gamma = UINT64_C(0x9E3779B97F4A7C15);
+  const double two_pi = 2.*acos(-1.);
+}
+
+/*!\brief Standard constructor
+
+  \param[in] seed Seed of the stream. Equal seeds give equal sequences.
+*/
+RandomStream::RandomStream(uint64_t seed):
+  key_(Mix(seed)),
+  counter_(0),
+  normals_(),
+  uniforms_(),
+  pending_(){
+}
+
+/*!\brief Derives an independent stream
+
+  \param[in] index Index of the derived stream. Different indices give
+  different streams, and the result does not depend on how many words have been
+  drawn from this stream.
+
+  \return New stream starting from its first word
+*/
+RandomStream RandomStream::Split(uint64_t index) const{
+  RandomStream stream(*this);
+  stream.key_ = Mix(key_+Mix(index+golden_gamma));
+  stream.counter_ = 0;
+  return stream;
+}
+
+/*!\brief Draws 64 random bits
+ */
+uint64_t RandomStream::Next(){
+  return Mix(key_+(++counter_)*golden_gamma);
+}
+
+/*!\brief Draws a uniform variate in (0, 1)
+ */
+double RandomStream::Uniform(){
+  return ToUniform(Next());
+}
+
+/*!\brief Draws a normal variate
+
+  \param[in] mean Mean of the distribution
+
+  \param[in] sigma Standard deviation of the distribution
+*/
+double RandomStream::Normal(double mean, double sigma){
+  double r = sqrt(-2.*log(Uniform()));
+  return mean+sigma*r*cos(two_pi*Uniform());
+}
+
+/*!\brief Draws a gamma variate
+
+  \param[in] shape Shape parameter k>0
+
+  \param[in] scale Scale parameter theta
+*/
+double RandomStream::Gamma(double shape, double scale){
+  if(!(shape > 0.)) ERROR("Gamma shape must be positive, got "+to_string(shape));
+  if(shape < 1.) return Gamma(shape+1., scale)*pow(Uniform(), 1./shape);
+
+  double d = shape-1./3.;
+  double c = 1./sqrt(9.*d);
+  while(true){
+    double x, v;
+    do{
+      x = Normal();
+      v = 1.+c*x;
+    }while(v <= 0.);
+    v = v*v*v;
+    double u = Uniform();
+    if(u < 1.-0.0331*x*x*x*x || log(u) < 0.5*x*x+d*(1.-v+log(v))) return scale*d*v;
+  }
+}
+
+/*!\brief Draws a Poisson variate
+
+  \param[in] mean Mean of the distribution. Non-positive means give 0.
+
+  \return Number of counts, as a double
+*/
+double RandomStream::Poisson(double mean){
+  if(!(mean > 0.)) return 0.;
+  if(mean < 10.){
+    double limit = exp(-mean);
+    double prod = Uniform();
+    double k = 0.;
+    while(prod > limit){
+      prod *= Uniform();
+      ++k;
+    }
+    return k;
+  }
+
+  double smean = sqrt(mean), log_mean = log(mean);
+  double b = 0.931+2.53*smean;
+  double a = -0.059+0.02483*b;
+  double inv_alpha = 1.1239+1.1328/(b-3.4);
+  double vr = 0.9277-3.6224/(b-2.);
+  while(true){
+    double u = Uniform()-0.5;
+    double v = Uniform();
+    double us = 0.5-fabs(u);
+    double k = floor((2.*a/us+b)*u+mean+0.43);
+    if(us >= 0.07 && v <= vr) return k;
+    if(k < 0. || (us < 0.013 && v > us)) continue;
+    if(log(v)+log(inv_alpha)-log(a/(us*us)+b) <= -mean+k*log_mean-lgamma(k+1.)) return k;
+  }
+}
+
+/*!\brief Fills a vector with uniform variates in (0, 1)
+
+  \param[in,out] out Vector to fill. Its size sets the number of draws.
+*/
+void RandomStream::Uniform(vector<double> &out){
+  size_t n = out.size();
+  for(size_t i = 0; i < n; ++i){
+    out[i] = ToUniform(Mix(key_+(counter_+i+1)*golden_gamma));
+  }
+  counter_ += n;
+}
+
+/*!\brief Fills a vector with normal variates
+
+  \param[in,out] out Vector to fill. Its size sets the number of draws.
+
+  \param[in] mean Mean of the distribution
+
+  \param[in] sigma Standard deviation of the distribution
+*/
+void RandomStream::Normal(vector<double> &out, double mean, double sigma){
+  Uniform(out);
+  size_t n = out.size();
+  for(size_t i = 0; i+1 < n; i += 2){
+    double r = sigma*sqrt(-2.*log(out[i]));
+    double phi = two_pi*out[i+1];
+    out[i] = mean+r*cos(phi);
+    out[i+1] = mean+r*sin(phi);
+  }
+  if(n%2) out[n-1] = Normal(mean, sigma);
+}
+
+/*!\brief Fills a vector with gamma variates
+
+  \param[in,out] out Vector to fill. Its size sets the number of draws.
+
+  \param[in] shape Shape parameter k>0
+
+  \param[in] scale Scale parameter theta
+*/
+void RandomStream::Gamma(vector<double> &out, double shape, double scale){
+  if(!(shape > 0.)) ERROR("Gamma shape must be positive, got "+to_string(shape));
+  double d = (shape < 1. ? shape+1. : shape)-1./3.;
+  double c = 1./sqrt(9.*d);
+
+  pending_.resize(out.size());
+  iota(pending_.begin(), pending_.end(), 0);
+  while(!pending_.empty()){
+    size_t m = pending_.size();
+    normals_.resize(m);
+    uniforms_.resize(m);
+    Normal(normals_);
+    Uniform(uniforms_);
+    size_t num_rejected = 0;
+    for(size_t j = 0; j < m; ++j){
+      double x = normals_[j];
+      double v = 1.+c*x;
+      if(v > 0.){
+        v = v*v*v;
+        double u = uniforms_[j];
+        if(u < 1.-0.0331*x*x*x*x || log(u) < 0.5*x*x+d*(1.-v+log(v))){
+          out[pending_[j]] = d*v;
+          continue;
+        }
+      }
+      pending_[num_rejected++] = pending_[j];
+    }
+    pending_.resize(num_rejected);
+  }
+
+  if(shape < 1.){
+    uniforms_.resize(out.size());
+    Uniform(uniforms_);
+    for(size_t i = 0; i < out.size(); ++i){
+      out[i] *= pow(uniforms_[i], 1./shape);
+    }
+  }
+  for(auto &x: out) x *= scale;
+}
+
+/*!\brief Fills a vector with Poisson variates of a common mean
+
+  \param[in,out] out Vector to fill. Its size sets the number of draws.
+
+  \param[in] mean Mean of the distribution
+*/
+void RandomStream::Poisson(vector<double> &out, double mean){
+  for(auto &x: out) x = Poisson(mean);
+}
+
+/*!\brief Fills a vector with Poisson variates of varying mean
+
+  \param[in,out] out Vector to fill. Resized to the number of means.
+
+  \param[in] means Mean of each draw
+*/
+void RandomStream::Poisson(vector<double> &out, const vector<double> &means){
+  out.resize(means.size());
+  for(size_t i = 0; i < means.size(); ++i){
+    out[i] = Poisson(means[i]);
+  }
+}
+
+/*!\brief splitmix64 finalizer
+ */
+uint64_t RandomStream::Mix(uint64_t x){
+  x = (x^(x>>30))*UINT64_C(0xBF58476D1CE4E5B9);
+  x = (x^(x>>27))*UINT64_C(0x94D049BB133111EB);
+  return x^(x>>31);
+}
+
+/*!\brief Maps 64 random bits to a double in (0, 1)
+ */
+double RandomStream::ToUniform(uint64_t x){
+  return ((x>>11)+0.5)*(1./9007199254740992.);
+}
@@ -0,0 +1,58 @@
+#include <cstdlib>
+#include <cstdio>
+
+#include <string>
+
+#include <getopt.h>
+
+#include "TError.h"
+
+#include "core/plot_server.hpp"
+
+using namespace std;
+
+namespace{
+  string socket_path = PlotServer::DefaultSocket();
+  string process_file = "";
+}
+
+void GetOptions(int argc, char *argv[]);
+
+int main(int argc, char *argv[]){
+  gErrorIgnoreLevel = 6000;
+  GetOptions(argc, argv);
+  if(process_file == ""){
+    printf("Usage: run_plot_server.exe --processes <process file> [--socket <path>]\n");
+    exit(1);
+  }
+
+  PlotServer server(socket_path, process_file);
+  server.Run();
+}
+
+void GetOptions(int argc, char *argv[]){
+  while(true){
+    static struct option long_options[] = {
+      {"processes", required_argument, 0, 'p'}, // File defining the processes to serve
+      {"socket", required_argument, 0, 's'},    // Unix socket on which to listen
+      {0, 0, 0, 0}
+    };
+
+    char opt = -1;
+    int option_index;
+    opt = getopt_long(argc, argv, "p:s:", long_options, &option_index);
+    if(opt == -1) break;
+
+    switch(opt){
+    case 'p':
+      process_file = optarg;
+      break;
+    case 's':
+      socket_path = optarg;
+      break;
+    default:
+      printf("Bad option! getopt_long returned character code 0%o\n", opt);
+      break;
+    }
+  }
+}
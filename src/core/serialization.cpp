@@ -0,0 +1,68 @@
+#include "core/serialization.hpp"
+
+#include <memory>
+
+#include "TArrayD.h"
+
+using namespace std;
+
+void Serialization::WriteString(ostream &out, const string &str){
+  Write<uint64_t>(out, str.size());
+  out.write(str.data(), str.size());
+}
+
+string Serialization::ReadString(istream &in){
+  string str(Read<uint64_t>(in), '\0');
+  if(!str.empty() && !in.read(&str.at(0), str.size())) ERROR("Truncated serialized data");
+  return str;
+}
+
+/*!\brief Writes the contents, errors, entries and statistics of a histogram
+
+  The binning is not written. AddHist() must be given a histogram with the same
+  binning.
+*/
+void Serialization::WriteHist(ostream &out, const TH1 &hist){
+  int num_cells = hist.GetNcells();
+  Write(out, num_cells);
+  vector<double> contents(num_cells), sumw2;
+  for(int i = 0; i < num_cells; ++i) contents.at(i) = hist.GetBinContent(i);
+  const TArrayD *hist_sumw2 = hist.GetSumw2();
+  if(hist_sumw2 != nullptr && hist_sumw2->GetSize() == num_cells){
+    sumw2.assign(hist_sumw2->GetArray(), hist_sumw2->GetArray()+num_cells);
+  }
+  WriteVector(out, contents);
+  WriteVector(out, sumw2);
+  Write(out, hist.GetEntries());
+  vector<double> stats(TH1::kNstat, 0.);
+  hist.GetStats(stats.data());
+  WriteVector(out, stats);
+}
+
+/*!\brief Adds a histogram written by WriteHist() to hist
+
+  \param[in,out] in Stream positioned at the start of the histogram
+
+  \param[in,out] hist Histogram with the same binning as the written one
+*/
+void Serialization::AddHist(istream &in, TH1 &hist){
+  int num_cells = Read<int>(in);
+  if(num_cells != hist.GetNcells()) ERROR("Serialized histogram has "+to_string(num_cells)
+                                          +" cells, expected "+to_string(hist.GetNcells()));
+  vector<double> contents = ReadVector<double>(in);
+  vector<double> sumw2 = ReadVector<double>(in);
+  double entries = Read<double>(in);
+  vector<double> stats = ReadVector<double>(in);
+
+  unique_ptr<TH1> other(static_cast<TH1*>(hist.Clone()));
+  other->SetDirectory(nullptr);
+  other->Reset();
+  if(!sumw2.empty() && other->GetSumw2N() == 0) other->Sumw2();
+  for(int i = 0; i < num_cells; ++i){
+    other->SetBinContent(i, contents.at(i));
+    if(!sumw2.empty()) other->GetSumw2()->SetAt(sumw2.at(i), i);
+  }
+  other->PutStats(stats.data());
+  other->SetEntries(entries);
+  hist.Add(other.get());
+}
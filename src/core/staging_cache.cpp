@@ -0,0 +1,255 @@
+/*! \class StagingCache
+
+  \brief Read-through copy of ntuple files on local scratch disk
+
+  Babies normally read their files directly from NFS, so every plotting session
+  pays for the same network reads. When the RA4_DRAW_STAGE_DIR environment
+  variable names a local directory, Baby::ActivateChain() reads each file
+  through Local() instead. Local() returns the path of a local copy, making it
+  first if needed.
+
+  A copy is named after a hash of the source path and the source size and
+  modification time. If the source file changes, its old copy is therefore
+  never used again and ages out. Copies are written under a temporary name,
+  checked against the source size, and then renamed, so an interrupted copy is
+  never mistaken for a complete one. Using a copy updates its modification
+  time. When the directory grows beyond RA4_DRAW_STAGE_GB (default 100), the
+  least recently used copies are deleted.
+
+  Prefetch() queues files in the order they are expected to be used. A
+  background thread copies them while earlier files are being processed,
+  staying at most a few files ahead of use so that it does not evict files
+  that are still needed. Without RA4_DRAW_STAGE_DIR, Local() returns its
+  argument and Prefetch() does nothing.
+*/
+
+#include "core/staging_cache.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <utility>
+
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "core/utilities.hpp"
+
+using namespace std;
+
+namespace{
+  bool StatFile(const string &path, int64_t &size, int64_t &mtime){
+    struct stat info;
+    if(stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode)) return false;
+    size = info.st_size;
+    mtime = INT64_C(1000000000)*info.st_mtim.tv_sec+info.st_mtim.tv_nsec;
+    return true;
+  }
+
+  // Checks that a copy is complete and marks it as recently used
+  bool UseCopy(const string &local, int64_t size){
+    int64_t local_size, local_mtime;
+    if(!StatFile(local, local_size, local_mtime) || local_size != size) return false;
+    utimensat(AT_FDCWD, local.c_str(), nullptr, 0);
+    return true;
+  }
+}
+
+/*!\brief Cache shared by the whole process, configured from the environment on
+  first use
+*/
+StagingCache & StagingCache::Get(){
+  static StagingCache cache;
+  return cache;
+}
+
+bool StagingCache::Enabled() const{
+  return dir_ != "";
+}
+
+/*!\brief Path from which to read a file, staging it locally if enabled
+
+  Waits for the prefetch thread if it is already copying the file.
+
+  \param[in] path Path of the source file
+
+  \return Path of an up-to-date local copy, or path if staging is disabled or
+  the copy failed
+*/
+string StagingCache::Local(const string &path){
+  if(!Enabled()) return path;
+  int64_t size, mtime;
+  if(!StatFile(path, size, mtime)) return path;
+  string local = LocalName(path);
+
+  unique_lock<mutex> lock(mutex_);
+  used_.insert(path);
+  waiting_.erase(path);
+  cv_.notify_all();
+  cv_.wait(lock, [this, &path](){return busy_.find(path) == busy_.end();});
+  if(!UseCopy(local, size)){
+    busy_.insert(path);
+    lock.unlock();
+    bool staged = Stage(path, local);
+    lock.lock();
+    busy_.erase(path);
+    cv_.notify_all();
+    if(!staged) return path;
+  }
+  // Chains open their files lazily, so recently returned copies are kept
+  recent_.push_back(local);
+  if(recent_.size() > max_recent_) recent_.pop_front();
+  return local;
+}
+
+/*!\brief Queues files to be copied ahead of their use
+
+  \param[in] paths Source files, in the order they will be passed to Local()
+*/
+void StagingCache::Prefetch(const vector<string> &paths){
+  if(!Enabled()) return;
+  lock_guard<mutex> lock(mutex_);
+  for(const auto &path: paths){
+    if(used_.find(path) == used_.end()) queue_.push_back(path);
+  }
+  if(!prefetcher_.joinable()) prefetcher_ = thread(&StagingCache::Work, this);
+  cv_.notify_all();
+}
+
+StagingCache::StagingCache():
+  dir_(),
+  max_bytes_(INT64_C(100) << 30),
+  lookahead_(8),
+  queue_(),
+  busy_(),
+  waiting_(),
+  used_(),
+  recent_(),
+  stop_(false),
+  mutex_(),
+  cv_(),
+  prefetcher_(){
+  const char *dir = getenv("RA4_DRAW_STAGE_DIR");
+  if(dir == nullptr || string(dir) == "") return;
+  dir_ = dir;
+  if(dir_.back() != '/') dir_ += '/';
+  mkdir(dir_.c_str(), 0755);
+  const char *max_gb = getenv("RA4_DRAW_STAGE_GB");
+  if(max_gb != nullptr) max_bytes_ = static_cast<int64_t>(atof(max_gb)*(INT64_C(1) << 30));
+}
+
+StagingCache::~StagingCache(){
+  {
+    lock_guard<mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  if(prefetcher_.joinable()) prefetcher_.join();
+}
+
+/*!\brief Name of the local copy of a file in its current version
+ */
+string StagingCache::LocalName(const string &path) const{
+  int64_t size, mtime;
+  if(!StatFile(path, size, mtime)) return "";
+  uint64_t hash = UINT64_C(14695981039346656037);
+  for(unsigned char c: path){
+    hash = (hash ^ c)*UINT64_C(1099511628211);
+  }
+  ostringstream oss;
+  oss << dir_ << hex << setw(16) << setfill('0') << hash << dec
+      << '_' << size << '_' << mtime << '_' << Basename(path);
+  return oss.str();
+}
+
+/*!\brief Copies a file to the scratch directory and makes room for it
+
+  \return True if the copy is complete
+*/
+bool StagingCache::Stage(const string &path, const string &local){
+  int64_t size, mtime;
+  if(!StatFile(path, size, mtime)) return false;
+  string part = local+".part"+to_string(getpid());
+  {
+    ifstream in(path, ios::binary);
+    ofstream out(part, ios::binary);
+    if(in && out) out << in.rdbuf();
+  }
+  int64_t part_size, part_mtime;
+  if(!StatFile(part, part_size, part_mtime) || part_size != size
+     || rename(part.c_str(), local.c_str()) != 0){
+    DBG("Could not stage " << path << " to " << local);
+    remove(part.c_str());
+    return false;
+  }
+  Evict();
+  return true;
+}
+
+/*!\brief Deletes least recently used copies until the directory fits the size
+  limit
+
+  Prefetched copies not yet used and the last max_recent_ copies returned by
+  Local() are kept. Copies already open by a chain stay readable after being
+  deleted.
+*/
+void StagingCache::Evict(){
+  set<string> keep;
+  {
+    lock_guard<mutex> lock(mutex_);
+    for(const auto &path: waiting_) keep.insert(LocalName(path));
+    keep.insert(recent_.cbegin(), recent_.cend());
+  }
+
+  vector<pair<int64_t, string> > copies;//(mtime, path)
+  int64_t total = 0;
+  DIR *dir = opendir(dir_.c_str());
+  if(dir == nullptr) return;
+  while(dirent *entry = readdir(dir)){
+    string local = dir_+entry->d_name;
+    int64_t size, mtime;
+    if(!StatFile(local, size, mtime)) continue;
+    total += size;
+    // Partial copies belong to stagings in progress
+    if(Contains(local, ".part") || keep.find(local) != keep.end()) continue;
+    copies.emplace_back(mtime, local);
+  }
+  closedir(dir);
+
+  sort(copies.begin(), copies.end());
+  for(const auto &copy: copies){
+    if(total <= max_bytes_) break;
+    int64_t size, mtime;
+    if(!StatFile(copy.second, size, mtime)) continue;
+    if(remove(copy.second.c_str()) == 0) total -= size;
+  }
+}
+
+void StagingCache::Work(){
+  unique_lock<mutex> lock(mutex_);
+  while(true){
+    cv_.wait(lock, [this](){return stop_ || (!queue_.empty() && waiting_.size() < lookahead_);});
+    if(stop_) break;
+    string path = queue_.front();
+    queue_.pop_front();
+    if(used_.find(path) != used_.end() || busy_.find(path) != busy_.end()) continue;
+
+    busy_.insert(path);
+    lock.unlock();
+    int64_t size, mtime;
+    string local = LocalName(path);
+    bool staged = StatFile(path, size, mtime)
+      && (UseCopy(local, size) || Stage(path, local));
+    lock.lock();
+    busy_.erase(path);
+    if(staged && used_.find(path) == used_.end()) waiting_.insert(path);
+    cv_.notify_all();
+  }
+}
@@ -1,7 +1,9 @@
 #include "core/table.hpp"
 
+#include <algorithm>
 #include <fstream>
 #include <iomanip>
+#include <map>
 
 #include <sys/stat.h>
 
@@ -15,6 +17,7 @@
 #include "TString.h"
 
 #include "core/utilities.hpp"
+#include "core/serialization.hpp"
 
 using namespace std;
 
@@ -42,17 +45,74 @@ Table::TableColumn::TableColumn(const Table &table,
   FigureComponent(table, process),
   sumw_(table.rows_.size(), 0.),
   sumw2_(table.rows_.size(), 0.),
+  var_sumw_(),
+  var_sumw2_(),
+  var_offset_(1, 0),
   proc_and_table_cut_(table.rows_.size(), process->cut_),
+  conjuncts_(),
+  row_conjuncts_(table.rows_.size()),
+  conjunct_pass_(),
+  grids_(),
+  row_grid_(table.rows_.size(), -1),
+  grid_cell_(),
   cut_vector_(),
   wgt_vector_(),
   val_vector_(){
+  //Split scalar row cuts into their "&&" operands so that sub-cuts common to
+  //several rows (e.g., a cut-flow's baseline) are evaluated once per event.
+  //Rows defined as regions of a BinGrid only need the grid's selection, with
+  //the event located in each distinct grid once per event.
+  map<string, size_t> conjunct_index;
   for(size_t irow = 0; irow < table.rows_.size(); ++irow){
-    proc_and_table_cut_.at(irow) = table.rows_.at(irow).cut_ && process->cut_;
+    const TableRow &row = table.rows_.at(irow);
+    proc_and_table_cut_.at(irow) = row.cut_ && process->cut_;
+    const NamedFunc &cut = proc_and_table_cut_.at(irow);
+    if(!row.is_data_row_ || !cut.IsScalar()) continue;
+    NamedFunc selection = cut;
+    if(row.grid_){
+      auto loc = find(grids_.cbegin(), grids_.cend(), row.grid_.get());
+      row_grid_.at(irow) = loc - grids_.cbegin();
+      if(loc == grids_.cend()) grids_.push_back(row.grid_.get());
+      selection = row.grid_->Cut() && process->cut_;
+    }
+    for(const auto &conjunct: selection.Conjuncts()){
+      //Only functions whose name defines them can be matched by name; any
+      //other sub-cut (e.g., one built from a user functor) is kept on its own
+      if(!conjunct.NameDefinesFunction()){
+        row_conjuncts_.at(irow).push_back(conjuncts_.size());
+        conjuncts_.push_back(conjunct);
+        continue;
+      }
+      auto loc = conjunct_index.find(conjunct.Name());
+      if(loc == conjunct_index.end()){
+        loc = conjunct_index.emplace(conjunct.Name(), conjuncts_.size()).first;
+        conjuncts_.push_back(conjunct);
+      }
+      row_conjuncts_.at(irow).push_back(loc->second);
+    }
   }
+  conjunct_pass_.resize(conjuncts_.size());
+  grid_cell_.resize(grids_.size());
+
+  for(const auto &row: table.rows_){
+    if(row.weight_variations_.size()){
+      if(!row.is_data_row_ || !(row.cut_ && process->cut_).IsScalar() || !row.weight_.IsScalar()){
+        ERROR("Weight variations require a data row with scalar cut and weight ("+row.label_+")");
+      }
+      for(const auto &variation: row.weight_variations_){
+        if(!variation.IsScalar()) ERROR("Weight variation "+variation.Name()+" must be scalar");
+      }
+    }
+    var_offset_.push_back(var_offset_.back()+row.weight_variations_.size());
+  }
+  var_sumw_.assign(var_offset_.back(), 0.);
+  var_sumw2_.assign(var_offset_.back(), 0.);
 }
 
 void Table::TableColumn::RecordEvent(const Baby &baby){
   const Table& table = static_cast<const Table&>(figure_);
+  fill(conjunct_pass_.begin(), conjunct_pass_.end(), -1);
+  fill(grid_cell_.begin(), grid_cell_.end(), -2);
 
   bool have_vector;
   size_t min_vec_size;
@@ -66,8 +126,13 @@ void Table::TableColumn::RecordEvent(const Baby &baby){
     const NamedFunc &wgt = row.weight_;
 
     if(cut.IsScalar()){
-      if(!cut.GetScalar(baby)) continue;
-      
+      if(!PassConjuncts(irow, baby)) continue;
+      long igrid = row_grid_.at(irow);
+      if(igrid >= 0){
+        long &cell = grid_cell_.at(igrid);
+        if(cell == -2) cell = grids_.at(igrid)->CellIndex(baby, false);
+        if(!row.grid_->InRegion(row.region_, cell)) continue;
+      }
     }else{
       cut_vector_ = cut.GetVector(baby);
       if(!have_vector || cut_vector_.size() < min_vec_size){
@@ -90,6 +155,13 @@ void Table::TableColumn::RecordEvent(const Baby &baby){
     if(!have_vector){
       sumw_.at(irow) += wgt_scalar;
       sumw2_.at(irow) += wgt_scalar*wgt_scalar;
+      double *var_sumw = var_sumw_.data()+var_offset_.at(irow);
+      double *var_sumw2 = var_sumw2_.data()+var_offset_.at(irow);
+      for(size_t ivar = 0; ivar < row.weight_variations_.size(); ++ivar){
+        NamedFunc::ScalarType var_wgt = wgt_scalar*row.weight_variations_[ivar].GetScalar(baby);
+        var_sumw[ivar] += var_wgt;
+        var_sumw2[ivar] += var_wgt*var_wgt;
+      }
     }else{
       for(size_t iobject = 0; iobject < min_vec_size; ++iobject){
        NamedFunc::ScalarType this_cut = cut.IsScalar() ? true : cut_vector_.at(iobject);
@@ -102,6 +174,47 @@ void Table::TableColumn::RecordEvent(const Baby &baby){
   }
 }
 
+bool Table::TableColumn::Mergeable() const{
+  return true;
+}
+
+void Table::TableColumn::Serialize(ostream &out) const{
+  Serialization::WriteVector(out, sumw_);
+  Serialization::WriteVector(out, sumw2_);
+  Serialization::WriteVector(out, var_sumw_);
+  Serialization::WriteVector(out, var_sumw2_);
+}
+
+void Table::TableColumn::Merge(istream &in){
+  for(vector<double> *sums: {&sumw_, &sumw2_, &var_sumw_, &var_sumw2_}){
+    vector<double> other = Serialization::ReadVector<double>(in);
+    if(other.size() != sums->size()) ERROR("Serialized column for "+process_->name_+" does not match table "+
+                                           static_cast<const Table&>(figure_).name_);
+    for(size_t i = 0; i < other.size(); ++i) sums->at(i) += other.at(i);
+  }
+}
+
+/*!\brief Check if event passes scalar cut for given row
+
+  Conjuncts are evaluated in order with short-circuiting, and each result is
+  cached until the next event so a sub-cut failing for one row is not
+  reevaluated for any other row.
+
+  \param[in] irow Index of row whose cut is checked
+
+  \param[in] baby Baby providing the current event
+
+  \return True if all conjuncts of the row's cut pass
+*/
+bool Table::TableColumn::PassConjuncts(size_t irow, const Baby &baby){
+  for(const auto &iconj: row_conjuncts_.at(irow)){
+    signed char &pass = conjunct_pass_.at(iconj);
+    if(pass < 0) pass = conjuncts_.at(iconj).GetScalar(baby) ? 1 : 0;
+    if(!pass) return false;
+  }
+  return true;
+}
+
 Table::Table(const string &name,
              const vector<TableRow> &rows,
              const vector<shared_ptr<Process> > &processes,
@@ -176,6 +289,33 @@ vector<GammaParams> Table::Yield(const Process *process, double luminosity) cons
   return yields;
 }
 
+/*!\brief Get yields of a row's weight variations for a process
+
+  \param[in] process Process whose yields are returned
+
+  \param[in] irow Index of row
+
+  \param[in] luminosity Luminosity by which yields are scaled
+
+  \return Yield for each of the row's TableRow::weight_variations_
+*/
+vector<GammaParams> Table::VariationYield(const Process *process, size_t irow, double luminosity) const{
+  const auto &component_list = GetComponentList(process);
+  const TableColumn *col = nullptr;
+  for(const auto &component: component_list){
+    if(component->process_.get() == process){
+      col = static_cast<const TableColumn *>(component.get());
+    }
+  }
+  if(col == nullptr) return vector<GammaParams>();
+  vector<GammaParams> yields(rows_.at(irow).weight_variations_.size());
+  for(size_t ivar = 0; ivar < yields.size(); ++ivar){
+    size_t i = col->var_offset_.at(irow)+ivar;
+    yields.at(ivar).SetYieldAndUncertainty(luminosity*col->var_sumw_.at(i), luminosity*sqrt(col->var_sumw2_.at(i)));
+  }
+  return yields;
+}
+
 vector<GammaParams> Table::BackgroundYield(double luminosity) const{
   vector<GammaParams> yields(rows_.size());  
   auto procs = GetProcesses();
@@ -8,7 +8,10 @@ TableRow::TableRow(const std::string &label,
   weight_("1"),
   lines_before_(lines_before),
   lines_after_(lines_after),
-  is_data_row_(false){
+  is_data_row_(false),
+  grid_(),
+  region_(0),
+  weight_variations_(){
   }
 
 TableRow::TableRow(const std::string &label,
@@ -21,5 +24,41 @@ TableRow::TableRow(const std::string &label,
   weight_(weight),
   lines_before_(lines_before),
   lines_after_(lines_after),
-  is_data_row_(true){
+  is_data_row_(true),
+  grid_(),
+  region_(0),
+  weight_variations_(){
   }
+
+TableRow::TableRow(const std::string &label,
+                   const std::shared_ptr<const BinGrid> &grid,
+                   const std::string &region,
+                   std::size_t lines_before,
+                   std::size_t lines_after,
+                   const NamedFunc &weight):
+  label_(label),
+  cut_(grid->RegionCut(region)),
+  weight_(weight),
+  lines_before_(lines_before),
+  lines_after_(lines_after),
+  is_data_row_(true),
+  grid_(grid),
+  region_(grid->RegionIndex(region)),
+  weight_variations_(){
+  }
+
+/*!\brief Set weight variations accumulated alongside the nominal yield
+
+  The row's selection is evaluated once per event, and the weight times each
+  variation factor is summed separately, so a row can hold all the variations of
+  a systematic (e.g., "sys_bctag[0]/w_btag" and "sys_bctag[1]/w_btag") for
+  about the cost of the nominal yield.
+
+  \param[in] variations Scalar factors multiplying TableRow::weight_
+
+  \return Reference to *this
+*/
+TableRow & TableRow::WeightVariations(const std::vector<NamedFunc> &variations){
+  weight_variations_ = variations;
+  return *this;
+}
@@ -0,0 +1,134 @@
+#include <cstdlib>
+#include <cstdio>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <getopt.h>
+#include <unistd.h>
+
+#include "core/plot_metrics.hpp"
+
+using namespace std;
+
+namespace{
+  string metrics_file = "";
+  size_t num_passes = 2;
+  int num_failures = 0;
+
+  void Check(bool pass, const string &name, const string &detail){
+    printf("%-5s %-36s %s\n", pass ? "ok" : "FAIL", name.c_str(), detail.c_str());
+    if(!pass) ++num_failures;
+  }
+
+  string ReadFile(const string &path){
+    ifstream in(path);
+    if(!in) return "";
+    ostringstream contents;
+    contents << in.rdbuf();
+    return contents.str();
+  }
+
+  // Records one Baby per pass, with a distinct entry count so each file can be traced back to
+  // the pass that wrote it, and writes the pass the way PlotMaker::MakePlots() does.
+  void WritePass(size_t pass){
+    PlotMetrics metrics;
+    metrics.Start(1, "none");
+    PlotMetrics::BabyRecord record;
+    record.tag = "pass"+to_string(pass)+".root";
+    record.thread = 0;
+    record.entries = 1000+pass;
+    record.wall_seconds = 0.;
+    record.cpu_seconds = 0.;
+    record.lock_seconds = 0.;
+    record.bytes_read = 0;
+    record.bytes_unzipped = 0;
+    record.figures = 1;
+    record.passed.emplace_back("data", 1000+pass);
+    metrics.Add(record);
+    metrics.FinishYields();
+    metrics.FinishPrint(pass+1);
+    metrics.Write(PlotMetrics::PassPath(metrics_file, pass));
+  }
+
+  void TestPassPaths(){
+    vector<string> paths;
+    for(size_t pass = 0; pass < num_passes; ++pass){
+      string path = PlotMetrics::PassPath(metrics_file, pass);
+      for(const auto &other: paths){
+        if(path == other) Check(false, "distinct file names", path+" used twice");
+      }
+      paths.push_back(path);
+    }
+    Check(paths.front() == metrics_file, "first pass keeps file name", paths.front());
+    Check(PlotMetrics::PassPath("out/metrics.json", 2) == "out/metrics_pass2.json",
+          "suffix before extension", PlotMetrics::PassPath("out/metrics.json", 2));
+    Check(PlotMetrics::PassPath("out.d/metrics", 1) == "out.d/metrics_pass1",
+          "no extension", PlotMetrics::PassPath("out.d/metrics", 1));
+  }
+
+  void TestPassesKept(){
+    for(size_t pass = 0; pass < num_passes; ++pass) WritePass(pass);
+    for(size_t pass = 0; pass < num_passes; ++pass){
+      string path = PlotMetrics::PassPath(metrics_file, pass);
+      string contents = ReadFile(path);
+      string tag = "pass"+to_string(pass)+".root";
+      Check(contents.find(tag) != string::npos, "pass "+to_string(pass)+" kept", path);
+      Check(contents.find("\"figures\": "+to_string(pass+1)) != string::npos,
+            "pass "+to_string(pass)+" figures", path);
+      for(size_t other = 0; other < num_passes; ++other){
+        if(other == pass) continue;
+        string other_tag = "pass"+to_string(other)+".root";
+        if(contents.find(other_tag) != string::npos){
+          Check(false, "pass "+to_string(pass)+" not overwritten", path+" has "+other_tag);
+        }
+      }
+      unlink(path.c_str());
+    }
+  }
+}
+
+void GetOptions(int argc, char *argv[]);
+
+int main(int argc, char *argv[]){
+  GetOptions(argc, argv);
+  if(metrics_file == "") metrics_file = "/tmp/test_plot_metrics_"+to_string(getpid())+".json";
+  if(num_passes < 2) num_passes = 2;
+
+  printf("Testing PlotMetrics with %zu passes written to %s\n\n",
+         num_passes, metrics_file.c_str());
+  TestPassPaths();
+  TestPassesKept();
+
+  printf("\n%d failure%s\n", num_failures, num_failures == 1 ? "" : "s");
+  if(num_failures > 0) exit(1);
+}
+
+void GetOptions(int argc, char *argv[]){
+  while(true){
+    static struct option long_options[] = {
+      {"file", required_argument, 0, 'f'},   // Metrics file name of the first pass
+      {"passes", required_argument, 0, 'n'}, // Number of passes, at least 2
+      {0, 0, 0, 0}
+    };
+
+    char opt = -1;
+    int option_index;
+    opt = getopt_long(argc, argv, "f:n:", long_options, &option_index);
+    if(opt == -1) break;
+
+    switch(opt){
+    case 'f':
+      metrics_file = optarg;
+      break;
+    case 'n':
+      num_passes = atoi(optarg);
+      break;
+    default:
+      printf("Bad option! getopt_long returned character code 0%o\n", opt);
+      break;
+    }
+  }
+}
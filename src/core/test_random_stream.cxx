@@ -0,0 +1,252 @@
+#include <cstdlib>
+#include <cstdio>
+#include <cstdint>
+#include <cinttypes>
+#include <cmath>
+
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <getopt.h>
+
+#include "TMath.h"
+
+#include "core/random_stream.hpp"
+
+using namespace std;
+
+namespace{
+  size_t num_draws = 1000000;
+  uint64_t seed = 12345;
+  double max_sigma = 5.;//!<Largest deviation, in standard errors, counted as a pass
+  int num_failures = 0;
+
+  void Check(bool pass, const string &name, const string &detail){
+    printf("%-5s %-36s %s\n", pass ? "ok" : "FAIL", name.c_str(), detail.c_str());
+    if(!pass) ++num_failures;
+  }
+
+  // Compares the sample mean and variance to the expected ones. The error on the variance uses
+  // the excess kurtosis of the distribution.
+  void CheckMoments(const string &name, const vector<double> &draws,
+                    double mean, double variance, double excess_kurtosis){
+    double n = draws.size();
+    double sum = 0., sum2 = 0.;
+    for(double x: draws){
+      sum += x;
+      sum2 += (x-mean)*(x-mean);
+    }
+    double sample_mean = sum/n;
+    double sample_variance = sum2/n-(sample_mean-mean)*(sample_mean-mean);
+    double mean_pull = (sample_mean-mean)/sqrt(variance/n);
+    double variance_pull = (sample_variance-variance)/(variance*sqrt((2.+excess_kurtosis)/n));
+    char detail[256];
+    snprintf(detail, sizeof(detail), "mean %.5g (pull %+.2f), variance %.5g (pull %+.2f)",
+             sample_mean, mean_pull, sample_variance, variance_pull);
+    Check(fabs(mean_pull) < max_sigma && fabs(variance_pull) < max_sigma, name+" moments", detail);
+  }
+
+  // Binned chi2 of the draws against a CDF. The bins are (-inf, edges[0]], ..., (edges.back(), inf),
+  // with neighbors merged until each expects at least 5 draws.
+  void CheckChi2(const string &name, const vector<double> &draws,
+                 const vector<double> &edges, const function<double(double)> &cdf){
+    vector<double> observed(edges.size()+1, 0.), expected(edges.size()+1, 0.);
+    for(double x: draws){
+      observed.at(lower_bound(edges.cbegin(), edges.cend(), x)-edges.cbegin()) += 1.;
+    }
+    double last_cdf = 0.;
+    for(size_t ibin = 0; ibin < edges.size(); ++ibin){
+      double this_cdf = cdf(edges.at(ibin));
+      expected.at(ibin) = draws.size()*(this_cdf-last_cdf);
+      last_cdf = this_cdf;
+    }
+    expected.back() = draws.size()*(1.-last_cdf);
+
+    double chi2 = 0., obs_sum = 0., exp_sum = 0.;
+    size_t num_bins = 0;
+    for(size_t ibin = 0; ibin < observed.size(); ++ibin){
+      obs_sum += observed.at(ibin);
+      exp_sum += expected.at(ibin);
+      if(exp_sum < 5. && ibin+1 < observed.size()) continue;
+      if(exp_sum > 0.) chi2 += (obs_sum-exp_sum)*(obs_sum-exp_sum)/exp_sum;
+      ++num_bins;
+      obs_sum = 0.;
+      exp_sum = 0.;
+    }
+    double dof = num_bins-1.;
+    double pull = (chi2-dof)/sqrt(2.*dof);
+    char detail[256];
+    snprintf(detail, sizeof(detail), "chi2/dof %.1f/%.0f (pull %+.2f)", chi2, dof, pull);
+    Check(dof > 0. && pull < max_sigma, name+" chi2", detail);
+  }
+
+  vector<double> Edges(double low, double high, size_t num_bins){
+    vector<double> edges;
+    for(size_t i = 0; i <= num_bins; ++i) edges.push_back(low+(high-low)*i/num_bins);
+    return edges;
+  }
+
+  void TestGamma(double shape, double scale){
+    string name = "Gamma("+to_string(shape).substr(0, 4)+", "+to_string(scale).substr(0, 4)+")";
+    double mean = shape*scale, sigma = sqrt(shape)*scale;
+    vector<double> edges = Edges(max(0., mean-4.*sigma), mean+6.*sigma, 60);
+    auto cdf = [shape, scale](double x){return x <= 0. ? 0. : TMath::Gamma(shape, x/scale);};
+
+    RandomStream rng(seed);
+    vector<double> draws(num_draws);
+    for(auto &x: draws) x = rng.Gamma(shape, scale);
+    CheckMoments(name, draws, mean, sigma*sigma, 6./shape);
+    CheckChi2(name, draws, edges, cdf);
+
+    rng.Gamma(draws, shape, scale);
+    CheckMoments(name+" batched", draws, mean, sigma*sigma, 6./shape);
+    CheckChi2(name+" batched", draws, edges, cdf);
+  }
+
+  void TestPoisson(double mean){
+    string name = "Poisson("+to_string(mean).substr(0, 4)+")";
+    vector<double> edges;
+    for(double k = 0.; k < mean+8.*sqrt(mean)+10.; ++k) edges.push_back(k+0.5);
+    auto cdf = [mean](double x){
+      double total = 0.;
+      for(double k = 0.; k <= x; ++k) total += exp(k*log(mean)-mean-lgamma(k+1.));
+      return total;
+    };
+
+    RandomStream rng(seed);
+    vector<double> draws(num_draws);
+    for(auto &x: draws) x = rng.Poisson(mean);
+    CheckMoments(name, draws, mean, mean, 1./mean);
+    CheckChi2(name, draws, edges, cdf);
+
+    rng.Poisson(draws, mean);
+    CheckMoments(name+" batched", draws, mean, mean, 1./mean);
+    CheckChi2(name+" batched", draws, edges, cdf);
+  }
+
+  void TestNormal(double mean, double sigma){
+    string name = "Normal("+to_string(mean).substr(0, 4)+", "+to_string(sigma).substr(0, 4)+")";
+    vector<double> edges = Edges(mean-5.*sigma, mean+5.*sigma, 60);
+    auto cdf = [mean, sigma](double x){return 0.5*erfc(-(x-mean)/(sigma*sqrt(2.)));};
+
+    RandomStream rng(seed);
+    vector<double> draws(num_draws);
+    for(auto &x: draws) x = rng.Normal(mean, sigma);
+    CheckMoments(name, draws, mean, sigma*sigma, 0.);
+    CheckChi2(name, draws, edges, cdf);
+
+    rng.Normal(draws, mean, sigma);
+    CheckMoments(name+" batched", draws, mean, sigma*sigma, 0.);
+    CheckChi2(name+" batched", draws, edges, cdf);
+  }
+
+  void TestDeterminism(){
+    RandomStream a(seed), b(seed);
+    bool same = true;
+    for(size_t i = 0; i < 1000; ++i) same = same && a.Next() == b.Next();
+    Check(same, "Same seed", "identical sequences");
+
+    RandomStream parent(seed);
+    RandomStream first = parent.Split(7);
+    parent.Next();
+    RandomStream second = parent.Split(7);
+    same = true;
+    for(size_t i = 0; i < 1000; ++i) same = same && first.Next() == second.Next();
+    Check(same, "Split(7) twice", "identical, independent of parent draws");
+
+    vector<double> x(1000), y(1000);
+    RandomStream(seed).Split(3).Gamma(x, 0.5);
+    RandomStream(seed).Split(3).Gamma(y, 0.5);
+    Check(x == y, "Batched gamma of Split(3)", "identical");
+  }
+
+  // Distinct streams must neither repeat each other's words nor be correlated
+  void TestIndependence(){
+    RandomStream parent(seed);
+    vector<RandomStream> streams;
+    streams.push_back(parent);
+    for(uint64_t index = 0; index < 8; ++index) streams.push_back(parent.Split(index));
+    streams.push_back(RandomStream(seed+1));
+
+    size_t num_pairs = 20000;
+    vector<vector<double> > uniforms(streams.size(), vector<double>(num_pairs));
+    for(size_t istream = 0; istream < streams.size(); ++istream){
+      streams.at(istream).Uniform(uniforms.at(istream));
+    }
+
+    bool distinct = true;
+    double max_pull = 0.;
+    for(size_t i = 0; i < streams.size(); ++i){
+      for(size_t j = i+1; j < streams.size(); ++j){
+        size_t num_equal = 0;
+        double corr = 0.;
+        for(size_t k = 0; k < num_pairs; ++k){
+          if(uniforms.at(i).at(k) == uniforms.at(j).at(k)) ++num_equal;
+          corr += (uniforms.at(i).at(k)-0.5)*(uniforms.at(j).at(k)-0.5);
+        }
+        // Each product has variance 1/144
+        double pull = corr/sqrt(num_pairs/144.);
+        max_pull = max(max_pull, fabs(pull));
+        if(num_equal > 1) distinct = false;
+      }
+    }
+    char detail[256];
+    snprintf(detail, sizeof(detail), "%zu streams, largest correlation pull %.2f", streams.size(), max_pull);
+    Check(distinct && max_pull < max_sigma, "Split streams independent", detail);
+  }
+}
+
+void GetOptions(int argc, char *argv[]);
+
+int main(int argc, char *argv[]){
+  GetOptions(argc, argv);
+
+  printf("Testing RandomStream with %zu draws per distribution, seed %" PRIu64 "\n\n",
+         num_draws, seed);
+  TestGamma(0.3, 1.);
+  TestGamma(0.9, 2.);
+  TestGamma(1., 1.);
+  TestGamma(4.5, 0.5);
+  TestGamma(150., 1.);
+  TestPoisson(0.5);
+  TestPoisson(6.);
+  TestPoisson(10.);
+  TestPoisson(37.);
+  TestPoisson(500.);
+  TestNormal(0., 1.);
+  TestNormal(-3., 0.2);
+  TestDeterminism();
+  TestIndependence();
+
+  printf("\n%d failure%s\n", num_failures, num_failures == 1 ? "" : "s");
+  if(num_failures > 0) exit(1);
+}
+
+void GetOptions(int argc, char *argv[]){
+  while(true){
+    static struct option long_options[] = {
+      {"draws", required_argument, 0, 'n'}, // Draws per distribution
+      {"seed", required_argument, 0, 's'},  // Seed of the streams under test
+      {0, 0, 0, 0}
+    };
+
+    char opt = -1;
+    int option_index;
+    opt = getopt_long(argc, argv, "n:s:", long_options, &option_index);
+    if(opt == -1) break;
+
+    switch(opt){
+    case 'n':
+      num_draws = atoi(optarg);
+      break;
+    case 's':
+      seed = strtoumax(optarg, nullptr, 10);
+      break;
+    default:
+      printf("Bad option! getopt_long returned character code 0%o\n", opt);
+      break;
+    }
+  }
+}
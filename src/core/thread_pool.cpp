@@ -1,14 +1,37 @@
+/*! \class ThreadPool
+
+  \brief Work-stealing pool of worker threads
+
+  Each worker owns a Chase-Lev deque (Le, Pop, Cohen and Zappa Nardelli, PPoPP
+  2013). Tasks pushed from inside a task go to the bottom of the running
+  worker's deque, which the owner pops without locking. Idle workers steal from
+  the top of the other workers' deques. Tasks pushed from threads outside the
+  pool go through a single mutex-protected queue. Workers only sleep when no
+  task is queued anywhere.
+
+  Push() returns a future for a single task. Related tasks can be collected in
+  a TaskGroup and waited on together, and ParallelFor() splits an index range
+  over the pool. A worker waiting on a group keeps running queued tasks, so
+  groups can be nested inside tasks without tying up threads or deadlocking.
+*/
+
 #include "core/thread_pool.hpp"
 
 #include "TThread.h"
 
 using namespace std;
 
+thread_local ThreadPool * ThreadPool::current_pool_ = nullptr;
+thread_local size_t ThreadPool::current_worker_ = 0;
+
 ThreadPool::ThreadPool():
-  tasks_(),
+  deques_(),
+  injected_(),
   threads_(),
-  stop_thread_now_(),
-  stop_at_empty_(),
+  on_start_(),
+  num_queued_(0),
+  num_sleeping_(0),
+  stop_(false),
   mutex_(),
   cv_(){
   TThread::Initialize();
@@ -18,100 +41,297 @@ ThreadPool::ThreadPool():
   }else{
     num_threads = 1;
   }
-  Resize(num_threads);
+  Start(num_threads);
 }
 
 ThreadPool::ThreadPool(std::size_t num_threads):
-  tasks_(),
+  deques_(),
+  injected_(),
   threads_(),
-  stop_thread_now_(),
-  stop_at_empty_(),
+  on_start_(),
+  num_queued_(0),
+  num_sleeping_(0),
+  stop_(false),
   mutex_(),
   cv_(){
   TThread::Initialize();
-  Resize(num_threads);
+  Start(num_threads);
 }
 
-ThreadPool::~ThreadPool(){
-  stop_at_empty_ = true;
-  {
-    lock_guard<mutex> lock(mutex_);
-    cv_.notify_all();
-  }
+/*!\brief Constructor with per-worker setup, e.g. to pin threads to CPUs
 
-  for(size_t ithread = 0; ithread < Size(); ++ithread){
-    if(threads_.at(ithread)->joinable()){
-      threads_.at(ithread)->join();
-    }
-  }
+  \param[in] num_threads Number of workers
+
+  \param[in] on_start Called by each worker with its index, before it runs any
+  task
+*/
+ThreadPool::ThreadPool(std::size_t num_threads, const function<void(size_t)> &on_start):
+  deques_(),
+  injected_(),
+  threads_(),
+  on_start_(on_start),
+  num_queued_(0),
+  num_sleeping_(0),
+  stop_(false),
+  mutex_(),
+  cv_(){
+  TThread::Initialize();
+  Start(num_threads);
+}
+
+/*!\brief Runs all queued tasks, then joins the workers
+ */
+ThreadPool::~ThreadPool(){
+  Stop();
 }
 
 size_t ThreadPool::Size() const{
   return threads_.size();
 }
 
+/*!\brief Changes the number of workers
+
+  Queued tasks are finished by the current workers before the new ones start.
+  Must not be called from inside a task.
+*/
 void ThreadPool::Resize(size_t num_threads){
-  size_t old_num_threads = Size();
-  if(num_threads > old_num_threads){
-    threads_.resize(num_threads);
-    stop_thread_now_.resize(num_threads);
+  if(num_threads == Size()) return;
+  Stop();
+  Start(num_threads);
+}
 
-    for(size_t ithread = old_num_threads; ithread < num_threads; ++ithread){
-      threads_.at(ithread).reset(new thread(&ThreadPool::DoTasksFromQueue, this, ithread));
-    }
-  }else if(num_threads < old_num_threads){
-    for(size_t ithread = num_threads; ithread < old_num_threads; ++ithread){
-      *stop_thread_now_.at(ithread) = true;
-      threads_.at(ithread)->detach();
-    }
+void ThreadPool::Start(size_t num_threads){
+  if(num_threads == 0) num_threads = 1;
+  stop_ = false;
+  deques_.clear();
+  for(size_t iworker = 0; iworker < num_threads; ++iworker){
+    deques_.emplace_back(new Deque());
+  }
+  for(size_t iworker = 0; iworker < num_threads; ++iworker){
+    threads_.emplace_back(&ThreadPool::Work, this, iworker);
+  }
+}
 
-    {
-      lock_guard<mutex> lock(mutex_);
-      cv_.notify_all();
-    }
+void ThreadPool::Stop(){
+  {
+    lock_guard<mutex> lock(mutex_);
+    stop_ = true;
+    cv_.notify_all();
+  }
+  for(auto &worker: threads_){
+    if(worker.joinable()) worker.join();
+  }
+  threads_.clear();
+}
+
+/*!\brief Queues a task, on the caller's deque if it is a worker of this pool
+ */
+void ThreadPool::Enqueue(Task *task){
+  if(current_pool_ == this){
+    deques_.at(current_worker_)->Push(task);
+  }else{
+    injected_.Push(task);
+  }
+  ++num_queued_;
+  if(num_sleeping_ > 0){
+    lock_guard<mutex> lock(mutex_);
+    cv_.notify_one();
+  }
+}
+
+/*!\brief Takes a task from the caller's deque, the injection queue, or another
+  worker, in that order
 
-    threads_.resize(num_threads);
-    stop_thread_now_.resize(num_threads);
+  \return Task now owned by the caller, or nullptr if none was found
+*/
+ThreadPool::Task * ThreadPool::FindTask(){
+  Task *task = nullptr;
+  bool is_worker = current_pool_ == this;
+  if(is_worker) task = deques_.at(current_worker_)->Take();
+  if(task == nullptr) task = injected_.Pop();
+  for(size_t i = 1; task == nullptr && i <= deques_.size(); ++i){
+    size_t victim = ((is_worker ? current_worker_ : 0)+i)%deques_.size();
+    task = deques_.at(victim)->Steal();
   }
+  if(task != nullptr) --num_queued_;
+  return task;
 }
 
-void ThreadPool::DoTasksFromQueue(size_t ithread){
-  unique_ptr<function<void()> > task = tasks_.Pop();
+void ThreadPool::Work(size_t iworker){
+  current_pool_ = this;
+  current_worker_ = iworker;
+  if(on_start_) on_start_(iworker);
   while(true){
-    while(task != nullptr){
-      (*task)();
-      if(stop_thread_now_.at(ithread)) return;
-      task = tasks_.Pop();
+    Task *task = FindTask();
+    if(task != nullptr){
+      Run(task);
+      continue;
     }
 
     unique_lock<mutex> lock(mutex_);
-    cv_.wait(lock, bind(&ThreadPool::ReadyToAct, this, ithread, ref(task)));
-    if(task == nullptr) return;
+    ++num_sleeping_;
+    cv_.wait(lock, [this](){return num_queued_ > 0 || stop_;});
+    --num_sleeping_;
+    if(stop_ && num_queued_ == 0) break;
+  }
+  current_pool_ = nullptr;
+}
+
+/*!\brief Runs one queued task, or yields if there is none
+ */
+void ThreadPool::Help(){
+  Task *task = FindTask();
+  if(task != nullptr) Run(task);
+  else this_thread::yield();
+}
+
+void ThreadPool::Run(Task *task){
+  unique_ptr<Task> owned(task);
+  (*owned)();
+}
+
+ThreadPool::Deque::Buffer::Buffer(int64_t size):
+  size_(size),
+  tasks_(new atomic<Task*>[size]){
+}
+
+ThreadPool::Deque::Deque():
+  top_(0),
+  bottom_(0),
+  buffer_(nullptr),
+  buffers_(){
+  buffers_.emplace_back(new Buffer(64));
+  buffer_.store(buffers_.back().get(), memory_order_relaxed);
+}
+
+ThreadPool::Deque::~Deque(){
+  Task *task;
+  while((task = Take()) != nullptr) delete task;
+}
+
+/*!\brief Adds a task at the bottom. Owner only.
+ */
+void ThreadPool::Deque::Push(Task *task){
+  int64_t b = bottom_.load(memory_order_relaxed);
+  int64_t t = top_.load(memory_order_acquire);
+  Buffer *buf = buffer_.load(memory_order_relaxed);
+  if(b-t > buf->size_-1){
+    Buffer *bigger = new Buffer(2*buf->size_);
+    for(int64_t i = t; i < b; ++i){
+      bigger->tasks_[i & (bigger->size_-1)].store(buf->tasks_[i & (buf->size_-1)].load(memory_order_relaxed),
+                                                 memory_order_relaxed);
+    }
+    buffers_.emplace_back(bigger);
+    buffer_.store(bigger, memory_order_release);
+    buf = bigger;
   }
+  buf->tasks_[b & (buf->size_-1)].store(task, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  bottom_.store(b+1, memory_order_relaxed);
 }
 
-bool ThreadPool::ReadyToAct(size_t ithread, unique_ptr<function<void()> > &task){
-  if(stop_thread_now_.at(ithread)){
-    return true;
+/*!\brief Removes the newest task. Owner only.
+
+  \return Task, or nullptr if the deque is empty
+*/
+ThreadPool::Task * ThreadPool::Deque::Take(){
+  int64_t b = bottom_.load(memory_order_relaxed)-1;
+  Buffer *buf = buffer_.load(memory_order_relaxed);
+  bottom_.store(b, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  int64_t t = top_.load(memory_order_relaxed);
+  Task *task = nullptr;
+  if(t <= b){
+    task = buf->tasks_[b & (buf->size_-1)].load(memory_order_relaxed);
+    if(t == b){
+      // Last task: race thieves for it
+      if(!top_.compare_exchange_strong(t, t+1, memory_order_seq_cst, memory_order_relaxed)){
+        task = nullptr;
+      }
+      bottom_.store(b+1, memory_order_relaxed);
+    }
   }else{
-    task = tasks_.Pop();
-    return stop_at_empty_ || task != nullptr;
+    bottom_.store(b+1, memory_order_relaxed);
   }
+  return task;
 }
 
-void ThreadPool::Queue::Push(FuncPtr &func){
+/*!\brief Removes the oldest task. Any thread.
+
+  \return Task, or nullptr if the deque is empty or another thread won the race
+*/
+ThreadPool::Task * ThreadPool::Deque::Steal(){
+  int64_t t = top_.load(memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  int64_t b = bottom_.load(memory_order_acquire);
+  if(t >= b) return nullptr;
+  Buffer *buf = buffer_.load(memory_order_acquire);
+  Task *task = buf->tasks_[t & (buf->size_-1)].load(memory_order_relaxed);
+  if(!top_.compare_exchange_strong(t, t+1, memory_order_seq_cst, memory_order_relaxed)){
+    return nullptr;
+  }
+  return task;
+}
+
+void ThreadPool::Queue::Push(Task *task){
   lock_guard<mutex> lock(mutex_);
-  queue_.push(unique_ptr<function<void()> >());
-  queue_.back() = move(func);
+  queue_.push(task);
 }
 
-ThreadPool::Queue::FuncPtr ThreadPool::Queue::Pop(){
+ThreadPool::Task * ThreadPool::Queue::Pop(){
   lock_guard<mutex> lock(mutex_);
   if(queue_.empty()){
-    return FuncPtr();
+    return nullptr;
   }else{
-    Queue::FuncPtr func = move(queue_.front());
+    Task *task = queue_.front();
     queue_.pop();
-    return func;
+    return task;
   }
 }
+
+/*!\class ThreadPool::TaskGroup
+
+  \brief Set of tasks on a ThreadPool that can be waited on together
+*/
+
+ThreadPool::TaskGroup::TaskGroup(ThreadPool &pool):
+  pool_(pool),
+  pending_(0),
+  error_(),
+  mutex_(),
+  cv_(){
+}
+
+/*!\brief Waits for any remaining tasks, discarding their exceptions
+ */
+ThreadPool::TaskGroup::~TaskGroup(){
+  try{
+    Wait();
+  }catch(...){
+  }
+}
+
+/*!\brief Waits until all tasks run so far have finished
+
+  Workers of the pool run other queued tasks while waiting. Rethrows the first
+  exception thrown by a task of the group.
+*/
+void ThreadPool::TaskGroup::Wait(){
+  if(current_pool_ == &pool_){
+    while(pending_ > 0) pool_.Help();
+  }
+  // Also ensures the last Finish() has released mutex_ before the group can be destroyed
+  unique_lock<mutex> lock(mutex_);
+  cv_.wait(lock, [this](){return pending_ == 0;});
+  if(error_ != nullptr){
+    exception_ptr error = error_;
+    error_ = nullptr;
+    rethrow_exception(error);
+  }
+}
+
+void ThreadPool::TaskGroup::Finish(exception_ptr error){
+  lock_guard<mutex> lock(mutex_);
+  if(error != nullptr && error_ == nullptr) error_ = error;
+  if(--pending_ == 0) cv_.notify_all();
+}
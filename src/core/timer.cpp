@@ -2,6 +2,8 @@
 
 #include <cmath>
 
+#include <algorithm>
+
 #include <iostream>
 #include <iomanip>
 
@@ -33,8 +35,11 @@ Timer::Timer(size_t num_iterations,
   label_(),
   start_time_(Clock::now()),
   last_print_(start_time_),
+  last_check_(start_time_),
   iteration_(static_cast<size_t>(-1)),
   num_iterations_(num_iterations),
+  last_check_iteration_(0),
+  check_step_(1),
   auto_print_(auto_print),
   erase_lines_(erase_lines){
   }
@@ -45,8 +50,11 @@ Timer::Timer(size_t num_iterations,
   label_(),
   start_time_(Clock::now()),
   last_print_(start_time_),
+  last_check_(start_time_),
   iteration_(static_cast<size_t>(-1)),
   num_iterations_(num_iterations),
+  last_check_iteration_(0),
+  check_step_(1),
   auto_print_(auto_print),
   erase_lines_(erase_lines){
   }
@@ -58,8 +66,11 @@ Timer::Timer(const string &label,
   label_(label),
   start_time_(Clock::now()),
   last_print_(start_time_),
+  last_check_(start_time_),
   iteration_(static_cast<size_t>(-1)),
   num_iterations_(num_iterations),
+  last_check_iteration_(0),
+  check_step_(1),
   auto_print_(auto_print),
   erase_lines_(erase_lines){
   }
@@ -71,16 +82,41 @@ Timer::Timer(const string &label,
   label_(label),
   start_time_(Clock::now()),
   last_print_(start_time_),
+  last_check_(start_time_),
   iteration_(static_cast<size_t>(-1)),
   num_iterations_(num_iterations),
+  last_check_iteration_(0),
+  check_step_(1),
   auto_print_(auto_print),
   erase_lines_(erase_lines){
   }
 
+/*!\brief Counts one iteration and prints progress if auto_print time has passed
+
+  The clock is only read every check_step_ iterations. The step is adapted to
+  the observed rate so that the clock is read about 100 times per auto_print
+  interval, and at most doubles between reads so a sudden slowdown cannot delay
+  a print by much.
+*/
 void Timer::Iterate(){
   ++iteration_;
-  if(auto_print_.count() >= 0.
-     && chrono::duration<double>(Clock::now() - last_print_) >= auto_print_){
+  if(auto_print_.count() < 0. || iteration_ - last_check_iteration_ < check_step_) return;
+
+  TimeType now = Clock::now();
+  double seconds = chrono::duration<double>(now - last_check_).count();
+  double target = 0.01*auto_print_.count();
+  if(target <= 0.){
+    check_step_ = 1;
+  }else if(seconds > 0.){
+    double step = (iteration_ - last_check_iteration_)*target/seconds;
+    check_step_ = max<size_t>(1, static_cast<size_t>(min(step, 2.*check_step_)));
+  }else{
+    check_step_ *= 2;
+  }
+  last_check_ = now;
+  last_check_iteration_ = iteration_;
+
+  if(chrono::duration<double>(now - last_print_) >= auto_print_){
     if(erase_lines_) clog << "\r\33[2K" << *this;
     else clog << *this << '\n';
   }
@@ -90,13 +126,14 @@ void Timer::Restart(){
   iteration_ = -1;
   start_time_ = Clock::now();
   last_print_ = start_time_;
+  last_check_ = start_time_;
+  last_check_iteration_ = 0;
+  check_step_ = 1;
 }
 
 void Timer::Restart(size_t num_iterations){
   num_iterations_ = num_iterations;
-  iteration_ = -1;
-  start_time_ = Clock::now();
-  last_print_ = start_time_;
+  Restart();
 }
 
 chrono::duration<double> Timer::ElapsedTime() const{
@@ -150,6 +187,8 @@ size_t Timer::Iteration() const{
 
 Timer & Timer::Iteration(size_t iteration){
   iteration_ = iteration;
+  last_check_iteration_ = iteration;
+  check_step_ = 1;
   return *this;
 }
 
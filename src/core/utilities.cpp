@@ -6,9 +6,14 @@
 #include <cmath>
 
 #include <sstream>
+#include <fstream>
 #include <string>
 #include <vector>
 #include <memory>
+#include <unordered_map>
+#include <thread>
+#include <functional>
+#include <chrono>
 
 #include <unistd.h>
 #include <glob.h>
@@ -23,9 +28,32 @@
 #include "TArrow.h"
 #include "RooStats/RooStatsUtils.h"
 
+#include "core/thread_pool.hpp"
+#include "core/random_stream.hpp"
+
 using namespace std;
 
 mutex Multithreading::root_mutex;
+thread_local double Multithreading::lock_wait_seconds = 0.;
+
+/*!\brief Locks a mutex, adding any time spent blocked to lock_wait_seconds
+
+  An uncontended lock costs a single try_lock(). The clock is only read when
+  the mutex is held by another thread.
+
+  \param[in,out] to_lock Mutex to lock
+
+  \return Lock owning to_lock
+*/
+unique_lock<mutex> Multithreading::TimedLock(mutex &to_lock){
+  unique_lock<mutex> lock(to_lock, try_to_lock);
+  if(!lock.owns_lock()){
+    auto start = chrono::steady_clock::now();
+    lock.lock();
+    lock_wait_seconds += chrono::duration<double>(chrono::steady_clock::now()-start).count();
+  }
+  return lock;
+}
 
 set<string> Glob(const string &pattern){
   glob_t glob_result;
@@ -595,38 +623,6 @@ TString RoundNumber(double num, int decimals, double denom){
   return result;
 }
 
-// Code from http://www.hongliangjie.com/2012/12/19/how-to-generate-gamma-random-variables/
-// Parameter b could be theta...
-double gsl_ran_gamma(const double a, const double b, TRandom3 &rand){
-  if (a < 1){
-    double u = rand.Uniform(1);
-    return gsl_ran_gamma(1.0 + a, b, rand) * pow (u, 1.0 / a);
-  }
-
-  double x, v, u;
-  double d = a - 1.0 / 3.0;
-  double c = (1.0 / 3.0) / sqrt (d);
-  
-  while (1) {
-    do {
-      x = rand.Gaus(0, 1.0);
-      v = 1.0 + c * x;
-    }
-    while (v <= 0);
-      
-    v = v * v * v;
-    u = rand.Uniform(1);
-
-    if (u < 1 - 0.0331 * x * x * x * x) 
-      break;
-
-    if (log (u) < 0.5 * x * x + d * (1 - v + log (v)))
-      break;
-  }
-    
-  return b * d * v;
-}
-
 double intGaus(double mean, double sigma, double minX, double maxX){
   return (TMath::Erf((maxX-mean)/sigma/sqrt(2.))-TMath::Erf((minX-mean)/sigma/sqrt(2.)))/2.;
 }
@@ -653,18 +649,18 @@ double Significance(double Nobs, double Nbkg, double Eup_bkg, double Edown_bkg){
     return -999.;
   }
   //if(Nobs==Nbkg) return 0.;
-  TRandom3 rand(1234);
+  RandomStream rng(1234);
   double mu, valG;
   while( (min(Nbelow,Nabove)+Nequal)<Nmin && (Nbelow+Nequal+Nabove)<Nmax){
     // Convolving expected bkg with log-normal
     mu = Nbkg;
-    valG = rand.Gaus(0,1);
+    valG = rng.Normal();
     if(mu==0) mu = fabs(valG)*Eup_bkg; // Apply 2-sided Gaussian uncertainty
     else if(valG>=0) mu *= exp(valG*log(1+Eup_bkg/Nbkg));
     else if(Edown_bkg<0.8*Nbkg) mu *= exp(-valG*log(1-Edown_bkg/Nbkg));
     else mu = max(0., mu + valG*Edown_bkg);
     // Finding if toy above the observed yield
-    double valPois = rand.PoissonD(mu);
+    double valPois = rng.Poisson(mu);
     if(valPois>Nobs) Nabove++;
     else if(valPois==Nobs) Nequal++;
     else Nbelow++;
@@ -683,56 +679,264 @@ double Significance(double Nobs, double Nbkg, double Eup_bkg, double Edown_bkg){
   return RooStats::PValueToSignificance((Nabove+Nequal/2.)/(Nbelow+Nequal+Nabove));
 }
 
+namespace{
+  // Toys are thrown in fixed-size chunks, each with its own stream split off by chunk index,
+  // so the toy values for a given seed do not depend on how many threads run the chunks
+  const int kappa_chunk = 4096;
+
+  // Fills kappas[begin, end). Samples of all observables are flattened into alpha/weight, with the
+  // samples of observable obs in [offset[obs], offset[obs+1]). Toys with 0/0 are set to NaN
+  void KappaToys(const vector<double> &alpha, const vector<double> &weight,
+                 const vector<size_t> &offset, const vector<float> &data_yield,
+                 const vector<float> &powers, bool do_data, double syst, double bignum,
+                 size_t ichunk, int begin, int end, vector<float> &kappas){
+    RandomStream rng = RandomStream(1234).Split(ichunk);
+    size_t ntoys = end-begin;
+    vector<double> kappa(ntoys, 1.), observed(ntoys), draws(ntoys);
+    vector<char> denom_is0(ntoys, false);
+    for(size_t obs = 0; obs < powers.size(); ++obs){
+      // With a flat prior, the expected average of the Poisson with N observed is Gamma(N+1,1)
+      if(do_data){
+        rng.Gamma(observed, data_yield[obs]+1.);
+      }else{
+        fill(observed.begin(), observed.end(), 0.);
+        for(size_t i = offset[obs]; i < offset[obs+1]; ++i){
+          rng.Gamma(draws, alpha[i]);
+          for(size_t toy = 0; toy < ntoys; ++toy) observed[toy] += draws[toy]*weight[i];
+        }
+      }
+      for(size_t toy = 0; toy < ntoys; ++toy){
+        if(observed[toy] <= 0 && powers[obs] < 0) denom_is0[toy] = true;
+        else kappa[toy] *= pow(observed[toy], powers[obs]);
+      }
+    }
+    if(syst>=0){
+      rng.Normal(draws, 0., log(1+syst));
+      for(size_t toy = 0; toy < ntoys; ++toy) kappa[toy] *= exp(draws[toy]);
+    }
+    for(size_t toy = 0; toy < ntoys; ++toy){
+      if(denom_is0[toy]) kappas[begin+toy] = kappa[toy]==0 ? numeric_limits<float>::quiet_NaN() : bignum;
+      else kappas[begin+toy] = kappa[toy];
+    }
+  }
+}
+
+namespace{
+  // Process-wide cache of calcKappa results, keyed by the exact bytes of the inputs, so identical
+  // kappas requested by several tables, plots or scenarios only throw their toys once
+  class KappaCache{
+  public:
+    // Bump whenever calcKappa, its toys or its random numbers change, so older results on disk are not reused
+    static const int version_ = 2;
+    struct Result{
+      float stdval, mSigma, pSigma;
+    };
+
+    KappaCache():
+      results_(),
+      path_(),
+      num_new_(0),
+      hits_(0),
+      misses_(0),
+      mutex_(){
+    }
+
+    ~KappaCache(){
+      Save();
+      if(hits_ + misses_ > 0){
+        cout << "calcKappa cache: " << hits_ << " hits, " << misses_ << " misses";
+        if(path_ != "") cout << ", " << results_.size() << " entries in " << path_;
+        cout << endl;
+      }
+    }
+
+    static string Key(const vector<vector<float> > &entries, const vector<vector<float> > &weights,
+                      const vector<float> &powers, bool do_data, double syst, int nrep){
+      string key;
+      auto add = [&key](const void *data, size_t size){
+        key.append(static_cast<const char*>(data), size);
+      };
+      add(&nrep, sizeof(nrep));
+      add(&do_data, sizeof(do_data));
+      add(&syst, sizeof(syst));
+      for(size_t obs = 0; obs < powers.size(); ++obs){
+        size_t nsam = entries[obs].size();
+        add(&powers[obs], sizeof(powers[obs]));
+        add(&nsam, sizeof(nsam));
+        add(entries[obs].data(), nsam*sizeof(float));
+        add(weights[obs].data(), nsam*sizeof(float));
+      }
+      return key;
+    }
+
+    bool Get(const string &key, Result &result){
+      lock_guard<mutex> lock(mutex_);
+      auto found = results_.find(key);
+      if(found == results_.end()){
+        ++misses_;
+        return false;
+      }
+      ++hits_;
+      result = found->second;
+      return true;
+    }
+
+    void Put(const string &key, const Result &result){
+      lock_guard<mutex> lock(mutex_);
+      if(results_.emplace(key, result).second) ++num_new_;
+    }
+
+    void SetFile(const string &path){
+      lock_guard<mutex> lock(mutex_);
+      path_ = path;
+      Load();
+    }
+
+  private:
+    static string Header(){
+      return "calcKappa_cache "+to_string(version_)+" "+to_string(kappa_chunk);
+    }
+
+    // Adds the entries in path_ not already known. Files written by another version are ignored,
+    // and unreadable lines are skipped rather than ending the load.
+    void Load(){
+      ifstream file(path_);
+      string line;
+      if(!getline(file, line) || line != Header()) return;
+      while(getline(file, line)){
+        vector<string> fields = Tokenize(line, " ");
+        if(fields.size() != 4 || fields[0].size()%2 != 0
+           || fields[0].find_first_not_of("0123456789abcdef") != string::npos) continue;
+        float values[3];
+        bool good = true;
+        for(size_t i = 0; i < 3 && good; ++i){
+          char *end = nullptr;
+          values[i] = strtof(fields[i+1].c_str(), &end);
+          good = end != fields[i+1].c_str() && *end == '\0';
+        }
+        if(!good) continue;
+        string key;
+        for(size_t i = 0; i < fields[0].size(); i += 2){
+          key.push_back(static_cast<char>(stoi(fields[0].substr(i, 2), nullptr, 16)));
+        }
+        results_.emplace(key, Result{values[0], values[1], values[2]});
+      }
+    }
+
+    // Merges entries saved by other jobs since the file was loaded, then replaces the file
+    // atomically, so jobs sharing a cache file never truncate or interleave it
+    void Save(){
+      lock_guard<mutex> lock(mutex_);
+      if(path_ == "" || num_new_ == 0) return;
+      Load();
+      string tmp_path = path_+"."+to_string(getpid());
+      ofstream file(tmp_path);
+      if(!file) return;
+      file << Header() << '\n';
+      file << setprecision(numeric_limits<float>::max_digits10);
+      for(const auto &entry: results_){
+        file << hex << setfill('0');
+        for(unsigned char c: entry.first) file << setw(2) << static_cast<unsigned>(c);
+        file << dec << ' ' << entry.second.stdval << ' ' << entry.second.mSigma
+             << ' ' << entry.second.pSigma << '\n';
+      }
+      file.close();
+      if(!file || rename(tmp_path.c_str(), path_.c_str()) != 0){
+        DBG("Could not write calcKappa cache " << path_);
+        remove(tmp_path.c_str());
+      }
+      num_new_ = 0;
+    }
+
+    unordered_map<string, Result> results_;
+    string path_;
+    size_t num_new_, hits_, misses_;
+    mutex mutex_;
+  };
+
+  KappaCache & GetKappaCache(){
+    static KappaCache cache;
+    return cache;
+  }
+
+  // Workers for the kappa toys, started on the first call and shared by all later ones
+  ThreadPool & GetKappaPool(){
+    static ThreadPool pool(max(thread::hardware_concurrency(), 1u));
+    return pool;
+  }
+}
+
+void SetKappaCacheFile(const string &path){
+  GetKappaCache().SetFile(path);
+}
+
 // yields[Nobs][Nsam] has the entries for each sample for each observable going into kappa
 // weights[Nobs][Nsam] has the average weight of each observable for each sample
 // powers[Nobs] defines kappa = Product_obs{ Sum_sam{yields[sam][obs]*weights[sam][obs]}^powers[obs] }
 double calcKappa(vector<vector<float> > &entries, vector<vector<float> > &weights,
                  vector<float> &powers, float &mSigma, float &pSigma, bool do_data,
                  bool verbose, double syst, bool do_plot, int nrep){
-  TRandom3 rand(1234);
-  int nbadk(0);
-  vector<float> fKappas;
+  // Plots and verbose printout need the toys, so only quiet calls are served from the cache
+  KappaCache &cache = GetKappaCache();
+  string cache_key = KappaCache::Key(entries, weights, powers, do_data, syst, nrep);
+  KappaCache::Result cached;
+  if(!do_plot && !verbose && cache.Get(cache_key, cached)){
+    mSigma = cached.mSigma;
+    pSigma = cached.pSigma;
+    return cached.stdval;
+  }
+
   double mean(0.), bignum(1e10);
-  // Doing kappa variations
-  for(int rep(0), irep(0); rep < nrep; rep++) {
-    fKappas.push_back(1.);
-    bool Denom_is0(false);
-    for(unsigned obs(0); obs < powers.size(); obs++) {
-      float observed(0.);
-      for(unsigned sam(0); sam < entries[obs].size(); sam++) {
-        // With a flat prior, the expected average of the Poisson with N observed is Gamma(N+1,1)
-        // Rounding the expected yield for data stats
-        if(do_data) observed += entries[obs][sam]*weights[obs][sam];
-        else observed += gsl_ran_gamma(entries[obs][sam]+1,1,rand)*weights[obs][sam];
-      } // Loop over samples
-      //if(do_data) observed = gsl_ran_gamma(static_cast<int>(0.5+observed)+1,1,rand);
-      if(do_data) observed = gsl_ran_gamma(observed+1,1,rand);
-      if(observed <= 0 && powers[obs] < 0) Denom_is0 = true;
-      else fKappas[irep] *= pow(observed, powers[obs]);
-    } // Loop over number of observables going into kappa
 
-    if(syst>=0){
-      double factor = exp(rand.Gaus(0,log(1+syst)));
-      fKappas[irep] *= factor;
+  // Flattening samples so the toy loop walks contiguous arrays
+  vector<double> alpha, weight;
+  vector<size_t> offset(1, 0);
+  vector<float> data_yield(powers.size(), 0.);
+  for(unsigned obs(0); obs < powers.size(); obs++) {
+    for(unsigned sam(0); sam < entries[obs].size(); sam++) {
+      alpha.push_back(entries[obs][sam]+1.);
+      weight.push_back(weights[obs][sam]);
+      data_yield[obs] += entries[obs][sam]*weights[obs][sam];
     }
-    if(Denom_is0 && fKappas[irep]==0) {
-      fKappas.pop_back();
+    offset.push_back(alpha.size());
+  }
+
+  // Doing kappa variations
+  vector<float> fKappas(max(nrep, 0));
+  size_t nchunks = (fKappas.size()+kappa_chunk-1)/kappa_chunk;
+  auto run_chunk = [&](size_t ichunk){
+    KappaToys(alpha, weight, offset, data_yield, powers, do_data, syst, bignum,
+              ichunk, ichunk*kappa_chunk, min<int>((ichunk+1)*kappa_chunk, nrep), fKappas);
+  };
+  if(nchunks <= 1 || thread::hardware_concurrency() <= 1){
+    for(size_t ichunk = 0; ichunk < nchunks; ++ichunk) run_chunk(ichunk);
+  }else{
+    GetKappaPool().ParallelFor(0, nchunks, run_chunk, 1);
+  }
+
+  // Dropping 0/0 toys, keeping the order so the result is independent of the thread count
+  int nbadk(0);
+  size_t ngood(0);
+  for(size_t rep = 0; rep < fKappas.size(); ++rep){
+    if(std::isnan(fKappas[rep])){
       nbadk++;
-    }else {
-      if(Denom_is0) fKappas[irep] = bignum;
-      else mean += fKappas[irep];
-      irep++;
+      continue;
     }
-  } // Loop over fluctuations of kappa (repetitions)
+    if(fKappas[rep] != bignum) mean += fKappas[rep];
+    fKappas[ngood++] = fKappas[rep];
+  }
+  fKappas.resize(ngood);
   int ntot(nrep-nbadk);
   mean /= static_cast<double>(ntot);
 
-  sort(fKappas.begin(), fKappas.end());
+  // Only a few order statistics are needed, so they are selected rather than fully sorted.
+  // Each selection partitions fKappas, and later ones are restricted to the matching side
   double gSigma = intGaus(0,1,0,1);
   int iMedian((nrep-nbadk+1)/2-1);
   int imSigma(iMedian-static_cast<int>(gSigma*ntot)), ipSigma(iMedian+static_cast<int>(gSigma*ntot));
+  vector<float>::iterator kbegin(fKappas.begin()), kend(fKappas.end());
+  nth_element(kbegin, kbegin+iMedian, kend);
   float median(fKappas[iMedian]);
-  mSigma = median-fKappas[imSigma]; pSigma = fKappas[ipSigma]-median;
 
   // Finding standard value
   float stdval(1.);
@@ -750,11 +954,15 @@ double calcKappa(vector<vector<float> > &entries, vector<vector<float> > &weight
     if(stdyield <= 0 && powers[obs] < 0) infStd = true;
     else stdval *= pow(stdyield, powers[obs]);
   } // Loop over number of observables going into kappa
-  if(infStd) stdval = median;
-  else {
-    int istd(0);
-    for(int rep(0); rep < ntot; rep++) 
-      if(fKappas[rep]>stdval) {istd = rep; break;}
+  if(infStd) {
+    stdval = median;
+    if(imSigma < iMedian) nth_element(kbegin, kbegin+imSigma, kbegin+iMedian);
+    if(ipSigma > iMedian) nth_element(kbegin+iMedian+1, kbegin+ipSigma, kend);
+    mSigma = median-fKappas[imSigma]; pSigma = fKappas[ipSigma]-median;
+  } else {
+    // Rank of the first toy above the standard value (0 if there is none)
+    int istd(count_if(kbegin, kend, [stdval](float kappa){return kappa <= stdval;}));
+    if(istd == ntot) istd = 0;
     imSigma = istd-static_cast<int>(gSigma*ntot);
     ipSigma = istd+static_cast<int>(gSigma*ntot);
     if(imSigma<0){ // Adjusting the length of the interval in case imSigma has less than 1sigma
@@ -765,16 +973,20 @@ double calcKappa(vector<vector<float> > &entries, vector<vector<float> > &weight
       imSigma -= (ipSigma-ntot+1);
       ipSigma = ntot-1;
     }
+    nth_element(kbegin, kbegin+ipSigma, kend);
+    nth_element(kbegin, kbegin+imSigma, kbegin+ipSigma);
     mSigma = fabs(stdval-fKappas[imSigma]); pSigma = fKappas[ipSigma]-stdval;
   }
-  
-  gStyle->SetOptStat(0);              // No Stats box
-  TCanvas can;
-  can.SetMargin(0.15, 0.05, 0.12, 0.11);
+
+  // The histogram is only needed for the plot and for the mode printed in verbose mode
+  cache.Put(cache_key, KappaCache::Result{stdval, mSigma, pSigma});
+  if(!do_plot && !verbose) return stdval;
+
   int nbins(100);
   double minH(stdval-3*fabs(mSigma)), maxH(stdval+3*pSigma);
-  if(minH < fKappas[0]) minH = fKappas[0];
-  if(maxH > fKappas[ntot-1]) maxH = fKappas[ntot-1];
+  auto kminmax = minmax_element(kbegin, kend);
+  if(minH < *kminmax.first) minH = *kminmax.first;
+  if(maxH > *kminmax.second) maxH = *kminmax.second;
   TH1D histo("h","",nbins, minH, maxH);
   TH1D herr("herr","",nbins, minH, maxH);
   for(int rep(0); rep < ntot; rep++) {
@@ -788,6 +1000,9 @@ double calcKappa(vector<vector<float> > &entries, vector<vector<float> > &weight
   //histo.SetBinContent(1, histo.GetBinContent(1)+nbadk);
   //histo.SetBinContent(nbins, histo.GetBinContent(nbins)+histo.GetBinContent(nbins+1));
   if(do_plot) {
+    gStyle->SetOptStat(0);              // No Stats box
+    TCanvas can;
+    can.SetMargin(0.15, 0.05, 0.12, 0.11);
     herr.SetLineColor(0);
     herr.SetFillColor(kGray);
     histo.SetTitleOffset(1.1, "X");
@@ -9,6 +9,8 @@
 #include <algorithm>
 #include <initializer_list>
 #include <stdexcept>
+#include <map>
+#include <memory>
 
 #include <getopt.h>
 
@@ -21,6 +23,7 @@
 #include "TH2D.h"
 #include "TStyle.h"
 #include "TLatex.h"
+#include "TMatrixDSym.h"
 
 #include "RooArgList.h"
 #include "RooArgSet.h"
@@ -38,6 +41,85 @@ namespace{
   bool r4_only(true);
 }
 
+namespace{
+  // Dense copy of the fit correlation matrix, indexed like floatParsFinal() and stored row-major.
+  // RooFitResult::correlation(name, name) searches the parameter list by name on every call, which
+  // dominates the error propagation for fits with many parameters. Callers build it once per sweep
+  vector<double> Correlations(const RooFitResult &f){
+    const TMatrixDSym &corr = f.correlationMatrix();
+    size_t npars = f.floatParsFinal().getSize();
+    vector<double> dense(npars*npars);
+    for(size_t i = 0; i < npars; ++i){
+      for(size_t j = 0; j < npars; ++j){
+        dense[i*npars+j] = corr(i, j);
+      }
+    }
+    return dense;
+  }
+
+  // Computes g^T C g for the symmetric matrix C restricted to the parameters in idx
+  double QuadraticForm(const vector<double> &corr, size_t npars,
+                       const vector<int> &idx, const vector<double> &g){
+    double sum = 0.;
+    for(size_t i = 0; i < g.size(); ++i){
+      if(g[i] == 0.) continue;
+      const double *row = &corr[idx[i]*npars];
+      double off_diag = 0.;
+      for(size_t j = 0; j < i; ++j){
+        off_diag += row[idx[j]]*g[j];
+      }
+      sum += g[i]*(row[idx[i]]*g[i]+2.*off_diag);
+    }
+    return sum;
+  }
+
+  // First function in the workspace with the given prefix for bin_name, as found by GetMCTotalErr and
+  // friends, or nullptr if there is none
+  const RooAbsReal * FindBinFunction(const RooWorkspace &w, const string &prefix, const string &bin_name){
+    TIter iter(w.allFunctions().createIterator());
+    int size = w.allFunctions().getSize();
+    RooAbsArg *arg = nullptr;
+    int i = 0;
+    while((arg = static_cast<RooAbsArg*>(iter())) && i < size){
+      ++i;
+      if(arg == nullptr) continue;
+      string name = arg->GetName();
+      if(name.substr(0,prefix.size()) != prefix) continue;
+      if(!(Contains(name, "_BIN_"+bin_name))) continue;
+      if(Contains(name, "_PRC_")) continue;
+      return static_cast<RooAbsReal*>(arg);
+    }
+    return nullptr;
+  }
+
+  // Errors of the functions with the given prefixes in each bin, keyed by prefix+bin_name and
+  // computed together in one sweep over the fit parameters
+  map<string, double> GetBinErrors(RooWorkspace &w, const RooFitResult &f,
+                                   const vector<string> &bin_names, const vector<string> &prefixes,
+                                   int errtype = 0){
+    vector<string> keys;
+    vector<const RooAbsReal*> funcs;
+    for(const auto &bin_name: bin_names){
+      for(const auto &prefix: prefixes){
+        const RooAbsReal *func = FindBinFunction(w, prefix, bin_name);
+        if(func == nullptr) continue;
+        keys.push_back(prefix+bin_name);
+        funcs.push_back(func);
+      }
+    }
+    vector<double> errors = GetErrors(funcs, f, errtype);
+    map<string, double> bin_errors;
+    for(size_t i = 0; i < keys.size(); ++i) bin_errors[keys.at(i)] = errors.at(i);
+    return bin_errors;
+  }
+
+  // Error looked up in the output of GetBinErrors; -1 if the bin has no such function, like GetMCTotalErr
+  double BinError(const map<string, double> &errors, const string &prefix, const string &bin_name){
+    auto found = errors.find(prefix+bin_name);
+    return found == errors.end() ? -1. : found->second;
+  }
+}
+
 int main(int argc, char *argv[]){
   GetOptionsExtract(argc, argv);
 
@@ -183,6 +265,14 @@ void PrintTable(RooWorkspace &w,
     digits = 1;
   }
 
+  // The table's errors, from one sweep over the fit parameters per error type instead of one per entry
+  vector<string> prefixes;
+  if(!table_clean) prefixes.insert(prefixes.end(), {"ymc_BLK_", "kappamc_BLK_"});
+  if(dosig) prefixes.insert(prefixes.end(), {"nbkg_BLK_", "nsig_BLK_"});
+  map<string, double> errors = GetBinErrors(w, f, bin_names, prefixes);
+  map<string, double> errors_hi = GetBinErrors(w, f, bin_names, {"nexp_BLK_"}, 1);
+  map<string, double> errors_lo = GetBinErrors(w, f, bin_names, {"nexp_BLK_"}, -1);
+
   ofstream out(file_name);
   out << fixed << setprecision(digits);
   out << "\\documentclass{article}\n";
@@ -233,20 +323,20 @@ void PrintTable(RooWorkspace &w,
       out << GetMCYield(w, bin_name, prc_name) << " & ";
     }
     out << "$" << GetMCTotal(w, bin_name);
-    if(!table_clean) out << "\\pm" << GetMCTotalErr(w, f, bin_name);
+    if(!table_clean) out << "\\pm" << BinError(errors, "ymc_BLK_", bin_name);
     out <<  "$ & ";
 
-    if(dosig) out << "$" << GetBkgPred(w, bin_name) << "\\pm" << GetBkgPredErr(w, f, bin_name) <<  "$ & ";
+    if(dosig) out << "$" << GetBkgPred(w, bin_name) << "\\pm" << BinError(errors, "nbkg_BLK_", bin_name) <<  "$ & ";
     out << GetMCYield(w, bin_name, sig_name) << " & ";
-    if(dosig) out << "$" << GetSigPred(w, bin_name) << "\\pm" << GetSigPredErr(w, f, bin_name) <<  "$ & ";
+    if(dosig) out << "$" << GetSigPred(w, bin_name) << "\\pm" << BinError(errors, "nsig_BLK_", bin_name) <<  "$ & ";
     if(!Contains(file_wspace, "nor4") || (Contains(bin_name, "hig_3b")||Contains(bin_name, "hig_4b")))
-      out << "$" << GetTotPred(w, bin_name) << "^{+" << GetTotPredErr(w, f, bin_name,1) 
-	  <<"}_{-"<< GetTotPredErr(w, f, bin_name,-1) <<  "}$";
+      out << "$" << GetTotPred(w, bin_name) << "^{+" << BinError(errors_hi, "nexp_BLK_", bin_name) 
+	  <<"}_{-"<< BinError(errors_lo, "nexp_BLK_", bin_name) <<  "}$";
     out<<" & ";
     if(Contains(bin_name,"4") && (blind_all || (!Contains(bin_name,"1b") && blind_2b))) out << "-- & ";
     else out << setprecision(0) << GetObserved(w, bin_name);
     out << setprecision(digits);
-    if(!table_clean) out << "& $" << GetLambda(w, bin_name) << "\\pm" << GetLambdaErr(w, f, bin_name) <<  "$";
+    if(!table_clean) out << "& $" << GetLambda(w, bin_name) << "\\pm" << BinError(errors, "kappamc_BLK_", bin_name) <<  "$";
     out << "\\\\\n";
     if(Contains(bin_name, "r3") || Contains(bin_name, "d3")) out << "\\hline"<<endl;
   }
@@ -1088,13 +1178,14 @@ void MakeCovarianceMatrix(RooWorkspace &w,
     rrv2.setVal(cenVal);
   }
 
+  vector<double> corr = Correlations(f);
+  size_t npars = fpf.getSize();
   vector<vector<double> > right(fpf.getSize(), vector<double>(yields.size(), 0.));
   for(Int_t iparam = 0; iparam<fpf.getSize(); ++iparam){
     for(size_t iyield = 0; iyield<yields.size(); ++iyield){
       right.at(iparam).at(iyield) = 0.;
       for(Int_t entry = 0; entry<fpf.getSize(); ++entry){
-	right.at(iparam).at(iyield) += f.correlation(fpf.at(iparam)->GetName(),fpf.at(entry)->GetName())
-	  * errors.at(entry).at(iyield);
+	right.at(iparam).at(iyield) += corr[iparam*npars+entry] * errors.at(entry).at(iyield);
       }
     }
   }
@@ -1262,27 +1353,41 @@ string PrettyBinName(string name){
 
 double GetError(const RooAbsReal &var,
                 const RooFitResult &f, int errtype){
-  // Clone self for internal use
-  RooAbsReal* cloneFunc = static_cast<RooAbsReal*>(var.cloneTree());
-  RooArgSet* errorParams = cloneFunc->getObservables(f.floatParsFinal());
-  RooArgSet* nset = cloneFunc->getParameters(*errorParams);
+  return GetErrors(vector<const RooAbsReal*>{&var}, f, errtype).front();
+}
 
-  // Make list of parameter instances of cloneFunc in order of error matrix
-  RooArgList paramList;
+vector<double> GetErrors(const vector<const RooAbsReal*> &vars,
+                         const RooFitResult &f, int errtype){
+  // Clone all functions together, so parameters and subexpressions they share are cloned once
+  RooArgList originals;
+  for(const auto &var: vars){
+    if(originals.find(var->GetName()) == nullptr) originals.add(*var);
+  }
+  unique_ptr<RooAbsCollection> clones(originals.snapshot(kTRUE));
   const RooArgList& fpf = f.floatParsFinal();
-  vector<int> fpf_idx;
-  for (int i=0; i<fpf.getSize(); i++) {
-    RooAbsArg* par = errorParams->find(fpf[i].GetName());
-    if (par) {
-      paramList.add(*par);
-      fpf_idx.push_back(i);
+  size_t npars = fpf.getSize();
+
+  // Functions depending on each fit parameter, and the normalization set of each function
+  vector<RooAbsReal*> funcs(vars.size());
+  vector<unique_ptr<RooArgSet> > nsets(vars.size());
+  vector<vector<size_t> > users(npars);
+  for(size_t ivar = 0; ivar < vars.size(); ++ivar){
+    funcs.at(ivar) = static_cast<RooAbsReal*>(clones->find(vars.at(ivar)->GetName()));
+    unique_ptr<RooArgSet> errorParams(funcs.at(ivar)->getObservables(fpf));
+    nsets.at(ivar).reset(funcs.at(ivar)->getParameters(*errorParams));
+    for(size_t ipar = 0; ipar < npars; ++ipar){
+      if(errorParams->find(fpf[ipar].GetName()) != nullptr) users.at(ipar).push_back(ivar);
     }
   }
 
-  string name = var.GetName();
-  vector<double> errors(paramList.getSize());
-  for (Int_t ivar=0; ivar<paramList.getSize(); ivar++) {
-    RooRealVar& rrv = static_cast<RooRealVar&>(fpf[fpf_idx[ivar]]);
+  // One sweep over the parameters fills the derivative vector of every function
+  vector<vector<double> > derivs(vars.size());
+  vector<vector<int> > fpf_idx(vars.size());
+  for(size_t ipar = 0; ipar < npars; ++ipar){
+    if(users.at(ipar).size() == 0) continue;
+    const RooRealVar& rrv = static_cast<const RooRealVar&>(fpf[ipar]);
+    RooRealVar *par = static_cast<RooRealVar*>(clones->find(rrv.GetName()));
+    if(par == nullptr) continue;
 
     double cenVal = rrv.getVal();
     double errVal = rrv.getError();
@@ -1290,65 +1395,32 @@ double GetError(const RooAbsReal &var,
     if(errtype ==-1) errVal = rrv.getErrorLo();
 
     // Make Plus variation
-    if(errtype==1) static_cast<RooRealVar*>(paramList.at(ivar))->setVal(cenVal+errVal);
-    else if(errtype==-1) static_cast<RooRealVar*>(paramList.at(ivar))->setVal(cenVal);
-    else static_cast<RooRealVar*>(paramList.at(ivar))->setVal(cenVal+0.5*errVal);
-    double up = cloneFunc->getVal(nset);
+    if(errtype==1) par->setVal(cenVal+errVal);
+    else if(errtype==-1) par->setVal(cenVal);
+    else par->setVal(cenVal+0.5*errVal);
+    vector<double> up;
+    for(const auto ivar: users.at(ipar)) up.push_back(funcs.at(ivar)->getVal(nsets.at(ivar).get()));
 
     // Make Minus variation
-    if(errtype==1) static_cast<RooRealVar*>(paramList.at(ivar))->setVal(cenVal);
-    else if(errtype==-1) static_cast<RooRealVar*>(paramList.at(ivar))->setVal(cenVal+errVal);
-    else static_cast<RooRealVar*>(paramList.at(ivar))->setVal(cenVal-0.5*errVal);
-    double down = cloneFunc->getVal(nset);
-
-    // string parname = rrv.GetName();
-    // if(Contains(parname, "rx21_BLK_met3") || Contains(parname, "rx31_BLK_met3")){
-    //   cout<<name<<" "<<ivar<<" - "<<parname<<": cenVal "<<setw(12)<<cenVal<<", errVal "<<setw(12)<<errVal
-    // 	  <<", up "<<setw(12)<<up<<", down "<<setw(12)<<down<<", errtype "<<setw(12)<<errtype<<endl;
-    // }
-
-    errors.at(ivar) = (up-down);
-
-    static_cast<RooRealVar*>(paramList.at(ivar))->setVal(cenVal);
-  }
-  // cout<<endl;
-
-  // bool print_corr = false;
-  // if(name.substr(0,9) == "nexp_BLK_" && Contains(name, "_BIN_hig_4b_met") && !Contains(name, "_PRC_")){
-  //      cout<<"Doing hig_4b_met3 = "<<var.getVal() <<endl;
-  //      print_corr = true;
-  // }
-  vector<double> right(errors.size());
-  for(size_t i = 0; i < right.size(); ++i){
-    right.at(i) = 0.;
-    for(size_t j = 0; j < errors.size(); ++j){
-      right.at(i) += f.correlation(paramList.at(i)->GetName(),paramList.at(j)->GetName())*errors.at(j);
-      // string par1 = paramList.at(i)->GetName(), par2 = paramList.at(j)->GetName();
-      // if(print_corr && (Contains(par1, "rx") || Contains(par1, "ry") || Contains(par1, "norm"))
-      // 	 && (Contains(par2, "rx") || Contains(par2, "ry") || Contains(par2, "norm"))) 
-      // 	cout<<setw(40)<<par1<<", "<<setw(40)<<par2<<": corr = "
-      // 	    <<f.correlation(paramList.at(i)->GetName(),paramList.at(j)->GetName())<<endl;
+    if(errtype==1) par->setVal(cenVal);
+    else if(errtype==-1) par->setVal(cenVal+errVal);
+    else par->setVal(cenVal-0.5*errVal);
+    for(size_t iuser = 0; iuser < users.at(ipar).size(); ++iuser){
+      size_t ivar = users.at(ipar).at(iuser);
+      double down = funcs.at(ivar)->getVal(nsets.at(ivar).get());
+      derivs.at(ivar).push_back(up.at(iuser)-down);
+      fpf_idx.at(ivar).push_back(static_cast<int>(ipar));
     }
-  }
-  double sum = 0.;
-  for(size_t i = 0; i < right.size(); ++i){
-    sum += errors.at(i)*right.at(i);
-  }
 
-  if(cloneFunc != nullptr){
-    delete cloneFunc;
-    cloneFunc = nullptr;
-  }
-  if(errorParams != nullptr){
-    delete errorParams;
-    errorParams = nullptr;
-  }
-  if(nset != nullptr){
-    delete nset;
-    nset = nullptr;
+    par->setVal(cenVal);
   }
 
-  return sqrt(sum);
+  vector<double> corr = Correlations(f);
+  vector<double> errors(vars.size());
+  for(size_t ivar = 0; ivar < vars.size(); ++ivar){
+    errors.at(ivar) = sqrt(QuadraticForm(corr, npars, fpf_idx.at(ivar), derivs.at(ivar)));
+  }
+  return errors;
 }
 
 void GetOptionsExtract(int argc, char *argv[]){
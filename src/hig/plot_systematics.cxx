@@ -71,6 +71,7 @@ namespace{
   TString mc_lumi = "";
   string sys_wgts_file = "txt/sys_weights.cfg";
   string mm_scen = "";
+  string kappa_cache = "";
   float lumi=35.9;
   bool quick_test = false;
   // for office use only
@@ -101,6 +102,7 @@ void GetOptions(int argc, char *argv[]);
 int main(int argc, char *argv[]){
   gErrorIgnoreLevel=6000; // Turns off ROOT errors due to missing branches
   GetOptions(argc, argv);
+  if(kappa_cache != "") SetKappaCacheFile(kappa_cache);
 
   chrono::high_resolution_clock::time_point begTime;
   begTime = chrono::high_resolution_clock::now();
@@ -1302,6 +1304,7 @@ void GetOptions(int argc, char *argv[]){
       {"ht", no_argument, 0, 0},              // Cuts on ht>500 instead of st>500
       {"mm", required_argument, 0, 0},        // Mismeasurment scenario, 0 for data
       {"quick", no_argument, 0, 0},           // Used inclusive ttbar for quick testing
+      {"kappa_cache", required_argument, 0, 0}, // File keeping kappa toy results across runs
       {"rewgt", no_argument, 0, 0},           // Used inclusive ttbar for quick testing
       {"no_trim", no_argument, 0, 0},         // No trimming of sideband
       {"zbi", no_argument, 0, 0},             // Use Zbi instead of toys
@@ -1371,6 +1374,8 @@ void GetOptions(int argc, char *argv[]){
         mm_scen = optarg;
       }else if(optname == "digits"){
 	digits_table = atoi(optarg);
+      }else if(optname == "kappa_cache"){
+        kappa_cache = optarg;
       }else if(optname == "quick"){
         quick_test = true;
       }else if(optname == "rewgt"){
@@ -17,6 +17,7 @@
 
 #include "core/named_func.hpp"
 #include "core/baby_full.hpp"
+#include "core/pu_accumulator.hpp"
 #include "core/utilities.hpp"
 
 using namespace std;
@@ -28,10 +29,6 @@ namespace {
   TString syst = "all";
 
   const vector<double> v_data_npv{6.540e-06, 2.294e-05, 6.322e-05, 8.558e-05, 1.226e-04, 1.642e-04, 1.917e-04, 3.531e-04, 9.657e-04, 2.155e-03, 4.846e-03, 9.862e-03, 1.651e-02, 2.401e-02, 3.217e-02, 4.078e-02, 4.818e-02, 5.324e-02, 5.612e-02, 5.756e-02, 5.841e-02, 5.886e-02, 5.831e-02, 5.649e-02, 5.376e-02, 5.044e-02, 4.667e-02, 4.257e-02, 3.833e-02, 3.406e-02, 2.982e-02, 2.567e-02, 2.169e-02, 1.799e-02, 1.464e-02, 1.170e-02, 9.178e-03, 7.058e-03, 5.306e-03, 3.884e-03, 2.757e-03, 1.890e-03, 1.247e-03, 7.901e-04, 4.795e-04, 2.783e-04, 1.544e-04, 8.181e-05, 4.141e-05, 2.004e-05, 9.307e-06, 4.178e-06, 1.846e-06, 8.350e-07, 4.150e-07, 2.458e-07, 1.779e-07, 1.488e-07, 1.339e-07, 1.238e-07, 1.153e-07, 1.071e-07, 9.899e-08, 9.095e-08, 8.301e-08, 7.527e-08, 6.778e-08, 6.063e-08, 5.387e-08, 4.753e-08, 4.166e-08, 3.627e-08, 3.136e-08, 2.693e-08, 2.297e-08};
-  TH1D h_data_npv("h_data_npv", "Data;N_{PV};P(N_{PV})", v_data_npv.size(), -0.5, v_data_npv.size()-0.5);
-  TH1D h_mc_npv("h_mc_npv", "MC;N_{PV};P(N_{PV})", v_data_npv.size(), -0.5, v_data_npv.size()-0.5);
-  double pu_low = 0.;
-  double pu_high = 0.;
 }
 
 class bindef {
@@ -40,6 +37,18 @@ public:
   TString tag, cut;
 };
 
+class yielddef {
+public:
+  yielddef(const NamedFunc &icut, const NamedFunc &iwgt, const vector<NamedFunc> &ivariations = {1.}):
+    cut(icut), wgt(iwgt), variations(ivariations){};
+  // selection, evaluated once per event for all variations
+  NamedFunc cut;
+  // weight common to all variations
+  NamedFunc wgt;
+  // factors multiplying wgt, each summed into its own entry of the big yields & entries vectors
+  vector<NamedFunc> variations;
+};
+
 class sysdef {
 public:
   sysdef(TString ilabel, TString itag, SysType isystype): label(ilabel), tag(itag), sys_type(isystype) {
@@ -62,12 +71,13 @@ public:
   size_t ind;
 };
 
-TString nom2sys_bin(TString ibin, size_t shift_index);
-TString nom2genmet(TString ibin);
+NamedFunc::Bindings nom2sys_bindings(size_t shift_index);
+NamedFunc::Bindings nom2genmet_bindings();
 void fillTtbarSys(ofstream &fsys);
 void fillHiggsinoSys(ofstream &fsys);
-vector<double> getYields(Baby_full &baby, const NamedFunc &baseline, const vector<NamedFunc> &bincuts,
-                         vector<double> &yield, vector<double> &w2, double lumi,
+size_t numYields(const vector<yielddef> &ydefs);
+vector<double> getYields(Baby_full &baby, const vector<yielddef> &ydefs,
+                         vector<double> &yield, vector<double> &w2, double lumi, PUAccumulator &pu,
                          bool do_trig = false, const TString &flag = "");
 void GetOptions(int argc, char *argv[], TString &infolder, TString &outfolder, TString &infile);
 
@@ -158,6 +168,8 @@ int main(int argc, char *argv[]){
 
   //// tables has a vector of the tables you want to print
   TString baseline("st>500 && met>200 && mj14>250 && njets>=6 && nbm>=1 && nleps==1 && nveto==0");
+  // filters opaque to rebinding, which keep their nominal value when kinematic variables are shifted
+  NamedFunc filters = true;
   vector<bindef> v_bins;
   if (model!="TChiHH") {
     v_bins.push_back(bindef("r1_lowmet_allnb",      "met<=350 && mt<=140 && mj14<=400"));
@@ -205,7 +217,8 @@ int main(int argc, char *argv[]){
     v_bins.push_back(bindef("r4_highmet_lownj_3b",   "met>500 && mt>140  && mj14>400 && nbm>=3 && njets<=8"));
     v_bins.push_back(bindef("r4_highmet_highnj_3b",  "met>500 && mt>140  && mj14>400 && nbm>=3 && njets>=9"));
   } else {
-    baseline = "higd_drmax<2.2&&ntks==0&&njets>=4&&njets<=5&&!low_dphi&&nvleps==0&&pass_ra2_badmu&&met/met_calo<5";
+    baseline = "higd_drmax<2.2&&ntks==0&&njets>=4&&njets<=5&&!low_dphi&&nvleps==0&&pass_ra2_badmu";
+    filters = NamedFunc("met/met_calo<5", [](const Baby &b){return b.met()/b.met_calo()<5.;});
     TString cut2b="nbdt==2&&nbdm==2", cut3b="nbdt>=2&&nbdm==3&&nbdl==3", cut4b="nbdt>=2&&nbdm>=3&&nbdl>=4";
     TString cuthig="higd_am>100&&higd_am<140&&higd_dm<40";
     TString cutsbd="!(higd_am>100&&higd_am<140)&&higd_dm<40&&higd_am<200";
@@ -240,49 +253,56 @@ int main(int argc, char *argv[]){
 
   /////////////////////////////  No more changes needed down here to add systematics ///////////////////////
   // prepare the vector of bincuts used to get the yields
-  vector<NamedFunc> bcuts;
+  // each selection is evaluated once per event, with all weight variations of a systematic summed together
+  vector<yielddef> ydefs;
   sysdef nom = v_sys[0];
   if (nom.tag != "nominal"){
     cerr<<" The first entry in the v_sys vector must be the nominal"<<endl;
     exit(1);
   }
+  // each bin cut is parsed once; shifted systematics rebind its variables, sharing all unshifted sub-cuts
+  vector<NamedFunc> bin_cuts;
+  for (const auto &bin: v_bins) bin_cuts.push_back(NamedFunc("("+baseline+"&&"+bin.cut+")") && filters);
   for (auto &sys: v_sys) {
-    sys.ind = bcuts.size(); 
+    sys.ind = numYields(ydefs); 
     if (sys.sys_type == kConst){
       continue;
     } else if (sys.sys_type == kWeight) {
-      for (auto &bin: v_bins) {
-        for (auto &wgt: sys.v_wgts) {
-          bcuts.emplace_back("("+baseline+"&&"+bin.cut+")*"+nom_wgt+"*"+wgt);
-        }
+      vector<NamedFunc> variations(sys.v_wgts.cbegin(), sys.v_wgts.cend());
+      for (const auto &cut: bin_cuts) {
+        ydefs.emplace_back(cut, nom_wgt, variations);
       }
     } else if (sys.sys_type == kCorr || sys.sys_type == kSmear) {
-      for (auto &bin: v_bins) {
-        bcuts.emplace_back(nom2sys_bin("("+baseline+"&&"+bin.cut, sys.shift_index)+")*"+nom_wgt);
+      const NamedFunc::Bindings shift = nom2sys_bindings(sys.shift_index);
+      const NamedFunc::Bindings shift_down = nom2sys_bindings(sys.shift_index+1);
+      for (const auto &cut: bin_cuts) {
+        ydefs.emplace_back(cut.Rebind(shift), nom_wgt);
         if (sys.sys_type == kCorr) { //if it is a correction, need to push the 'down' variation as well
-          bcuts.emplace_back(nom2sys_bin("("+baseline+"&&"+bin.cut, sys.shift_index+1)+")*"+nom_wgt);
+          ydefs.emplace_back(cut.Rebind(shift_down), nom_wgt);
         }
       }
     } else if (sys.sys_type == kMetSwap){
-      for (auto &bin: v_bins) {
-        bcuts.emplace_back(nom2genmet("("+baseline+"&&"+bin.cut)+")*"+nom_wgt);
+      const NamedFunc::Bindings genmet = nom2genmet_bindings();
+      for (const auto &cut: bin_cuts) {
+        ydefs.emplace_back(cut.Rebind(genmet), nom_wgt);
       }
     } else if (sys.sys_type == kPU) {
       for(const auto &bin: v_bins){
-        bcuts.emplace_back("("+baseline+"&&"+bin.cut+"&&"+"npv<=20)*"+nom_wgt);
-        bcuts.emplace_back("(npv<=20)*"+nom_wgt);
-        bcuts.emplace_back("("+baseline+"&&"+bin.cut+"&&"+"npv>=21)*"+nom_wgt);
-        bcuts.emplace_back("(npv>=21)*"+nom_wgt);
+        ydefs.emplace_back(NamedFunc("("+baseline+"&&"+bin.cut+"&&"+"npv<=20)") && filters, nom_wgt);
+        ydefs.emplace_back("npv<=20", nom_wgt);
+        ydefs.emplace_back(NamedFunc("("+baseline+"&&"+bin.cut+"&&"+"npv>=21)") && filters, nom_wgt);
+        ydefs.emplace_back("npv>=21", nom_wgt);
       }
     }
   }
   
-  // get yields from the baby for all the cut strings
+  // get yields from the baby for all the selections and weights
   cout<<"Running on: "<<infolder+"/"+infile<<endl;
   Baby_full baby(std::set<std::string>{(infolder+"/"+infile).Data()});
   auto activator = baby.Activate();
   vector<double> yields, w2, entries;
-  entries = getYields(baby, baseline, bcuts, yields, w2, luminosity.Atof());
+  PUAccumulator pu(v_data_npv);
+  entries = getYields(baby, ydefs, yields, w2, luminosity.Atof(), pu);
 
 
   //calculate uncertainties and write results to three files
@@ -344,15 +364,7 @@ int main(int argc, char *argv[]){
       } else if (sys.sys_type == kPU ) {
         double eff_low  = yields[sys.ind+4*ibin+0]/yields[sys.ind+4*ibin+1];
         double eff_high = yields[sys.ind+4*ibin+2]/yields[sys.ind+4*ibin+3];
-        double m = (eff_high-eff_low)/(pu_high-pu_low);
-        double b = (eff_low*pu_high-eff_high*pu_low)/(pu_high-pu_low);
-        double eff_data = 0., eff_mc = 0.;
-        for(size_t i = 0; i < v_data_npv.size(); ++i){
-          double fx = m*static_cast<double>(i)+b;
-          eff_data += fx*h_data_npv.GetBinContent(i+1);
-          eff_mc += fx*h_mc_npv.GetBinContent(i+1);
-        }
-        up = (eff_data-eff_mc)/eff_mc;
+        up = pu.Uncertainty(eff_low, eff_high);
         dn = -up;
 
         //Temporary stand-in until better method available
@@ -399,31 +411,18 @@ int main(int argc, char *argv[]){
   cout<<endl<<"Took "<<difftime(endtime, begtime)<<" seconds"<<endl<<endl;
 }
 
-TString nom2sys_bin(TString ibin, size_t shift_index){
-  ibin.ReplaceAll("met", "sys_met["+to_string(shift_index)+"]");
-  ibin.ReplaceAll("mt", "sys_mt["+to_string(shift_index)+"]");
-  ibin.ReplaceAll("st", "sys_st["+to_string(shift_index)+"]");
-  ibin.ReplaceAll("mj14", "sys_mj14["+to_string(shift_index)+"]");
-  ibin.ReplaceAll("njets", "sys_njets["+to_string(shift_index)+"]");
-  ibin.ReplaceAll("nbm", "sys_nbm["+to_string(shift_index)+"]");
-  //replacements for higgsino
-  ibin.ReplaceAll("nbdl", "sys_nbdl["+to_string(shift_index)+"]");
-  ibin.ReplaceAll("nbdm", "sys_nbdm["+to_string(shift_index)+"]");
-  ibin.ReplaceAll("nbdt", "sys_nbdt["+to_string(shift_index)+"]");
-  ibin.ReplaceAll("higd_am", "sys_higd_am["+to_string(shift_index)+"]");
-  ibin.ReplaceAll("higd_dm", "sys_higd_dm["+to_string(shift_index)+"]");
-  ibin.ReplaceAll("higd_drmax", "sys_higd_drmax["+to_string(shift_index)+"]");
-  //fix unintended replacement...
-  ibin.ReplaceAll("sys_met["+to_string(shift_index)+"]/sys_met["+to_string(shift_index)+"]_calo","met/met_calo");
-  return ibin;
+NamedFunc::Bindings nom2sys_bindings(size_t shift_index){
+  // variables are replaced as whole names, so e.g. met_calo is left untouched
+  const vector<string> vars{"met", "mt", "st", "mj14", "njets", "nbm",
+      //replacements for higgsino
+      "nbdl", "nbdm", "nbdt", "higd_am", "higd_dm", "higd_drmax"};
+  NamedFunc::Bindings bindings;
+  for (const auto &var: vars) bindings.emplace(var, NamedFunc("sys_"+var+"["+to_string(shift_index)+"]"));
+  return bindings;
 }
 
-TString nom2genmet(TString ibin){
-  ibin.ReplaceAll("met", "met_tru");
-  //fix unintended replacement...
-  ibin.ReplaceAll("met_tru/met_tru_calo", "met/met_calo");
-  return ibin;
-
+NamedFunc::Bindings nom2genmet_bindings(){
+  return NamedFunc::Bindings{{"met", NamedFunc("met_tru")}};
 }
 
 void fillTtbarSys(ofstream &fsys){
@@ -552,33 +551,41 @@ void fillHiggsinoSys(ofstream &fsys){
     fsys << "  sbd_4b_met3    0.06"  << endl << endl;
 }
 
-vector<double> getYields(Baby_full &baby, const NamedFunc &/*baseline*/, const vector<NamedFunc> &bincuts,
-                         vector<double> &yield, vector<double> &w2, double lumi,
+size_t numYields(const vector<yielddef> &ydefs){
+  size_t nyields = 0;
+  for(const auto &ydef: ydefs) nyields += ydef.variations.size();
+  return nyields;
+}
+
+vector<double> getYields(Baby_full &baby, const vector<yielddef> &ydefs,
+                         vector<double> &yield, vector<double> &w2, double lumi, PUAccumulator &pu,
                          bool do_trig, const TString &flag){
-  for(size_t i = 0; i <v_data_npv.size(); ++i){
-    h_data_npv.SetBinContent(i+1, v_data_npv.at(i));
-    h_data_npv.SetBinError(i+1, 0.);
-    h_mc_npv.SetBinContent(i+1, 0.);
-    h_mc_npv.SetBinError(i+1, 0.);
-  }
-  
-  vector<double> entries = vector<double>(bincuts.size(), 0);
-  yield = vector<double>(bincuts.size(), 0);
+  pu.Clear();
+  size_t nyields = numYields(ydefs);
+  vector<double> entries = vector<double>(nyields, 0);
+  yield = vector<double>(nyields, 0);
   w2 = yield;
 
   long nentries = baby.GetEntries();
 
   for(long entry = 0; entry < nentries; ++entry){
     baby.GetEntry(entry);
-    h_mc_npv.Fill(baby.npv(), baby.weight()*baby.eff_trig());
+    pu.Fill(baby.npv(), baby.weight()*baby.eff_trig());
     if(do_trig){
       if(!baby.pass()) continue;
       if(!baby.trig()->at(4) && !baby.trig()->at(8) && !baby.trig()->at(13) && !baby.trig()->at(33)) continue;
     }
-    //if(!baseline.GetScalar(baby)) continue;
-    for(size_t ind = 0; ind<bincuts.size(); ++ind){
-      float wgt = bincuts.at(ind).GetScalar(baby);
-      if(wgt != 0.){
+    size_t ind = 0;
+    for(const auto &ydef: ydefs){
+      size_t nvariations = ydef.variations.size();
+      if(!ydef.cut.GetScalar(baby)){
+        ind += nvariations;
+        continue;
+      }
+      double nom = ydef.wgt.GetScalar(baby);
+      for(size_t ivar = 0; ivar < nvariations; ++ivar, ++ind){
+        float wgt = nom*ydef.variations[ivar].GetScalar(baby);
+        if(wgt == 0.) continue;
         ++entries.at(ind);
 
         if(flag=="jer_tail"){
@@ -593,26 +600,10 @@ vector<double> getYields(Baby_full &baby, const NamedFunc &/*baseline*/, const v
       }
     }
   } // Loop over entries
-  for(size_t ind = 0; ind<bincuts.size(); ++ind){ 
+  for(size_t ind = 0; ind<nyields; ++ind){ 
      yield.at(ind) *= lumi;
      w2.at(ind) *= pow(lumi, 2);
   }
-  h_data_npv.Scale(1./h_data_npv.Integral());
-  h_mc_npv.Scale(1./h_mc_npv.Integral());
-  pu_low = 0.;
-  pu_high = 0.;
-  double norm = 0.;
-  for(size_t npv = 0; npv <= 20 && npv < v_data_npv.size(); ++npv){
-    pu_low += npv*h_mc_npv.GetBinContent(npv+1);
-    norm += h_mc_npv.GetBinContent(npv+1);
-  }
-  pu_low /= norm;
-  norm = 0.;
-  for(size_t npv = 21; npv < v_data_npv.size(); ++npv){
-    pu_high += npv*h_mc_npv.GetBinContent(npv+1);
-    norm += h_mc_npv.GetBinContent(npv+1);
-  }
-  pu_high /= norm;
   return entries;
 }
 
@@ -19,12 +19,15 @@
 
 #include "core/named_func.hpp"
 #include "core/baby_full.hpp"
+#include "core/pu_accumulator.hpp"
 #include "core/utilities.hpp"
 
 using namespace std;
 namespace {
   bool fake_PU = false;
-  float bf = 1.;
+  // one datacard is written for each branching fraction and decay mode, all from a single event loop
+  vector<float> bfs = {1.};
+  vector<pair<bool, bool> > decay_modes; // (incl_nonhh, incl_nonbb) of each mode
   bool incl_nonbb = false;
   bool incl_nonhh = false;
   bool old_cards = false;
@@ -42,13 +45,25 @@ namespace {
   bool nosys = false;
 
   const vector<double> v_data_npv{6.540e-06, 2.294e-05, 6.322e-05, 8.558e-05, 1.226e-04, 1.642e-04, 1.917e-04, 3.531e-04, 9.657e-04, 2.155e-03, 4.846e-03, 9.862e-03, 1.651e-02, 2.401e-02, 3.217e-02, 4.078e-02, 4.818e-02, 5.324e-02, 5.612e-02, 5.756e-02, 5.841e-02, 5.886e-02, 5.831e-02, 5.649e-02, 5.376e-02, 5.044e-02, 4.667e-02, 4.257e-02, 3.833e-02, 3.406e-02, 2.982e-02, 2.567e-02, 2.169e-02, 1.799e-02, 1.464e-02, 1.170e-02, 9.178e-03, 7.058e-03, 5.306e-03, 3.884e-03, 2.757e-03, 1.890e-03, 1.247e-03, 7.901e-04, 4.795e-04, 2.783e-04, 1.544e-04, 8.181e-05, 4.141e-05, 2.004e-05, 9.307e-06, 4.178e-06, 1.846e-06, 8.350e-07, 4.150e-07, 2.458e-07, 1.779e-07, 1.488e-07, 1.339e-07, 1.238e-07, 1.153e-07, 1.071e-07, 9.899e-08, 9.095e-08, 8.301e-08, 7.527e-08, 6.778e-08, 6.063e-08, 5.387e-08, 4.753e-08, 4.166e-08, 3.627e-08, 3.136e-08, 2.693e-08, 2.297e-08};
-  TH1D h_data_npv("h_data_npv", "Data;N_{PV};P(N_{PV})", v_data_npv.size(), -0.5, v_data_npv.size()-0.5);
-  TH1D h_mc_npv("h_mc_npv", "MC;N_{PV};P(N_{PV})", v_data_npv.size(), -0.5, v_data_npv.size()-0.5);
-  double pu_low = 0.;
-  double pu_high = 0.;
 
   vector<double> global_fit, observed;
-  
+
+  // ------------ fits for extrapolating yields including contamination ---------------
+  map<TString, vector<double> > hz_fit{{"sbd_2b", { 1.79760e+00, -1.42525e-01 }},
+                                       {"hig_2b", { 7.47671e-01,  1.83420e-01 }},
+                                       {"sbd_3b", { 6.07960e-01, -1.03622e+00 }},
+                                       {"hig_3b", { 1.25460e-01, -2.26228e+00 }}};
+  map<TString, vector<double> > zz_fit{{"sbd_2b", { 1.83532e+00,  6.26855e-01 }},
+                                       {"hig_2b", { 8.31874e-02, -6.92802e-01 }},
+                                       {"sbd_3b", { 3.67293e-01, -6.38853e-01 }},
+                                       {"hig_3b", { 9.35245e-03, -3.55249e+00 }}};
+
+  // Components of the decay-mode weight. Yields are accumulated separately for each, and every
+  // datacard's yields are a linear combination with coefficients set by its branching fraction.
+  // Signal events fall in exactly one of the first six, by number of Higgs bosons and whether
+  // any of them decays to something other than bb. Other events use the fitted HZ and ZZ
+  // contamination weights.
+  enum DecayComp {kHH, kHZ, kZZ, kHH_nonbb, kHZ_nonbb, kZZ_nonbb, kFitHH, kFitHZ, kFitZZ, kNDecayComps};
 }
 
 class bindef {
@@ -57,6 +72,29 @@ public:
   TString tag, cut;
 };
 
+class yielddef {
+public:
+  yielddef(const NamedFunc &icut, const NamedFunc &iwgt, const vector<NamedFunc> &ivariations = {1.}):
+    cut(icut), wgt(iwgt), variations(ivariations){};
+  // selection, evaluated once per event for all variations
+  NamedFunc cut;
+  // weight common to all variations
+  NamedFunc wgt;
+  // factors multiplying wgt, each summed into its own entry of the big yields & entries vectors
+  vector<NamedFunc> variations;
+};
+
+class carddef {
+public:
+  carddef(float ibf, bool iincl_nonhh, bool iincl_nonbb): bf(ibf), incl_nonhh(iincl_nonhh), incl_nonbb(iincl_nonbb){};
+  // coefficient of each DecayComp in this card's yields
+  vector<double> coefficients() const;
+  // branching fraction of chi -> h G
+  float bf;
+  // include decays with fewer than two Higgs bosons, or Higgs bosons decaying to something other than bb
+  bool incl_nonhh, incl_nonbb;
+};
+
 class sysdef {
 public:
   sysdef(TString ilabel, TString itag, SysType isystype): label(ilabel), tag(itag), sys_type(isystype) {
@@ -79,12 +117,20 @@ public:
   size_t ind;
 };
 
-TString nom2sys_bin(TString ibin, size_t shift_index);
-TString nom2genmet(TString ibin);
+NamedFunc::Bindings nom2sys_bindings(size_t shift_index);
+NamedFunc::Bindings nom2genmet_bindings();
 void fillHiggsinoSys(ofstream &fcard);
-vector<double> getYields(Baby_full &baby, const NamedFunc &baseline, const vector<NamedFunc> &bincuts,
-                         vector<double> &yield, vector<double> &w2, double lumi,
+size_t numYields(const vector<yielddef> &ydefs);
+void decayComponents(const Baby &b, vector<pair<size_t, double> > &comps);
+vector<double> getYields(Baby_full &baby, const vector<yielddef> &ydefs,
+                         vector<double> &yield, vector<double> &w2, double lumi, PUAccumulator &pu,
                          bool do_trig = false, const TString &flag = "");
+void cardYields(const carddef &card, const vector<double> &comp_yield, const vector<double> &comp_w2,
+                vector<double> &yield, vector<double> &w2);
+TString cardPath(const carddef &card, const string &model, const string &glu_lsp);
+void writeDatacard(const TString &outpath, const vector<bindef> &v_bins, const vector<sysdef> &v_sys,
+                   const vector<double> &yields, const vector<double> &w2, const vector<double> &entries,
+                   const PUAccumulator &pu);
 void GetOptions(int argc, char *argv[]);
 
 int main(int argc, char *argv[]){
@@ -106,7 +152,9 @@ int main(int argc, char *argv[]){
 
   //------------- SYSTEMATICS DEFINITIONS -----------------------------
   //// tables has a vector of the tables you want to print
-  TString baseline("higd_drmax<2.2&&ntks==0&&njets>=4&&njets<=5&&!low_dphi&&nvleps==0&&pass_ra2_badmu&&met/met_calo<5");
+  TString baseline("higd_drmax<2.2&&ntks==0&&njets>=4&&njets<=5&&!low_dphi&&nvleps==0&&pass_ra2_badmu");
+  // the met/met_calo filter is opaque to rebinding, so it keeps its nominal value when met is shifted
+  const NamedFunc met_filter("met/met_calo<5", [](const Baby &b){return b.met()/b.met_calo()<5.;});
   vector<bindef> v_bins;
   TString cut2b="nbdt==2&&nbdm==2", cut3b="nbdt>=2&&nbdm==3&&nbdl==3", cut4b="nbdt>=2&&nbdm>=3&&nbdl>=4";
   TString cuthig="higd_am>100&&higd_am<140&&higd_dm<40";
@@ -154,22 +202,8 @@ int main(int argc, char *argv[]){
       }
     }
   }
-  unsigned nbins(v_bins.size());
 
 
-  // ------------ fits for extrapolating yields including contamination ---------------
-  map<TString, vector<double> > hz_fit;
-  hz_fit["sbd_2b"] = { 1.79760e+00, -1.42525e-01 };
-  hz_fit["hig_2b"] = { 7.47671e-01,  1.83420e-01 };
-  hz_fit["sbd_3b"] = { 6.07960e-01, -1.03622e+00 };
-  hz_fit["hig_3b"] = { 1.25460e-01, -2.26228e+00 };
-
-  map<TString, vector<double> > zz_fit;
-  zz_fit["sbd_2b"] = { 1.83532e+00,  6.26855e-01 };
-  zz_fit["hig_2b"] = { 8.31874e-02, -6.92802e-01 };
-  zz_fit["sbd_3b"] = { 3.67293e-01, -6.38853e-01 };
-  zz_fit["hig_3b"] = { 9.35245e-03, -3.55249e+00 };
-
   //------------- SYSTEMATICS DEFINITIONS -----------------------------
   vector<sysdef> v_sys;
   // order as they will appear in latex table
@@ -208,89 +242,97 @@ int main(int argc, char *argv[]){
 
   /////////////////////////////  No more changes needed down here to add systematics ///////////////////////
   // prepare the vector of bincuts used to get the yields
-  NamedFunc bf_wgt("bf_wgt", [&](const Baby &b){
-    float wgt_ = 1;
-    if (b.type()==-999999){
-      int nh(0), nh_nonbb(0);
-      for (unsigned i(0); i<b.mc_id()->size(); i++) {
-        if (b.mc_id()->at(i)==25) nh++;
-        if (b.mc_mom()->at(i)==25 && abs(b.mc_id()->at(i))!=5) nh_nonbb++;
-      }
-      nh_nonbb /=2;
-      if (incl_nonhh) wgt_ *= (bf*bf/.25*(nh==2) + 2*bf*(1-bf)/.5*(nh==1) + (1-bf)*(1-bf)/.25*(nh==0));
-      else wgt_ *= (bf*bf/.25*(nh==2));
-      if (!incl_nonbb) wgt_ *= (nh_nonbb==0);
-    } else if (incl_nonhh) {
-      float mass = b.mgluino();
-      double hz_wgt(0), zz_wgt(0);
-      if (b.nbdt()==2 && b.nbdm()==2){
-        if (b.higd_am()>100 && b.higd_am()<140 && b.higd_dm()<40) {
-          hz_wgt = hz_fit["hig_2b"][0]+TMath::Exp(hz_fit["hig_2b"][1]-1e-05*mass*mass);
-          zz_wgt = zz_fit["hig_2b"][0]+TMath::Exp(zz_fit["hig_2b"][1]-1.5e-05*mass*mass);
-        } else {
-          hz_wgt = hz_fit["sbd_2b"][0]+TMath::Exp(hz_fit["sbd_2b"][1]-1e-05*mass*mass);
-          zz_wgt = zz_fit["sbd_2b"][0]+TMath::Exp(zz_fit["sbd_2b"][1]-1.5e-05*mass*mass);
-        }
-      } else {
-        if (b.higd_am()>100 && b.higd_am()<140 && b.higd_dm()<40) {
-          hz_wgt = hz_fit["hig_3b"][0]+TMath::Exp(hz_fit["hig_3b"][1]-1e-05*mass*mass);
-          zz_wgt = zz_fit["hig_3b"][0]+TMath::Exp(zz_fit["hig_3b"][1]-1.5e-05*mass*mass);
-        } else {
-          hz_wgt = hz_fit["sbd_3b"][0]+TMath::Exp(hz_fit["sbd_3b"][1]-1e-05*mass*mass);
-          zz_wgt = zz_fit["sbd_3b"][0]+TMath::Exp(zz_fit["sbd_3b"][1]-1.5e-05*mass*mass);
-        }
-      }
-      wgt_ *= bf*bf + 2*bf*(1-bf)*hz_wgt + (1-bf)*(1-bf)*zz_wgt;
-    } else {
-      wgt_ *= bf*bf;
-    }
-    return wgt_;
-  });
+  // datacards to write, one per branching fraction and decay mode
+  if (decay_modes.empty()) decay_modes.push_back(make_pair(incl_nonhh, incl_nonbb));
+  vector<carddef> cards;
+  for (const auto &mode: decay_modes) {
+    for (const auto &ibf: bfs) cards.push_back(carddef(ibf, mode.first, mode.second));
+  }
 
-  vector<NamedFunc> bcuts;
+  // each selection is evaluated once per event, with all weight variations of a systematic summed together
+  // the decay-mode weight is left out here, and applied per datacard by cardYields
+  vector<yielddef> ydefs;
+  NamedFunc sel_wgt(nom_wgt);
   sysdef nom = v_sys[0];
   if (nom.tag != "nominal"){
     cerr<<" The first entry in the v_sys vector must be the nominal"<<endl;
     exit(1);
   }
+  // each bin cut is parsed once; shifted systematics rebind its variables, sharing all unshifted sub-cuts
+  vector<NamedFunc> bin_cuts;
+  for (const auto &bin: v_bins) bin_cuts.push_back(NamedFunc("("+baseline+"&&"+bin.cut+")") && met_filter);
   for (auto &sys: v_sys) {
-    sys.ind = bcuts.size(); 
+    sys.ind = numYields(ydefs); 
     if (sys.sys_type == kConst){
       continue;
     } else if (sys.sys_type == kWeight) {
-      for (auto &bin: v_bins) {
-        for (auto &wgt: sys.v_wgts) {
-          bcuts.emplace_back(("("+baseline+"&&"+bin.cut+")*"+nom_wgt+"*"+wgt) * bf_wgt);
-        }
+      vector<NamedFunc> variations(sys.v_wgts.cbegin(), sys.v_wgts.cend());
+      for (const auto &cut: bin_cuts) {
+        ydefs.emplace_back(cut, sel_wgt, variations);
       }
     } else if (sys.sys_type == kCorr || sys.sys_type == kSmear) {
-      for (auto &bin: v_bins) {
-        bcuts.emplace_back((nom2sys_bin("("+baseline+"&&"+bin.cut, sys.shift_index)+")*"+nom_wgt) * bf_wgt);
+      const NamedFunc::Bindings shift = nom2sys_bindings(sys.shift_index);
+      const NamedFunc::Bindings shift_down = nom2sys_bindings(sys.shift_index+1);
+      for (const auto &cut: bin_cuts) {
+        ydefs.emplace_back(cut.Rebind(shift), sel_wgt);
         if (sys.sys_type == kCorr) { //if it is a correction, need to push the 'down' variation as well
-          bcuts.emplace_back((nom2sys_bin("("+baseline+"&&"+bin.cut, sys.shift_index+1)+")*"+nom_wgt) * bf_wgt);
+          ydefs.emplace_back(cut.Rebind(shift_down), sel_wgt);
         }
       }
     } else if (sys.sys_type == kMetSwap){
-      for (auto &bin: v_bins) {
-        bcuts.emplace_back((nom2genmet("("+baseline+"&&"+bin.cut)+")*"+nom_wgt) * bf_wgt);
+      const NamedFunc::Bindings genmet = nom2genmet_bindings();
+      for (const auto &cut: bin_cuts) {
+        ydefs.emplace_back(cut.Rebind(genmet), sel_wgt);
       }
     } else if (sys.sys_type == kPU) {
       for(const auto &bin: v_bins){
-        bcuts.emplace_back(("("+baseline+"&&"+bin.cut+"&&"+"npv<=20)*"+nom_wgt) * bf_wgt);
-        bcuts.emplace_back(("(npv<=20)*"+nom_wgt) * bf_wgt);
-        bcuts.emplace_back(("("+baseline+"&&"+bin.cut+"&&"+"npv>=21)*"+nom_wgt) * bf_wgt);
-        bcuts.emplace_back(("(npv>=21)*"+nom_wgt) * bf_wgt);
+        ydefs.emplace_back(NamedFunc("("+baseline+"&&"+bin.cut+"&&"+"npv<=20)") && met_filter, sel_wgt);
+        ydefs.emplace_back("npv<=20", sel_wgt);
+        ydefs.emplace_back(NamedFunc("("+baseline+"&&"+bin.cut+"&&"+"npv>=21)") && met_filter, sel_wgt);
+        ydefs.emplace_back("npv>=21", sel_wgt);
       }
     }
   }
 
-  // get yields from the baby for all the cut strings
+  // get yields from the baby for all the selections and weights, split by decay component
   cout<<"Running on: "<<infolder+"/"+infile<<endl;
   Baby_full baby(std::set<std::string>{(infolder+"/"+infile).Data()});
   auto activator = baby.Activate();
-  vector<double> yields, w2, entries;
-  entries = getYields(baby, baseline, bcuts, yields, w2, luminosity.Atof());
+  vector<double> comp_yields, comp_w2, entries;
+  PUAccumulator pu(v_data_npv);
+  entries = getYields(baby, ydefs, comp_yields, comp_w2, luminosity.Atof(), pu);
+
+  // --------- Writing datacards -----------------------
+  set<TString> outpaths;
+  for (const auto &card: cards) {
+    TString outpath = cardPath(card, model, glu_lsp);
+    // e.g. bf = 1 gives the same card with and without Z contamination
+    if (!outpaths.insert(outpath).second) continue;
+    vector<double> yields, w2;
+    cardYields(card, comp_yields, comp_w2, yields, w2);
+    writeDatacard(outpath, v_bins, v_sys, yields, w2, entries, pu);
+  }
 
+  time(&endtime); 
+  cout<<endl<<"Took "<<difftime(endtime, begtime)<<" seconds"<<endl<<endl;
+}
+
+TString cardPath(const carddef &card, const string &model, const string &glu_lsp){
+  TString lumi_tag = luminosity;
+  TString outpath = outfolder+"/datacard_SMS-"+TString(model)+"_"+glu_lsp+"_bfH-"+RoundNumber(card.bf*100, 0);
+  if (card.incl_nonbb) outpath += "_allHigDecays";
+  if (card.incl_nonhh && card.bf<1.) outpath += "_withZContam";
+  outpath += "_"+lumi_tag.ReplaceAll(".","p")+"ifb";
+  if (old_cards) outpath += "_old";
+  if (nosys)  outpath += "_nosys";
+  outpath += ".txt";
+  return outpath;
+}
+
+void writeDatacard(const TString &outpath, const vector<bindef> &v_bins, const vector<sysdef> &v_sys,
+                   const vector<double> &yields, const vector<double> &w2, const vector<double> &entries,
+                   const PUAccumulator &pu){
+  unsigned nbins(v_bins.size());
   // calculate average of yields with GEN and RECO MET
   vector<float> nom_met_avg_yield, nom_met_avg_w2;
   for (auto &sys: v_sys) {
@@ -302,14 +344,6 @@ int main(int argc, char *argv[]){
     }
   }
 
-  // --------- Writing datacard -----------------------
-  TString outpath = outfolder+"/datacard_SMS-"+TString(model)+"_"+glu_lsp+"_bfH-"+RoundNumber(bf*100, 0);
-  if (incl_nonbb) outpath += "_allHigDecays";
-  if (incl_nonhh && bf<1.) outpath += "_withZContam";
-  outpath += "_"+luminosity.ReplaceAll(".","p")+"ifb";
-  if (old_cards) outpath += "_old";
-  if (nosys)  outpath += "_nosys";
-  outpath += ".txt";
   cout<<"open "<<outpath<<endl;
   unsigned wname(25), wdist(7), wbin(15);
   unsigned nmet(metbins.size());
@@ -448,15 +482,7 @@ int main(int argc, char *argv[]){
         } else if (sys.sys_type == kPU ) {
           double eff_low  = yields[sys.ind+4*ibin+0]/yields[sys.ind+4*ibin+1];
           double eff_high = yields[sys.ind+4*ibin+2]/yields[sys.ind+4*ibin+3];
-          double m = (eff_high-eff_low)/(pu_high-pu_low);
-          double b = (eff_low*pu_high-eff_high*pu_low)/(pu_high-pu_low);
-          double eff_data = 0., eff_mc = 0.;
-          for(size_t i = 0; i < v_data_npv.size(); ++i){
-            double fx = m*static_cast<double>(i)+b;
-            eff_data += fx*h_data_npv.GetBinContent(i+1);
-            eff_mc += fx*h_mc_npv.GetBinContent(i+1);
-          }
-          up = (eff_data-eff_mc)/eff_mc;
+          up = pu.Uncertainty(eff_low, eff_high);
           dn = -up;
 
           //Temporary stand-in until better method available
@@ -524,63 +550,128 @@ int main(int argc, char *argv[]){
   fcard.close();
 
   cout<<" open "<<outpath<<endl;
+}
 
-  time(&endtime); 
-  cout<<endl<<"Took "<<difftime(endtime, begtime)<<" seconds"<<endl<<endl;
+NamedFunc::Bindings nom2sys_bindings(size_t shift_index){
+  // variables are replaced as whole names, so e.g. met_calo is left untouched
+  const vector<string> vars{"met", "mt", "st", "mj14", "njets", "nbm",
+      //replacements for higgsino
+      "nbdl", "nbdm", "nbdt", "higd_am", "higd_dm", "higd_drmax"};
+  NamedFunc::Bindings bindings;
+  for (const auto &var: vars) bindings.emplace(var, NamedFunc("sys_"+var+"["+to_string(shift_index)+"]"));
+  return bindings;
 }
 
-TString nom2sys_bin(TString ibin, size_t shift_index){
-  ibin.ReplaceAll("met", "sys_met["+to_string(shift_index)+"]");
-  ibin.ReplaceAll("mt", "sys_mt["+to_string(shift_index)+"]");
-  ibin.ReplaceAll("st", "sys_st["+to_string(shift_index)+"]");
-  ibin.ReplaceAll("mj14", "sys_mj14["+to_string(shift_index)+"]");
-  ibin.ReplaceAll("njets", "sys_njets["+to_string(shift_index)+"]");
-  ibin.ReplaceAll("nbm", "sys_nbm["+to_string(shift_index)+"]");
-  //replacements for higgsino
-  ibin.ReplaceAll("nbdl", "sys_nbdl["+to_string(shift_index)+"]");
-  ibin.ReplaceAll("nbdm", "sys_nbdm["+to_string(shift_index)+"]");
-  ibin.ReplaceAll("nbdt", "sys_nbdt["+to_string(shift_index)+"]");
-  ibin.ReplaceAll("higd_am", "sys_higd_am["+to_string(shift_index)+"]");
-  ibin.ReplaceAll("higd_dm", "sys_higd_dm["+to_string(shift_index)+"]");
-  ibin.ReplaceAll("higd_drmax", "sys_higd_drmax["+to_string(shift_index)+"]");
-  //fix unintended replacement...
-  ibin.ReplaceAll("sys_met["+to_string(shift_index)+"]/sys_met["+to_string(shift_index)+"]_calo","met/met_calo");
-  return ibin;
+NamedFunc::Bindings nom2genmet_bindings(){
+  return NamedFunc::Bindings{{"met", NamedFunc("met_tru")}};
 }
 
-TString nom2genmet(TString ibin){
-  ibin.ReplaceAll("met", "met_tru");
-  //fix unintended replacement...
-  ibin.ReplaceAll("met_tru/met_tru_calo", "met/met_calo");
-  return ibin;
+size_t numYields(const vector<yielddef> &ydefs){
+  size_t nyields = 0;
+  for(const auto &ydef: ydefs) nyields += ydef.variations.size();
+  return nyields;
+}
 
+vector<double> carddef::coefficients() const{
+  vector<double> coef(kNDecayComps, 0.);
+  coef[kHH] = bf*bf/.25;
+  if (incl_nonhh) {
+    coef[kHZ] = 2*bf*(1-bf)/.5;
+    coef[kZZ] = (1-bf)*(1-bf)/.25;
+  }
+  if (incl_nonbb) {
+    coef[kHH_nonbb] = coef[kHH];
+    coef[kHZ_nonbb] = coef[kHZ];
+    coef[kZZ_nonbb] = coef[kZZ];
+  }
+  coef[kFitHH] = bf*bf;
+  if (incl_nonhh) {
+    coef[kFitHZ] = 2*bf*(1-bf);
+    coef[kFitZZ] = (1-bf)*(1-bf);
+  }
+  return coef;
 }
 
-vector<double> getYields(Baby_full &baby, const NamedFunc &/*baseline*/, const vector<NamedFunc> &bincuts,
-                         vector<double> &yield, vector<double> &w2, double lumi,
-                         bool do_trig, const TString &flag){
-  for(size_t i = 0; i <v_data_npv.size(); ++i){
-    h_data_npv.SetBinContent(i+1, v_data_npv.at(i));
-    h_data_npv.SetBinError(i+1, 0.);
-    h_mc_npv.SetBinContent(i+1, 0.);
-    h_mc_npv.SetBinError(i+1, 0.);
+// decay components of the event and their weights, to be scaled by the coefficients of each card
+void decayComponents(const Baby &b, vector<pair<size_t, double> > &comps){
+  comps.clear();
+  if (b.type()==-999999){
+    int nh(0), nh_nonbb(0);
+    for (unsigned i(0); i<b.mc_id()->size(); i++) {
+      if (b.mc_id()->at(i)==25) nh++;
+      if (b.mc_mom()->at(i)==25 && abs(b.mc_id()->at(i))!=5) nh_nonbb++;
+    }
+    nh_nonbb /=2;
+    if (nh>2) return;
+    size_t comp = nh==2 ? kHH : (nh==1 ? kHZ : kZZ);
+    if (nh_nonbb!=0) comp += kHH_nonbb-kHH;
+    comps.push_back(make_pair(comp, 1.));
+  } else {
+    float mass = b.mgluino();
+    TString region = b.higd_am()>100 && b.higd_am()<140 && b.higd_dm()<40 ? "hig" : "sbd";
+    region += b.nbdt()==2 && b.nbdm()==2 ? "_2b" : "_3b";
+    comps.push_back(make_pair(kFitHH, 1.));
+    comps.push_back(make_pair(kFitHZ, hz_fit[region][0]+TMath::Exp(hz_fit[region][1]-1e-05*mass*mass)));
+    comps.push_back(make_pair(kFitZZ, zz_fit[region][0]+TMath::Exp(zz_fit[region][1]-1.5e-05*mass*mass)));
   }
-  vector<double> entries = vector<double>(bincuts.size(), 0);
-  yield = vector<double>(bincuts.size(), 0);
+}
+
+// combines the per-component yields into those of one card
+void cardYields(const carddef &card, const vector<double> &comp_yield, const vector<double> &comp_w2,
+                vector<double> &yield, vector<double> &w2){
+  const size_t ncomps = kNDecayComps;
+  const vector<double> coef = card.coefficients();
+  size_t nyields = comp_yield.size()/ncomps;
+  yield = vector<double>(nyields, 0.);
   w2 = yield;
+  for(size_t ind = 0; ind<nyields; ++ind){
+    for(size_t icomp = 0; icomp<ncomps; ++icomp){
+      if(coef[icomp] == 0.) continue;
+      yield[ind] += coef[icomp]*comp_yield[ind*ncomps+icomp];
+      for(size_t jcomp = 0; jcomp<ncomps; ++jcomp){
+        w2[ind] += coef[icomp]*coef[jcomp]*comp_w2[(ind*ncomps+icomp)*ncomps+jcomp];
+      }
+    }
+  }
+}
+
+vector<double> getYields(Baby_full &baby, const vector<yielddef> &ydefs,
+                         vector<double> &yield, vector<double> &w2, double lumi, PUAccumulator &pu,
+                         bool do_trig, const TString &flag){
+  pu.Clear();
+  // yields are split by decay component, and w2 holds the products of the weights of each pair of
+  // components, so that the sums of weights and squared weights of any card can be reconstructed
+  const size_t ncomps = kNDecayComps;
+  size_t nyields = numYields(ydefs);
+  vector<double> entries = vector<double>(nyields, 0);
+  yield = vector<double>(nyields*ncomps, 0);
+  w2 = vector<double>(nyields*ncomps*ncomps, 0);
+  vector<pair<size_t, double> > comps;
 
   long nentries = baby.GetEntries();
   for(long entry = 0; entry < nentries; ++entry){
     baby.GetEntry(entry);
-    h_mc_npv.Fill(baby.npv(), baby.weight()*baby.eff_trig());
+    pu.Fill(baby.npv(), baby.weight()*baby.eff_trig());
     if(do_trig){
       if(!baby.pass()) continue;
       if(!baby.trig()->at(4) && !baby.trig()->at(8) && !baby.trig()->at(13) && !baby.trig()->at(33)) continue;
     }
-    //if(!baseline.GetScalar(baby)) continue;
-    for(size_t ind = 0; ind<bincuts.size(); ++ind){
-      float wgt = bincuts.at(ind).GetScalar(baby);
-      if(wgt != 0.){
+    bool have_comps = false;
+    size_t ind = 0;
+    for(const auto &ydef: ydefs){
+      size_t nvariations = ydef.variations.size();
+      if(!ydef.cut.GetScalar(baby)){
+        ind += nvariations;
+        continue;
+      }
+      if(!have_comps){
+        decayComponents(baby, comps);
+        have_comps = true;
+      }
+      double nom = ydef.wgt.GetScalar(baby);
+      for(size_t ivar = 0; ivar < nvariations; ++ivar, ++ind){
+        float wgt = nom*ydef.variations[ivar].GetScalar(baby);
+        if(wgt == 0.) continue;
         ++entries.at(ind);
 
         if(flag=="jer_tail"){
@@ -590,31 +681,17 @@ vector<double> getYields(Baby_full &baby, const NamedFunc &/*baseline*/, const v
             wgt *= 1.5;
         }
 
-        yield.at(ind) += wgt;
-        w2.at(ind) += wgt*wgt;
+        for(const auto &ci: comps){
+          yield.at(ind*ncomps+ci.first) += wgt*ci.second;
+          for(const auto &cj: comps){
+            w2.at((ind*ncomps+ci.first)*ncomps+cj.first) += wgt*wgt*ci.second*cj.second;
+          }
+        }
       }
     }
   } // Loop over entries
-  for(size_t ind = 0; ind<bincuts.size(); ++ind){ 
-     yield.at(ind) *= lumi;
-     w2.at(ind) *= pow(lumi, 2);
-  }
-  h_data_npv.Scale(1./h_data_npv.Integral());
-  h_mc_npv.Scale(1./h_mc_npv.Integral());
-  pu_low = 0.;
-  pu_high = 0.;
-  double norm = 0.;
-  for(size_t npv = 0; npv <= 20 && npv < v_data_npv.size(); ++npv){
-    pu_low += npv*h_mc_npv.GetBinContent(npv+1);
-    norm += h_mc_npv.GetBinContent(npv+1);
-  }
-  pu_low /= norm;
-  norm = 0.;
-  for(size_t npv = 21; npv < v_data_npv.size(); ++npv){
-    pu_high += npv*h_mc_npv.GetBinContent(npv+1);
-    norm += h_mc_npv.GetBinContent(npv+1);
-  }
-  pu_high /= norm;
+  for(auto &y: yield) y *= lumi;
+  for(auto &y: w2) y *= pow(lumi, 2);
   return entries;
 }
 
@@ -628,6 +705,7 @@ void GetOptions(int argc, char *argv[]){
       {"outfolder", required_argument, 0, 'o'},
       {"lumi", required_argument, 0, 'l'},
       {"bf", required_argument, 0, 0},
+      {"decay_modes", required_argument, 0, 0},
       {"incl_nonbb", no_argument, 0, 0},
       {"incl_nonhh", no_argument, 0, 0},
       {"old", no_argument, 0, 0},
@@ -656,7 +734,20 @@ void GetOptions(int argc, char *argv[]){
       }else if(optname == "incl_nonhh"){
         incl_nonhh = true;
       }else if(optname == "bf"){
-        bf = atof(optarg);
+        // comma separated list, e.g. --bf 1,0.5
+        bfs.clear();
+        for(const auto &ibf: Tokenize(optarg, ",")) bfs.push_back(atof(ibf.c_str()));
+      }else if(optname == "decay_modes"){
+        // comma separated list of hh, nonhh, nonbb and nonhh_nonbb. Overrides --incl_nonhh and --incl_nonbb
+        decay_modes.clear();
+        for(const auto &mode: Tokenize(optarg, ",")){
+          if(mode != "hh" && mode != "nonhh" && mode != "nonbb" && mode != "nonhh_nonbb"){
+            printf("Bad decay mode %s\n", mode.c_str());
+            exit(1);
+          }
+          decay_modes.push_back(make_pair(mode == "nonhh" || mode == "nonhh_nonbb",
+                                          mode == "nonbb" || mode == "nonhh_nonbb"));
+        }
       }else if(optname == "old"){
         old_cards = true;
       }else{
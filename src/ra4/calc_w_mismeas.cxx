@@ -7,6 +7,8 @@
 #include <limits>
 #include <numeric>
 #include <algorithm>
+#include <thread>
+#include <cmath>
 
 #include <unistd.h>
 #include <getopt.h>
@@ -20,6 +22,8 @@
 #include "core/named_func.hpp"
 #include "core/plot_maker.hpp"
 #include "core/config_parser.hpp"
+#include "core/thread_pool.hpp"
+#include "core/random_stream.hpp"
 
 using namespace std;
 
@@ -31,20 +35,25 @@ namespace{
   
   double luminosity = 35.;
   size_t num_toys = 10000000;
+  size_t num_pilot_toys = 100000;
+  double pilot_margin = 5.;
+  double tolerance = 0.001;
+  size_t num_threads = thread::hardware_concurrency();
 
   bool debug = false;
 }
 
 namespace{
-  mt19937_64 InitializePRNG(){
-    array<int, 128> sd;
+  RandomStream InitializePRNG(){
     random_device r;
-    generate_n(sd.begin(), sd.size(), ref(r));
-    seed_seq ss(begin(sd), end(sd));
-    return mt19937_64(ss);
+    uint64_t seed = r();
+    seed = (seed << 32) | r();
+    return RandomStream(seed);
   }
 
-  mt19937_64 prng = InitializePRNG();
+  RandomStream prng = InitializePRNG();
+
+  const size_t omega_batch = 4096;
 }
 
 int main(int argc, char *argv[]){
@@ -287,54 +296,84 @@ void BayesianOmega(double &omega_lo, double &omega_mid, double &omega_hi,
                    const GammaParams &c_mc_good, const GammaParams &d_mc_good,
                    const GammaParams &a_mc_bad, const GammaParams &b_mc_bad,
                    const GammaParams &c_mc_bad, const GammaParams &d_mc_bad){
-  gamma_distribution<double> ga_data(a_data.Yield(), 1.);
-  gamma_distribution<double> gb_data(b_data.Yield(), 1.);
-  gamma_distribution<double> gc_data(c_data.Yield(), 1.);
-  gamma_distribution<double> gd_data(d_data.Yield(), 1.);
-  gamma_distribution<double> ga_mc_good(a_mc_good.NEffective(), a_mc_good.Weight());
-  gamma_distribution<double> gb_mc_good(b_mc_good.NEffective(), b_mc_good.Weight());
-  gamma_distribution<double> gc_mc_good(c_mc_good.NEffective(), c_mc_good.Weight());
-  gamma_distribution<double> gd_mc_good(d_mc_good.NEffective(), d_mc_good.Weight());
-  gamma_distribution<double> ga_mc_bad(a_mc_bad.NEffective(), a_mc_bad.Weight());
-  gamma_distribution<double> gb_mc_bad(b_mc_bad.NEffective(), b_mc_bad.Weight());
-  gamma_distribution<double> gc_mc_bad(c_mc_bad.NEffective(), c_mc_bad.Weight());
-  gamma_distribution<double> gd_mc_bad(d_mc_bad.NEffective(), d_mc_bad.Weight());
-
-  vector<double> omega(num_toys);
-
-  for(size_t i = 0; i < num_toys; ++i){
-    double mua_data = ga_data(prng), mub_data = gb_data(prng),
-      muc_data = gc_data(prng), mud_data = gd_data(prng);
-    double mua_mc_good = ga_mc_good(prng), mub_mc_good = gb_mc_good(prng),
-      muc_mc_good = gc_mc_good(prng), mud_mc_good = gd_mc_good(prng);
-    double mua_mc_bad = ga_mc_bad(prng), mub_mc_bad = gb_mc_bad(prng),
-      muc_mc_bad = gc_mc_bad(prng), mud_mc_bad = gd_mc_bad(prng);
-    omega.at(i) = GetOmega(mua_data, mub_data, muc_data, mud_data,
-                           mua_mc_good, mub_mc_good, muc_mc_good, mud_mc_good,
-                           mua_mc_bad, mub_mc_bad, muc_mc_bad, mud_mc_bad);
-    if(fabs(omega.at(i))>1. && false){
-      DBG(i << " " << omega.at(i));
-      DBG("a_data: " << mua_data << " " << a_data);
-      DBG("b_data: " << mub_data << " " << b_data);
-      DBG("c_data: " << muc_data << " " << c_data);
-      DBG("d_data: " << mud_data << " " << d_data);
-      DBG("a_mc_good: " << mua_mc_good << " " << a_mc_good);
-      DBG("b_mc_good: " << mub_mc_good << " " << b_mc_good);
-      DBG("c_mc_good: " << muc_mc_good << " " << c_mc_good);
-      DBG("d_mc_good: " << mud_mc_good << " " << d_mc_good);
-      DBG("a_mc_bad: " << mua_mc_bad << " " << a_mc_bad);
-      DBG("b_mc_bad: " << mub_mc_bad << " " << b_mc_bad);
-      DBG("c_mc_bad: " << muc_mc_bad << " " << c_mc_bad);
-      DBG("d_mc_bad: " << mud_mc_bad << " " << d_mc_bad);
-    }
-  }
+  OmegaDists dists = {{
+      {a_data.Yield(), 1.}, {b_data.Yield(), 1.},
+      {c_data.Yield(), 1.}, {d_data.Yield(), 1.},
+      {a_mc_good.NEffective(), a_mc_good.Weight()}, {b_mc_good.NEffective(), b_mc_good.Weight()},
+      {c_mc_good.NEffective(), c_mc_good.Weight()}, {d_mc_good.NEffective(), d_mc_good.Weight()},
+      {a_mc_bad.NEffective(), a_mc_bad.Weight()}, {b_mc_bad.NEffective(), b_mc_bad.Weight()},
+      {c_mc_bad.NEffective(), c_mc_bad.Weight()}, {d_mc_bad.NEffective(), d_mc_bad.Weight()}
+    }};
 
   omega_mid = GetOmega(a_data.Yield(), b_data.Yield(), c_data.Yield(), d_data.Yield(),
 		       a_mc_good.Yield(), b_mc_good.Yield(), c_mc_good.Yield(), d_mc_good.Yield(),
 		       a_mc_bad.Yield(), b_mc_bad.Yield(), c_mc_bad.Yield(), d_mc_bad.Yield());
 
+  // A small pilot sample is kept in full to find the scale of the interval
+  vector<double> omega(min(num_toys, num_pilot_toys));
+  OmegaToys(dists, prng, omega);
   sort(omega.begin(), omega.end());
   GetInterval(omega_lo, omega_hi, omega);
+  if(omega.size() == num_toys) return;
+
+  double width = omega_hi-omega_lo;
+  if(!(width > 0.) || std::isinf(width)){
+    DBG("Cannot histogram omega with pilot interval [" << omega_lo << ", " << omega_hi << "]");
+    return;
+  }
+
+  // The full sample is only histogrammed, with bins a fraction "tolerance" of the pilot interval
+  double x_min = omega_lo-pilot_margin*width;
+  double x_max = omega_hi+pilot_margin*width;
+  size_t num_bins = ceil((x_max-x_min)/(tolerance*width));
+
+  // One pool serves every call, started once the thread count is known
+  size_t num_tasks = max<size_t>(num_threads, 1);
+  static ThreadPool tp(num_tasks);
+  vector<vector<size_t> > partial(num_tasks);
+  tp.ParallelFor(0, num_tasks, [&](size_t itask){
+      size_t num = num_toys/num_tasks + (itask < num_toys%num_tasks ? 1 : 0);
+      partial.at(itask) = OmegaHistogram(dists, prng.Split(itask), num, x_min, x_max, num_bins);
+    }, 1);
+  vector<size_t> counts(num_bins+2, 0);
+  for(const auto &this_counts: partial){
+    for(size_t bin = 0; bin < counts.size(); ++bin){
+      counts.at(bin) += this_counts.at(bin);
+    }
+  }
+
+  GetInterval(omega_lo, omega_hi, counts, x_min, x_max);
+}
+
+void OmegaToys(const OmegaDists &dists, RandomStream &rng, vector<double> &omega){
+  array<vector<double>, 12> mu;
+  for(size_t i = 0; i < mu.size(); ++i){
+    mu[i].resize(omega.size());
+    rng.Gamma(mu[i], dists[i].first, dists[i].second);
+  }
+  for(size_t toy = 0; toy < omega.size(); ++toy){
+    omega[toy] = GetOmega(mu[0][toy], mu[1][toy], mu[2][toy], mu[3][toy],
+                          mu[4][toy], mu[5][toy], mu[6][toy], mu[7][toy],
+                          mu[8][toy], mu[9][toy], mu[10][toy], mu[11][toy]);
+  }
+}
+
+vector<size_t> OmegaHistogram(OmegaDists dists, RandomStream rng, size_t num,
+                              double x_min, double x_max, size_t num_bins){
+  vector<size_t> counts(num_bins+2, 0);
+  double scale = num_bins/(x_max-x_min);
+  vector<double> omega;
+  for(size_t done = 0; done < num; done += omega.size()){
+    omega.resize(min(omega_batch, num-done));
+    OmegaToys(dists, rng, omega);
+    for(const auto &this_omega: omega){
+      double x = (this_omega-x_min)*scale;
+      if(x < 0.) ++counts.front();
+      else if(!(x < num_bins)) ++counts.back();
+      else ++counts.at(1+static_cast<size_t>(x));
+    }
+  }
+  return counts;
 }
 
 double GetOmega(double mua_data, double mub_data, double muc_data, double mud_data,
@@ -370,6 +409,33 @@ void GetInterval(double &x_lo, double &x_hi, const vector<double> &x_vals){
   }
 }
 
+void GetInterval(double &x_lo, double &x_hi, const vector<size_t> &counts,
+                 double x_min, double x_max){
+  size_t total = accumulate(counts.begin(), counts.end(), static_cast<size_t>(0));
+  size_t target = ceil(erf(sqrt(0.5))*total);
+  double bin_width = (x_max-x_min)/(counts.size()-2);
+
+  // Shortest run of in-range bins holding the target number of toys
+  size_t best_lo = 0, best_hi = counts.size(), sum = 0;
+  for(size_t lo = 1, hi = 1; lo+1 < counts.size(); ++lo){
+    while(hi+1 < counts.size() && sum < target) sum += counts.at(hi++);
+    if(sum < target) break;
+    if(hi-lo < best_hi-best_lo){
+      best_lo = lo;
+      best_hi = hi;
+    }
+    sum -= counts.at(lo);
+  }
+  if(best_lo == 0){
+    ERROR("Too many toys outside histogram range ["+to_string(x_min)+", "+to_string(x_max)+")");
+  }
+  if(best_lo == 1 || best_hi+1 == counts.size()){
+    DBG("Interval reaches edge of histogram range [" << x_min << ", " << x_max << ")");
+  }
+  x_lo = x_min+(best_lo-0.5)*bin_width;
+  x_hi = x_min+(best_hi-1.5)*bin_width;
+}
+
 void GetOptions(int argc, char *argv[]){
   while(true){
     static struct option long_options[] = {
@@ -378,13 +444,15 @@ void GetOptions(int argc, char *argv[]){
       {"file", required_argument, 0, 'f'},
       {"luminosity", required_argument, 0, 'l'},
       {"toys", required_argument, 0, 't'},
+      {"tolerance", required_argument, 0, 0},
+      {"threads", required_argument, 0, 'j'},
       {"debug", no_argument, 0, 0},
       {0, 0, 0, 0}
     };
 
     char opt = -1;
     int option_index;
-    opt = getopt_long(argc, argv, "m:r:f:l:t:", long_options, &option_index);
+    opt = getopt_long(argc, argv, "m:r:f:l:t:j:", long_options, &option_index);
 
     if( opt == -1) break;
 
@@ -405,10 +473,15 @@ void GetOptions(int argc, char *argv[]){
     case 't':
       num_toys = atoi(optarg);
       break;
+    case 'j':
+      num_threads = atoi(optarg);
+      break;
     case 0:
       optname = long_options[option_index].name;
       if(optname == "debug"){
         debug = true;
+      }else if(optname == "tolerance"){
+        tolerance = atof(optarg);
       }else{
         printf("Bad option! Found option name %s\n", optname.c_str());
       }
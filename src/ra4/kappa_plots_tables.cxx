@@ -57,6 +57,7 @@ namespace{
   TString mc_lumi = "";
   string sys_wgts_file = "txt/sys_weights.cfg";
   string mm_scen = "";
+  string kappa_cache = "";
   float lumi=35.9;
   bool quick_test = false;
 }
@@ -98,6 +99,7 @@ const NamedFunc nbadmu("nbadmu", [](const Baby &b) -> NamedFunc::ScalarType{
 int main(int argc, char *argv[]){
   gErrorIgnoreLevel=6000; // Turns off ROOT errors due to missing branches
   GetOptions(argc, argv);
+  if(kappa_cache != "") SetKappaCacheFile(kappa_cache);
 
   chrono::high_resolution_clock::time_point begTime;
   begTime = chrono::high_resolution_clock::now();
@@ -1514,6 +1516,7 @@ void GetOptions(int argc, char *argv[]){
       {"ht", no_argument, 0, 0},              // Cuts on ht>500 instead of st>500
       {"mm", required_argument, 0, 0},        // Mismeasurment scenario, 0 for data
       {"quick", no_argument, 0, 0},           // Used inclusive ttbar for quick testing
+      {"kappa_cache", required_argument, 0, 0}, // File keeping kappa toy results across runs
       {"ichep_nbm", no_argument, 0, 0},       // Use ICHEP b-tagging working point
       {"preview", no_argument, 0, 0},         // Table preview, no caption
       {0, 0, 0, 0}
@@ -1577,6 +1580,8 @@ void GetOptions(int argc, char *argv[]){
 	    ichep_nbm = true;
       }else if(optname == "preview"){
 	    table_preview = true;
+      }else if(optname == "kappa_cache"){
+        kappa_cache = optarg;
       }else if(optname == "quick"){
 	    quick_test = true;
       }else{
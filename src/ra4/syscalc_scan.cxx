@@ -6,6 +6,10 @@
 #include <sstream>
 #include <ctime>
 #include <algorithm>
+#include <limits>
+#include <vector>
+#include <future>
+#include <mutex>
 #include <unistd.h> // getopt in Macs
 #include <getopt.h>
 
@@ -14,8 +18,11 @@
 #include "TError.h" // Controls error level reporting
 
 #include "core/named_func.hpp"
+#include "core/bin_grid.hpp"
+#include "core/pu_accumulator.hpp"
 #include "core/baby_full.hpp"
 #include "core/utilities.hpp"
+#include "core/thread_pool.hpp"
 
 using namespace std;
 namespace {
@@ -26,16 +33,35 @@ namespace {
   TString syst = "all";
 
   const vector<double> v_data_npv{6.540e-06, 2.294e-05, 6.322e-05, 8.558e-05, 1.226e-04, 1.642e-04, 1.917e-04, 3.531e-04, 9.657e-04, 2.155e-03, 4.846e-03, 9.862e-03, 1.651e-02, 2.401e-02, 3.217e-02, 4.078e-02, 4.818e-02, 5.324e-02, 5.612e-02, 5.756e-02, 5.841e-02, 5.886e-02, 5.831e-02, 5.649e-02, 5.376e-02, 5.044e-02, 4.667e-02, 4.257e-02, 3.833e-02, 3.406e-02, 2.982e-02, 2.567e-02, 2.169e-02, 1.799e-02, 1.464e-02, 1.170e-02, 9.178e-03, 7.058e-03, 5.306e-03, 3.884e-03, 2.757e-03, 1.890e-03, 1.247e-03, 7.901e-04, 4.795e-04, 2.783e-04, 1.544e-04, 8.181e-05, 4.141e-05, 2.004e-05, 9.307e-06, 4.178e-06, 1.846e-06, 8.350e-07, 4.150e-07, 2.458e-07, 1.779e-07, 1.488e-07, 1.339e-07, 1.238e-07, 1.153e-07, 1.071e-07, 9.899e-08, 9.095e-08, 8.301e-08, 7.527e-08, 6.778e-08, 6.063e-08, 5.387e-08, 4.753e-08, 4.166e-08, 3.627e-08, 3.136e-08, 2.693e-08, 2.297e-08};
-  TH1D h_data_npv("h_data_npv", "Data;N_{PV};P(N_{PV})", v_data_npv.size(), -0.5, v_data_npv.size()-0.5);
-  TH1D h_mc_npv("h_mc_npv", "MC;N_{PV};P(N_{PV})", v_data_npv.size(), -0.5, v_data_npv.size()-0.5);
-  double pu_low = 0.;
-  double pu_high = 0.;
+  size_t num_threads = 0; // threads used to process files in directory mode; 0 to use all cores
+  mutex print_mutex;
 }
 
 class bindef {
 public:
-  bindef(TString itag, TString icut): tag(itag), cut(icut){};
-  TString tag, cut;
+  bindef(TString itag, BinGrid::Ranges iranges): tag(itag), ranges(iranges){};
+  TString tag;
+  // (low, high] range of each grid axis covered by the bin; axes not listed are not cut on
+  BinGrid::Ranges ranges;
+};
+
+class yielddef {
+public:
+  yielddef(const BinGrid &igrid, size_t igrid_index, const NamedFunc &iwgt, size_t ifirst, size_t istride,
+           bool iinclusive = false):
+    sums(igrid), grid_index(igrid_index), wgt(iwgt), first(ifirst), stride(istride), inclusive(iinclusive){
+    sums.Clear();
+  }
+  // accumulates the weights in each cell of the grid
+  BinGrid sums;
+  // index of the grid used to locate events
+  size_t grid_index;
+  // weight summed in each bin
+  NamedFunc wgt;
+  // yield of bin ibin goes to index first + stride*ibin in the big yields & entries vectors
+  size_t first, stride;
+  // if true, the grid has a single region whose yield is stored for every bin
+  bool inclusive;
 };
 
 class sysdef {
@@ -60,14 +86,19 @@ public:
   size_t ind;
 };
 
-TString nom2sys_bin(TString ibin, size_t shift_index);
-TString nom2genmet(TString ibin);
+NamedFunc::Bindings nom2sys_bindings(size_t shift_index);
+NamedFunc::Bindings nom2genmet_bindings();
 void GetOptions(int argc, char *argv[], TString &infolder, TString &outfolder, TString &infile);
 void fillTtbarSys(ofstream &fsys);
 
-vector<double> getYields(Baby_full &baby, const NamedFunc &baseline, const vector<NamedFunc> &bincuts,
-                         vector<double> &yield, vector<double> &w2, double lumi,
+vector<double> getYields(Baby_full &baby, const vector<BinGrid> &grids, vector<yielddef> &ydefs,
+                         size_t nbins, size_t nyields,
+                         vector<double> &yield, vector<double> &w2, double lumi, PUAccumulator &pu,
                          bool do_trig = false, const TString &flag = "");
+bool parseMasses(const string &infile, int &mglu, int &mlsp);
+void processFile(const TString &infolder, const TString &outfolder, const string &infile,
+                 const vector<sysdef> &v_sys, const vector<bindef> &v_bins,
+                 const vector<BinGrid> &grids, vector<yielddef> ydefs, size_t nyields);
 
 int main(int argc, char *argv[]){
   gErrorIgnoreLevel=6000; // Turns off ROOT errors due to missing branches
@@ -77,19 +108,6 @@ int main(int argc, char *argv[]){
   GetOptions(argc, argv, infolder, outfolder, infile);
   gSystem->mkdir(outfolder, kTRUE);
 
-  // TString infile = "/cms2r0/babymaker/babies/2015_11_27/sms/split_sms/renorm/baby_SMS-T1tttt_mGluino-1500_mLSP-100_TuneCUETP8M1_13TeV-madgraphMLM-pythia8_RunIISpring15FSPremix-MCRUN2_74_V9_renorm.root";
-  string prs = infile.Data();
-  int mglu = stoi(prs.substr(prs.find("ino-")+4,prs.find("_mLSP")-prs.find("ino-")-4));
-  int mlsp = stoi(prs.substr(prs.find("LSP-")+4,prs.find("_Tune")-prs.find("LSP-")-4));
-  cout<<"Working on: mGluino = "<<mglu<<" mLSP = "<<mlsp<<endl;
-  string glu_lsp("mGluino-"+to_string(mglu)+"_mLSP-"+to_string(mlsp));
-  string model = "T1tttt";
-  if(Contains(prs, "T5tttt")) model = "T5tttt";
-  if(Contains(prs, "T5tttt-Stop")) model = "T5tttt-Stop";
-  if(Contains(prs, "T5tttt-degen")) model = "T5tttt-degen";
-  if(Contains(prs, "T2tt")) model = "T2tt";
-  if(Contains(prs, "T6ttWW")) model = "T6ttWW";
-
   vector<sysdef> v_sys;
   // order as they will appear in latex table
   // *Nominal must stay in the first spot!!* (will be skipped in table)
@@ -138,107 +156,164 @@ int main(int argc, char *argv[]){
   TString baseline("st>500 && met>200 && mj14>250 && njets>=6 && nbm>=1 && nleps==1 && nveto==0");
   vector<bindef> v_bins;
 
-  v_bins.push_back(bindef("r1_lowmet_allnb",      "met<=350 && mt<=140 && mj14<=400"));
-  v_bins.push_back(bindef("r2_lowmet_lownj_1b",   "met<=350 && mt<=140 && mj14>400 && nbm==1 && njets<=8"));
-  v_bins.push_back(bindef("r2_lowmet_highnj_1b",  "met<=350 && mt<=140 && mj14>400 && nbm==1 && njets>=9"));
-  v_bins.push_back(bindef("r2_lowmet_lownj_2b",   "met<=350 && mt<=140 && mj14>400 && nbm==2 && njets<=8"));
-  v_bins.push_back(bindef("r2_lowmet_highnj_2b",  "met<=350 && mt<=140 && mj14>400 && nbm==2 && njets>=9"));
-  v_bins.push_back(bindef("r2_lowmet_lownj_3b",   "met<=350 && mt<=140 && mj14>400 && nbm>=3 && njets<=8"));
-  v_bins.push_back(bindef("r2_lowmet_highnj_3b",  "met<=350 && mt<=140 && mj14>400 && nbm>=3 && njets>=9"));
-  v_bins.push_back(bindef("r3_lowmet_allnb",      "met<=350 && mt>140  && mj14<=400"));
-  v_bins.push_back(bindef("r4_lowmet_lownj_1b",   "met<=350 && mt>140  && mj14>400 && nbm==1 && njets<=8"));
-  v_bins.push_back(bindef("r4_lowmet_highnj_1b",  "met<=350 && mt>140  && mj14>400 && nbm==1 && njets>=9"));
-  v_bins.push_back(bindef("r4_lowmet_lownj_2b",   "met<=350 && mt>140  && mj14>400 && nbm==2 && njets<=8"));
-  v_bins.push_back(bindef("r4_lowmet_highnj_2b",  "met<=350 && mt>140  && mj14>400 && nbm==2 && njets>=9"));
-  v_bins.push_back(bindef("r4_lowmet_lownj_3b",   "met<=350 && mt>140  && mj14>400 && nbm>=3 && njets<=8"));
-  v_bins.push_back(bindef("r4_lowmet_highnj_3b",  "met<=350 && mt>140  && mj14>400 && nbm>=3 && njets>=9"));
-
-  v_bins.push_back(bindef("r1_medmet_allnb",      "met>350&&met<=500 && mt<=140 && mj14<=400"));
-  v_bins.push_back(bindef("r2_medmet_lownj_1b",   "met>350&&met<=500 && mt<=140 && mj14>400 && nbm==1 && njets<=8"));
-  v_bins.push_back(bindef("r2_medmet_highnj_1b",  "met>350&&met<=500 && mt<=140 && mj14>400 && nbm==1 && njets>=9"));
-  v_bins.push_back(bindef("r2_medmet_lownj_2b",   "met>350&&met<=500 && mt<=140 && mj14>400 && nbm==2 && njets<=8"));
-  v_bins.push_back(bindef("r2_medmet_highnj_2b",  "met>350&&met<=500 && mt<=140 && mj14>400 && nbm==2 && njets>=9"));
-  v_bins.push_back(bindef("r2_medmet_lownj_3b",   "met>350&&met<=500 && mt<=140 && mj14>400 && nbm>=3 && njets<=8"));
-  v_bins.push_back(bindef("r2_medmet_highnj_3b",  "met>350&&met<=500 && mt<=140 && mj14>400 && nbm>=3 && njets>=9"));
-  v_bins.push_back(bindef("r3_medmet_allnb",      "met>350&&met<=500 && mt>140  && mj14<=400"));
-  v_bins.push_back(bindef("r4_medmet_lownj_1b",   "met>350&&met<=500 && mt>140  && mj14>400 && nbm==1 && njets<=8"));
-  v_bins.push_back(bindef("r4_medmet_highnj_1b",  "met>350&&met<=500 && mt>140  && mj14>400 && nbm==1 && njets>=9"));
-  v_bins.push_back(bindef("r4_medmet_lownj_2b",   "met>350&&met<=500 && mt>140  && mj14>400 && nbm==2 && njets<=8"));
-  v_bins.push_back(bindef("r4_medmet_highnj_2b",  "met>350&&met<=500 && mt>140  && mj14>400 && nbm==2 && njets>=9"));
-  v_bins.push_back(bindef("r4_medmet_lownj_3b",   "met>350&&met<=500 && mt>140  && mj14>400 && nbm>=3 && njets<=8"));
-  v_bins.push_back(bindef("r4_medmet_highnj_3b",  "met>350&&met<=500 && mt>140  && mj14>400 && nbm>=3 && njets>=9"));
-  
-  v_bins.push_back(bindef("r1_highmet_allnb",      "met>500 && mt<=140 && mj14<=400"));
-  v_bins.push_back(bindef("r2_highmet_lownj_1b",   "met>500 && mt<=140 && mj14>400 && nbm==1 && njets<=8"));
-  v_bins.push_back(bindef("r2_highmet_highnj_1b",  "met>500 && mt<=140 && mj14>400 && nbm==1 && njets>=9"));
-  v_bins.push_back(bindef("r2_highmet_lownj_2b",   "met>500 && mt<=140 && mj14>400 && nbm==2 && njets<=8"));
-  v_bins.push_back(bindef("r2_highmet_highnj_2b",  "met>500 && mt<=140 && mj14>400 && nbm==2 && njets>=9"));
-  v_bins.push_back(bindef("r2_highmet_lownj_3b",   "met>500 && mt<=140 && mj14>400 && nbm>=3 && njets<=8"));
-  v_bins.push_back(bindef("r2_highmet_highnj_3b",  "met>500 && mt<=140 && mj14>400 && nbm>=3 && njets>=9"));
-  v_bins.push_back(bindef("r3_highmet_allnb",      "met>500 && mt>140  && mj14<=400"));
-  v_bins.push_back(bindef("r4_highmet_lownj_1b",   "met>500 && mt>140  && mj14>400 && nbm==1 && njets<=8"));
-  v_bins.push_back(bindef("r4_highmet_highnj_1b",  "met>500 && mt>140  && mj14>400 && nbm==1 && njets>=9"));
-  v_bins.push_back(bindef("r4_highmet_lownj_2b",   "met>500 && mt>140  && mj14>400 && nbm==2 && njets<=8"));
-  v_bins.push_back(bindef("r4_highmet_highnj_2b",  "met>500 && mt>140  && mj14>400 && nbm==2 && njets>=9"));
-  v_bins.push_back(bindef("r4_highmet_lownj_3b",   "met>500 && mt>140  && mj14>400 && nbm>=3 && njets<=8"));
-  v_bins.push_back(bindef("r4_highmet_highnj_3b",  "met>500 && mt>140  && mj14>400 && nbm>=3 && njets>=9"));
-  
+  const double inf = numeric_limits<double>::infinity();
+  const vector<pair<TString, pair<double, double> > > metbins{{"lowmet", {200., 350.}},
+      {"medmet", {350., 500.}}, {"highmet", {500., inf}}};
+  const vector<pair<TString, pair<double, double> > > nbbins{{"1b", {0., 1.}}, {"2b", {1., 2.}}, {"3b", {2., inf}}};
+  const vector<pair<TString, pair<double, double> > > njbins{{"lownj", {5., 8.}}, {"highnj", {8., inf}}};
+  const pair<double, double> lowmt{-inf, 140.}, highmt{140., inf}, lowmj{250., 400.}, highmj{400., inf};
+  for(const auto &met: metbins){
+    for(const auto &mt: {lowmt, highmt}){
+      TString rlow = mt == lowmt ? "r1_" : "r3_", rhigh = mt == lowmt ? "r2_" : "r4_";
+      v_bins.push_back(bindef(rlow+met.first+"_allnb", {{"met", met.second}, {"mt", mt}, {"mj14", lowmj}}));
+      for(const auto &nb: nbbins){
+        for(const auto &nj: njbins){
+          v_bins.push_back(bindef(rhigh+met.first+"_"+nj.first+"_"+nb.first,
+                                  {{"met", met.second}, {"mt", mt}, {"mj14", highmj},
+                                      {"nbm", nb.second}, {"njets", nj.second}}));
+        }
+      }
+    }
+  }
+
+  // All bins are regions of one lattice, so each event is located once per
+  // set of analysis variables instead of evaluating every bin's cut string
+  const vector<string> grid_vars{"met", "mt", "mj14", "nbm", "njets"};
+  BinGrid nom_grid(baseline);
+  nom_grid.AddAxis("met", "met", {200., 350., 500., inf})
+    .AddAxis("mt", "mt", {-inf, 140., inf})
+    .AddAxis("mj14", "mj14", {250., 400., inf})
+    .AddAxis("nbm", "nbm", {0., 1., 2., inf})
+    .AddAxis("njets", "njets", {5., 8., inf});
+  for(const auto &bin: v_bins) nom_grid.AddRegion(bin.tag.Data(), bin.ranges);
+
   /////////////////////////////  No more changes needed down here to add systematics ///////////////////////
-  // prepare the vector of bincuts used to get the yields
-  vector<NamedFunc> bcuts;
+  // prepare the grids and weights used to get the yields
+  vector<BinGrid> grids{nom_grid};
+  vector<yielddef> ydefs;
+  size_t nyields = 0;
   sysdef nom = v_sys[0];
   if (nom.tag != "nominal"){
     cerr<<" The first entry in the v_sys vector must be the nominal"<<endl;
     exit(1);
   }
+  size_t nbins = v_bins.size();
   for (auto &sys: v_sys) {
-    sys.ind = bcuts.size(); 
+    sys.ind = nyields; 
     if (sys.sys_type == kConst){
       continue;
     } else if (sys.sys_type == kWeight) {
-      for (auto &bin: v_bins) {
-        for (auto &wgt: sys.v_wgts) {
-          bcuts.emplace_back("("+baseline+"&&"+bin.cut+")*"+nom_wgt+"*"+wgt);
-        }
+      size_t nwgts = sys.v_wgts.size();
+      for (size_t iwgt = 0; iwgt < nwgts; ++iwgt) {
+        ydefs.push_back(yielddef(nom_grid, 0, nom_wgt+"*"+sys.v_wgts[iwgt], sys.ind+iwgt, nwgts));
       }
+      nyields += nbins*nwgts;
     } else if (sys.sys_type == kCorr || sys.sys_type == kSmear) {
-      for (auto &bin: v_bins) {
-        bcuts.emplace_back(nom2sys_bin("("+baseline+"&&"+bin.cut, sys.shift_index)+")*"+nom_wgt);
-        if (sys.sys_type == kCorr) { //if it is a correction, need to push the 'down' variation as well
-          bcuts.emplace_back(nom2sys_bin("("+baseline+"&&"+bin.cut, sys.shift_index+1)+")*"+nom_wgt);
-        }
+      // if it is a correction, need to push the 'down' variation as well
+      size_t nshifts = sys.sys_type == kCorr ? 2 : 1;
+      for (size_t ishift = 0; ishift < nshifts; ++ishift) {
+        const NamedFunc::Bindings shift = nom2sys_bindings(sys.shift_index+ishift);
+        BinGrid sys_grid(nom_grid);
+        sys_grid.Cut(nom_grid.Cut().Rebind(shift));
+        for (const auto &var: grid_vars) sys_grid.AxisVariable(var, nom_grid.AxisVariable(var).Rebind(shift));
+        grids.push_back(sys_grid);
+        ydefs.push_back(yielddef(sys_grid, grids.size()-1, nom_wgt, sys.ind+ishift, nshifts));
       }
+      nyields += nbins*nshifts;
     } else if (sys.sys_type == kMetSwap){
-      for (auto &bin: v_bins) {
-	bcuts.emplace_back(nom2genmet("("+baseline+"&&"+bin.cut)+")*"+nom_wgt);
-      }
+      BinGrid sys_grid(nom_grid);
+      const NamedFunc::Bindings genmet = nom2genmet_bindings();
+      sys_grid.Cut(nom_grid.Cut().Rebind(genmet)).AxisVariable("met", nom_grid.AxisVariable("met").Rebind(genmet));
+      grids.push_back(sys_grid);
+      ydefs.push_back(yielddef(sys_grid, grids.size()-1, nom_wgt, sys.ind, 1));
+      nyields += nbins;
     } else if (sys.sys_type == kPU) {
-      for(const auto &bin: v_bins){
-        bcuts.emplace_back("("+baseline+"&&"+bin.cut+"&&"+"ntrupv<=20)*"+nom_wgt);
-        bcuts.emplace_back("(ntrupv<=20)*"+nom_wgt);
-        bcuts.emplace_back("("+baseline+"&&"+bin.cut+"&&"+"ntrupv>=21)*"+nom_wgt);
-        bcuts.emplace_back("(ntrupv>=21)*"+nom_wgt);
-      }
+      // denominators are the inclusive yields, the same for every bin
+      grids.push_back(BinGrid().AddRegion("inclusive"));
+      size_t incl = grids.size()-1;
+      ydefs.push_back(yielddef(nom_grid, 0, "(ntrupv<=20)*"+nom_wgt, sys.ind+0, 4));
+      ydefs.push_back(yielddef(grids.back(), incl, "(ntrupv<=20)*"+nom_wgt, sys.ind+1, 4, true));
+      ydefs.push_back(yielddef(nom_grid, 0, "(ntrupv>=21)*"+nom_wgt, sys.ind+2, 4));
+      ydefs.push_back(yielddef(grids.back(), incl, "(ntrupv>=21)*"+nom_wgt, sys.ind+3, 4, true));
+      nyields += 4*nbins;
     }
   }
   
-  // get yields from the baby for all the cut strings
+  // in directory mode (no --infile), every SMS .root file in infolder is processed concurrently,
+  // sharing the definitions above
+  vector<string> infiles;
+  if (infile != "") infiles.push_back(infile.Data());
+  else for (const auto &path: Glob((infolder+"/*mGluino-*_mLSP-*.root").Data())) infiles.push_back(Basename(path));
+  for (auto file = infiles.begin(); file != infiles.end(); ) {
+    int mglu, mlsp;
+    if (parseMasses(*file, mglu, mlsp)) {
+      ++file;
+    } else {
+      cout<<"WARNING: Skipping "<<*file<<", could not read the masses from its name"<<endl;
+      file = infiles.erase(file);
+    }
+  }
+  if (infiles.empty()) ERROR("No SMS files to process in "+string(infolder.Data()));
+  size_t nthreads = num_threads ? num_threads : thread::hardware_concurrency();
+  nthreads = max(static_cast<size_t>(1), min(nthreads, infiles.size()));
+  cout<<"Processing "<<infiles.size()<<" files with "<<nthreads<<" threads"<<endl;
+  if (nthreads == 1) {
+    for (const auto &file: infiles) processFile(infolder, outfolder, file, v_sys, v_bins, grids, ydefs, nyields);
+  } else {
+    ThreadPool tp(nthreads);
+    vector<future<void> > done;
+    for (const auto &file: infiles) {
+      done.push_back(tp.Push(processFile, cref(infolder), cref(outfolder), cref(file), cref(v_sys), cref(v_bins),
+                             cref(grids), cref(ydefs), nyields));
+    }
+    for (auto &file_done: done) file_done.get();
+  }
+
+  time(&endtime); 
+  cout<<endl<<"Took "<<difftime(endtime, begtime)<<" seconds"<<endl<<endl;
+}
+
+void processFile(const TString &infolder, const TString &outfolder, const string &infile,
+                 const vector<sysdef> &v_sys, const vector<bindef> &v_bins,
+                 const vector<BinGrid> &grids, vector<yielddef> ydefs, size_t nyields){
+  // TString infile = "/cms2r0/babymaker/babies/2015_11_27/sms/split_sms/renorm/baby_SMS-T1tttt_mGluino-1500_mLSP-100_TuneCUETP8M1_13TeV-madgraphMLM-pythia8_RunIISpring15FSPremix-MCRUN2_74_V9_renorm.root";
+  string prs = infile;
+  int mglu, mlsp;
+  if (!parseMasses(prs, mglu, mlsp)) ERROR("Could not read the masses from "+prs);
+  {
+    lock_guard<mutex> lock(print_mutex);
+    cout<<"Working on: mGluino = "<<mglu<<" mLSP = "<<mlsp<<endl;
+  }
+  string glu_lsp("mGluino-"+to_string(mglu)+"_mLSP-"+to_string(mlsp));
+  string model = "T1tttt";
+  if(Contains(prs, "T5tttt")) model = "T5tttt";
+  if(Contains(prs, "T5tttt-Stop")) model = "T5tttt-Stop";
+  if(Contains(prs, "T5tttt-degen")) model = "T5tttt-degen";
+  if(Contains(prs, "T2tt")) model = "T2tt";
+  if(Contains(prs, "T6ttWW")) model = "T6ttWW";
+
+  size_t nbins = v_bins.size();
+
+  // get yields from the baby for all the grids and weights
   Baby_full baby(std::set<std::string>{(infolder+"/"+infile).Data()});
   auto activator = baby.Activate();
   vector<double> yields, w2, entries;
-  entries = getYields(baby, baseline, bcuts, yields, w2, luminosity.Atof());
+  PUAccumulator pu(v_data_npv);
+  entries = getYields(baby, grids, ydefs, nbins, nyields, yields, w2, luminosity.Atof(), pu);
 
 
   //calculate uncertainties and write results to three files
   TString outpath = outfolder+"/sys_SMS-"+TString(model)+"_"+glu_lsp+"_"+luminosity+"ifb";
-  cout<<"Writing to "<<outpath<<endl;
+  {
+    lock_guard<mutex> lock(print_mutex);
+    cout<<"Writing to "<<outpath<<endl;
+  }
   ofstream fsys(outpath);
   fillTtbarSys(fsys);
   // ofstream fsysrms(outpath.ReplaceAll("sys_","sysrms_"));
   // fillTtbarSys(fsysrms);
   ofstream fsysdbg(outpath.ReplaceAll("sys_","sysdbg_"));
   ofstream fsysent(outpath.ReplaceAll("sysdbg_","sysent_"));
-  size_t nbins = v_bins.size();
   for (auto &sys: v_sys) {
     if (sys.tag != "nominal") {
       if (sys.tag != "rms_pdf") fsys<<"\nSYSTEMATIC "<<sys.tag<<"\n  PROCESSES signal\n";
@@ -286,15 +361,7 @@ int main(int argc, char *argv[]){
       } else if (sys.sys_type == kPU ) {
         double eff_low  = yields[sys.ind+4*ibin+0]/yields[sys.ind+4*ibin+1];
         double eff_high = yields[sys.ind+4*ibin+2]/yields[sys.ind+4*ibin+3];
-        double m = (eff_high-eff_low)/(pu_high-pu_low);
-        double b = (eff_low*pu_high-eff_high*pu_low)/(pu_high-pu_low);
-        double eff_data = 0., eff_mc = 0.;
-        for(size_t i = 0; i < v_data_npv.size(); ++i){
-          double fx = m*static_cast<double>(i)+b;
-          eff_data += fx*h_data_npv.GetBinContent(i+1);
-          eff_mc += fx*h_mc_npv.GetBinContent(i+1);
-        }
-        up = (eff_data-eff_mc)/eff_mc;
+        up = pu.Uncertainty(eff_low, eff_high);
         dn = -up;
 
         //Temporary stand-in until better method available
@@ -332,25 +399,35 @@ int main(int argc, char *argv[]){
   // fsysrms.close();
   fsysdbg.close();
   fsysent.close();
-
-  time(&endtime); 
-  cout<<endl<<"Took "<<difftime(endtime, begtime)<<" seconds"<<endl<<endl;
 }
 
-TString nom2sys_bin(TString ibin, size_t shift_index){
-  ibin.ReplaceAll("met", "sys_met["+to_string(shift_index)+"]");
-  ibin.ReplaceAll("mt", "sys_mt["+to_string(shift_index)+"]");
-  ibin.ReplaceAll("st", "sys_st["+to_string(shift_index)+"]");
-  ibin.ReplaceAll("mj14", "sys_mj14["+to_string(shift_index)+"]");
-  ibin.ReplaceAll("njets", "sys_njets["+to_string(shift_index)+"]");
-  ibin.ReplaceAll("nbm", "sys_nbm["+to_string(shift_index)+"]");
-  return ibin;
+NamedFunc::Bindings nom2sys_bindings(size_t shift_index){
+  // variables are replaced as whole names, so e.g. met_calo is left untouched
+  const vector<string> vars{"met", "mt", "st", "mj14", "njets", "nbm"};
+  NamedFunc::Bindings bindings;
+  for (const auto &var: vars) bindings.emplace(var, NamedFunc("sys_"+var+"["+to_string(shift_index)+"]"));
+  return bindings;
 }
 
-TString nom2genmet(TString ibin){
-  ibin.ReplaceAll("met", "met_tru");
-  return ibin;
+NamedFunc::Bindings nom2genmet_bindings(){
+  return NamedFunc::Bindings{{"met", NamedFunc("met_tru")}};
+}
 
+// reads the masses from names like baby_SMS-T1tttt_mGluino-1500_mLSP-100_TuneCUETP8M1_...root;
+// returns false if the name does not have that form
+bool parseMasses(const string &infile, int &mglu, int &mlsp){
+  size_t glu_pos = infile.find("mGluino-"), lsp_pos = infile.find("_mLSP-");
+  if (glu_pos == string::npos || lsp_pos == string::npos || lsp_pos < glu_pos) return false;
+  glu_pos += 8;
+  lsp_pos += 6;
+  size_t glu_end = infile.find_first_not_of("0123456789", glu_pos);
+  size_t lsp_end = infile.find_first_not_of("0123456789", lsp_pos);
+  if (glu_end == glu_pos || glu_end != lsp_pos-6 || glu_end-glu_pos > 9
+      || lsp_end == lsp_pos || lsp_end == string::npos || lsp_end-lsp_pos > 9
+      || infile.compare(lsp_end, 5, "_Tune") != 0) return false;
+  mglu = stoi(infile.substr(glu_pos, glu_end-glu_pos));
+  mlsp = stoi(infile.substr(lsp_pos, lsp_end-lsp_pos));
+  return true;
 }
 
 void GetOptions(int argc, char *argv[], TString &infolder, TString &outfolder, TString &infile){
@@ -364,12 +441,13 @@ void GetOptions(int argc, char *argv[], TString &infolder, TString &outfolder, T
       {"lumi", required_argument, 0, 'l'},
       {"alt_bin", no_argument, 0, 'b'},
       {"fake_PU", no_argument, 0, 0},
+      {"threads", required_argument, 0, 'j'},
       {0, 0, 0, 0}
     };
 
     char opt = -1;
     int option_index;
-    opt = getopt_long(argc, argv, "s:i:f:o:l:b", long_options, &option_index);
+    opt = getopt_long(argc, argv, "s:i:f:o:l:bj:", long_options, &option_index);
     if( opt == -1) break;
 
     string optname;
@@ -379,6 +457,7 @@ void GetOptions(int argc, char *argv[], TString &infolder, TString &outfolder, T
     case 'f': infile = optarg; break;
     case 'o': outfolder = optarg; break;
     case 'l': luminosity = optarg; break;
+    case 'j': num_threads = atoi(optarg); break;
     case 0:
       optname = long_options[option_index].name;
       if(optname == "fake_PU"){
@@ -443,66 +522,52 @@ void fillTtbarSys(ofstream &fsys){
     fsys << endl;
 }
 
-vector<double> getYields(Baby_full &baby, const NamedFunc &/*baseline*/, const vector<NamedFunc> &bincuts,
-                         vector<double> &yield, vector<double> &w2, double lumi,
+vector<double> getYields(Baby_full &baby, const vector<BinGrid> &grids, vector<yielddef> &ydefs,
+                         size_t nbins, size_t nyields,
+                         vector<double> &yield, vector<double> &w2, double lumi, PUAccumulator &pu,
                          bool do_trig, const TString &flag){
-  for(size_t i = 0; i <v_data_npv.size(); ++i){
-    h_data_npv.SetBinContent(i+1, v_data_npv.at(i));
-    h_data_npv.SetBinError(i+1, 0.);
-    h_mc_npv.SetBinContent(i+1, 0.);
-    h_mc_npv.SetBinError(i+1, 0.);
-  }
-  
-  vector<double> entries = vector<double>(bincuts.size(), 0);
-  yield = vector<double>(bincuts.size(), 0);
+  pu.Clear();
+  vector<double> entries = vector<double>(nyields, 0);
+  yield = vector<double>(nyields, 0);
   w2 = yield;
+  vector<long> cells(grids.size(), -1);
 
   long nentries = baby.GetEntries();
 
   for(long entry = 0; entry < nentries; ++entry){
     baby.GetEntry(entry);
-    h_mc_npv.Fill(baby.ntrupv(), baby.weight()*baby.eff_trig());
+    pu.Fill(baby.ntrupv(), baby.weight()*baby.eff_trig());
     if(do_trig){
       if(!baby.pass()) continue;
       if(!baby.trig()->at(4) && !baby.trig()->at(8) && !baby.trig()->at(13) && !baby.trig()->at(33)) continue;
     }
-    //if(!baseline.GetScalar(baby)) continue;
-    for(size_t ind = 0; ind<bincuts.size(); ++ind){
-      float wgt = bincuts.at(ind).GetScalar(baby);
-      if(wgt != 0.){
-	++entries.at(ind);
-	
-	if(flag=="jer_tail"){
-	  double jet_res_min = *min_element(baby.jets_pt_res()->begin(), baby.jets_pt_res()->end());
-	  double jet_res_max = *max_element(baby.jets_pt_res()->begin(), baby.jets_pt_res()->end());
-	  if((jet_res_min>0&&jet_res_min<0.675) || jet_res_max>1.391)
-	    wgt *= 1.5;
-	}
-
-        yield.at(ind) += wgt;
-        w2.at(ind) += wgt*wgt;
+    for(size_t igrid = 0; igrid < grids.size(); ++igrid){
+      cells.at(igrid) = grids.at(igrid).CellIndex(baby);
+    }
+    for(auto &ydef: ydefs){
+      long cell = cells.at(ydef.grid_index);
+      if(cell < 0) continue;
+      double wgt = ydef.wgt.GetScalar(baby);
+      if(wgt == 0.) continue;
+
+      if(flag=="jer_tail"){
+        double jet_res_min = *min_element(baby.jets_pt_res()->begin(), baby.jets_pt_res()->end());
+        double jet_res_max = *max_element(baby.jets_pt_res()->begin(), baby.jets_pt_res()->end());
+        if((jet_res_min>0&&jet_res_min<0.675) || jet_res_max>1.391)
+          wgt *= 1.5;
       }
+
+      ydef.sums.Fill(cell, wgt);
     }
   } // Loop over entries
-  for(size_t ind = 0; ind<bincuts.size(); ++ind){ 
-     yield.at(ind) *= lumi;
-     w2.at(ind) *= pow(lumi, 2);
-  }
-  h_data_npv.Scale(1./h_data_npv.Integral());
-  h_mc_npv.Scale(1./h_mc_npv.Integral());
-  pu_low = 0.;
-  pu_high = 0.;
-  double norm = 0.;
-  for(size_t npv = 0; npv <= 20 && npv < v_data_npv.size(); ++npv){
-    pu_low += npv*h_mc_npv.GetBinContent(npv+1);
-    norm += h_mc_npv.GetBinContent(npv+1);
-  }
-  pu_low /= norm;
-  norm = 0.;
-  for(size_t npv = 21; npv < v_data_npv.size(); ++npv){
-    pu_high += npv*h_mc_npv.GetBinContent(npv+1);
-    norm += h_mc_npv.GetBinContent(npv+1);
+  for(const auto &ydef: ydefs){
+    for(size_t ibin = 0; ibin < nbins; ++ibin){
+      size_t iregion = ydef.inclusive ? 0 : ibin;
+      size_t ind = ydef.first + ydef.stride*ibin;
+      entries.at(ind) = ydef.sums.Entries(iregion);
+      yield.at(ind) = ydef.sums.SumW(iregion)*lumi;
+      w2.at(ind) = ydef.sums.SumW2(iregion)*pow(lumi, 2);
+    }
   }
-  pu_high /= norm;
   return entries;
 }
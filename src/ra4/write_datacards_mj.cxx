@@ -15,6 +15,7 @@
 
 #include "core/named_func.hpp"
 #include "core/baby_full.hpp"
+#include "core/pu_accumulator.hpp"
 #include "core/utilities.hpp"
 
 using namespace std;
@@ -26,10 +27,6 @@ namespace {
   TString syst = "all";
 
   const vector<double> v_data_npv{6.540e-06, 2.294e-05, 6.322e-05, 8.558e-05, 1.226e-04, 1.642e-04, 1.917e-04, 3.531e-04, 9.657e-04, 2.155e-03, 4.846e-03, 9.862e-03, 1.651e-02, 2.401e-02, 3.217e-02, 4.078e-02, 4.818e-02, 5.324e-02, 5.612e-02, 5.756e-02, 5.841e-02, 5.886e-02, 5.831e-02, 5.649e-02, 5.376e-02, 5.044e-02, 4.667e-02, 4.257e-02, 3.833e-02, 3.406e-02, 2.982e-02, 2.567e-02, 2.169e-02, 1.799e-02, 1.464e-02, 1.170e-02, 9.178e-03, 7.058e-03, 5.306e-03, 3.884e-03, 2.757e-03, 1.890e-03, 1.247e-03, 7.901e-04, 4.795e-04, 2.783e-04, 1.544e-04, 8.181e-05, 4.141e-05, 2.004e-05, 9.307e-06, 4.178e-06, 1.846e-06, 8.350e-07, 4.150e-07, 2.458e-07, 1.779e-07, 1.488e-07, 1.339e-07, 1.238e-07, 1.153e-07, 1.071e-07, 9.899e-08, 9.095e-08, 8.301e-08, 7.527e-08, 6.778e-08, 6.063e-08, 5.387e-08, 4.753e-08, 4.166e-08, 3.627e-08, 3.136e-08, 2.693e-08, 2.297e-08};
-  TH1D h_data_npv("h_data_npv", "Data;N_{PV};P(N_{PV})", v_data_npv.size(), -0.5, v_data_npv.size()-0.5);
-  TH1D h_mc_npv("h_mc_npv", "MC;N_{PV};P(N_{PV})", v_data_npv.size(), -0.5, v_data_npv.size()-0.5);
-  double pu_low = 0.;
-  double pu_high = 0.;
   bool do_syst = true;
 }
 
@@ -61,13 +58,13 @@ public:
   size_t ind;
 };
 
-TString nom2sys_bin(TString ibin, size_t shift_index);
-TString nom2genmet(TString ibin);
+NamedFunc::Bindings nom2sys_bindings(size_t shift_index);
+NamedFunc::Bindings nom2genmet_bindings();
 void GetOptions(int argc, char *argv[], TString &infolder, TString &outfolder, TString &infile);
 void fillTtbarSys(ofstream &fsys);
 
 vector<double> getYields(Baby_full &baby, const NamedFunc &baseline, const vector<NamedFunc> &bincuts,
-                         vector<double> &yield, vector<double> &w2, double lumi,
+                         vector<double> &yield, vector<double> &w2, double lumi, PUAccumulator &pu,
                          bool do_trig = false, const TString &flag = "");
 
 int main(int argc, char *argv[]){
@@ -198,6 +195,10 @@ int main(int argc, char *argv[]){
     cerr<<" The first entry in the v_sys vector must be the nominal"<<endl;
     exit(1);
   }
+  // each bin cut is parsed once; shifted systematics rebind its variables, sharing all unshifted sub-cuts
+  const NamedFunc nom_wgt_func(nom_wgt);
+  vector<NamedFunc> bin_cuts;
+  for (const auto &bin: v_bins) bin_cuts.emplace_back("("+baseline+"&&"+bin.cut+")");
   for (auto &sys: v_sys) {
     sys.ind = bcuts.size(); 
     if (sys.sys_type == kConst){
@@ -209,15 +210,18 @@ int main(int argc, char *argv[]){
         }
       }
     } else if (sys.sys_type == kCorr || sys.sys_type == kSmear) {
-      for (auto &bin: v_bins) {
-        bcuts.emplace_back(nom2sys_bin("("+baseline+"&&"+bin.cut, sys.shift_index)+")*"+nom_wgt);
+      const NamedFunc::Bindings shift = nom2sys_bindings(sys.shift_index);
+      const NamedFunc::Bindings shift_down = nom2sys_bindings(sys.shift_index+1);
+      for (const auto &cut: bin_cuts) {
+        bcuts.push_back(cut.Rebind(shift)*nom_wgt_func);
         if (sys.sys_type == kCorr) { //if it is a correction, need to push the 'down' variation as well
-          bcuts.emplace_back(nom2sys_bin("("+baseline+"&&"+bin.cut, sys.shift_index+1)+")*"+nom_wgt);
+          bcuts.push_back(cut.Rebind(shift_down)*nom_wgt_func);
         }
       }
     } else if (sys.sys_type == kMetSwap){
-      for (auto &bin: v_bins) {
-        bcuts.emplace_back(nom2genmet("("+baseline+"&&"+bin.cut)+")*"+nom_wgt);
+      const NamedFunc::Bindings genmet = nom2genmet_bindings();
+      for (const auto &cut: bin_cuts) {
+        bcuts.push_back(cut.Rebind(genmet)*nom_wgt_func);
       }
     } else if (sys.sys_type == kPU) {
       for(const auto &bin: v_bins){
@@ -233,7 +237,8 @@ int main(int argc, char *argv[]){
   Baby_full baby(std::set<std::string>{(infolder+"/"+infile).Data()});
   auto activator = baby.Activate();
   vector<double> yields, w2, entries;
-  entries = getYields(baby, baseline, bcuts, yields, w2, luminosity.Atof());
+  PUAccumulator pu(v_data_npv);
+  entries = getYields(baby, baseline, bcuts, yields, w2, luminosity.Atof(), pu);
 
   // calculate average of yields with GEN and RECO MET
   vector<float> nom_met_avg_yield, nom_met_avg_w2;
@@ -365,15 +370,7 @@ int main(int argc, char *argv[]){
       } else if (sys.sys_type == kPU ) {
         double eff_low  = yields[sys.ind+4*ibin+0]/yields[sys.ind+4*ibin+1];
         double eff_high = yields[sys.ind+4*ibin+2]/yields[sys.ind+4*ibin+3];
-        double m = (eff_high-eff_low)/(pu_high-pu_low);
-        double b = (eff_low*pu_high-eff_high*pu_low)/(pu_high-pu_low);
-        double eff_data = 0., eff_mc = 0.;
-        for(size_t i = 0; i < v_data_npv.size(); ++i){
-          double fx = m*static_cast<double>(i)+b;
-          eff_data += fx*h_data_npv.GetBinContent(i+1);
-          eff_mc += fx*h_mc_npv.GetBinContent(i+1);
-        }
-        up = (eff_data-eff_mc)/eff_mc;
+        up = pu.Uncertainty(eff_low, eff_high);
         dn = -up;
 
         //Temporary stand-in until better method available
@@ -488,20 +485,16 @@ int main(int argc, char *argv[]){
   cout<<endl<<"Took "<<difftime(endtime, begtime)<<" seconds"<<endl<<endl;
 }
 
-TString nom2sys_bin(TString ibin, size_t shift_index){
-  ibin.ReplaceAll("met", "sys_met["+to_string(shift_index)+"]");
-  ibin.ReplaceAll("mt", "sys_mt["+to_string(shift_index)+"]");
-  ibin.ReplaceAll("st", "sys_st["+to_string(shift_index)+"]");
-  ibin.ReplaceAll("mj14", "sys_mj14["+to_string(shift_index)+"]");
-  ibin.ReplaceAll("njets", "sys_njets["+to_string(shift_index)+"]");
-  ibin.ReplaceAll("nbm", "sys_nbm["+to_string(shift_index)+"]");
-  return ibin;
+NamedFunc::Bindings nom2sys_bindings(size_t shift_index){
+  // variables are replaced as whole names, so e.g. met_tru is left untouched
+  const vector<string> vars{"met", "mt", "st", "mj14", "njets", "nbm"};
+  NamedFunc::Bindings bindings;
+  for (const auto &var: vars) bindings.emplace(var, NamedFunc("sys_"+var+"["+to_string(shift_index)+"]"));
+  return bindings;
 }
 
-TString nom2genmet(TString ibin){
-  ibin.ReplaceAll("met", "met_tru");
-  return ibin;
-
+NamedFunc::Bindings nom2genmet_bindings(){
+  return NamedFunc::Bindings{{"met", NamedFunc("met_tru")}};
 }
 
 void GetOptions(int argc, char *argv[], TString &infolder, TString &outfolder, TString &infile){
@@ -598,15 +591,9 @@ void fillTtbarSys(ofstream &fsys){
 }
 
 vector<double> getYields(Baby_full &baby, const NamedFunc &/*baseline*/, const vector<NamedFunc> &bincuts,
-                         vector<double> &yield, vector<double> &w2, double lumi,
+                         vector<double> &yield, vector<double> &w2, double lumi, PUAccumulator &pu,
                          bool do_trig, const TString &flag){
-  for(size_t i = 0; i <v_data_npv.size(); ++i){
-    h_data_npv.SetBinContent(i+1, v_data_npv.at(i));
-    h_data_npv.SetBinError(i+1, 0.);
-    h_mc_npv.SetBinContent(i+1, 0.);
-    h_mc_npv.SetBinError(i+1, 0.);
-  }
-  
+  pu.Clear();
   vector<double> entries = vector<double>(bincuts.size(), 0);
   yield = vector<double>(bincuts.size(), 0);
   w2 = yield;
@@ -615,7 +602,7 @@ vector<double> getYields(Baby_full &baby, const NamedFunc &/*baseline*/, const v
 
   for(long entry = 0; entry < nentries; ++entry){
     baby.GetEntry(entry);
-    h_mc_npv.Fill(baby.ntrupv(), baby.weight()*baby.eff_trig());
+    pu.Fill(baby.ntrupv(), baby.weight()*baby.eff_trig());
     if(do_trig){
       if(!baby.pass()) continue;
       if(!baby.trig()->at(4) && !baby.trig()->at(8) && !baby.trig()->at(13) && !baby.trig()->at(33)) continue;
@@ -642,21 +629,5 @@ vector<double> getYields(Baby_full &baby, const NamedFunc &/*baseline*/, const v
      yield.at(ind) *= lumi;
      w2.at(ind) *= pow(lumi, 2);
   }
-  h_data_npv.Scale(1./h_data_npv.Integral());
-  h_mc_npv.Scale(1./h_mc_npv.Integral());
-  pu_low = 0.;
-  pu_high = 0.;
-  double norm = 0.;
-  for(size_t npv = 0; npv <= 20 && npv < v_data_npv.size(); ++npv){
-    pu_low += npv*h_mc_npv.GetBinContent(npv+1);
-    norm += h_mc_npv.GetBinContent(npv+1);
-  }
-  pu_low /= norm;
-  norm = 0.;
-  for(size_t npv = 21; npv < v_data_npv.size(); ++npv){
-    pu_high += npv*h_mc_npv.GetBinContent(npv+1);
-    norm += h_mc_npv.GetBinContent(npv+1);
-  }
-  pu_high /= norm;
   return entries;
 }